@@ -49,6 +49,10 @@ static inline u64 paravirt_steal_clock(int cpu)
 void __init paravirt_set_cap(void);
 #endif
 
+#if defined(CONFIG_PARAVIRT_SPINLOCKS) && defined(CONFIG_NUMA_AWARE_SPINLOCKS)
+void __init cna_configure_spin_lock_slowpath(void);
+#endif
+
 /* The paravirtualized I/O functions */
 static inline void slow_down_io(void)
 {
@@ -791,5 +795,11 @@ static inline void paravirt_set_cap(void)
 {
 }
 #endif
+
+#if !defined(CONFIG_PARAVIRT_SPINLOCKS) || !defined(CONFIG_NUMA_AWARE_SPINLOCKS)
+static inline void cna_configure_spin_lock_slowpath(void)
+{
+}
+#endif
 #endif /* __ASSEMBLY__ */
 #endif /* _ASM_X86_PARAVIRT_H */
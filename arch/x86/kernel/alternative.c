@@ -928,6 +928,12 @@ void __init alternative_instructions(void)
 	 */
 	paravirt_set_cap();
 
+	/*
+	 * Pick the NUMA-aware spinlock slowpath, if wanted, before the
+	 * paravirt call sites get patched.
+	 */
+	cna_configure_spin_lock_slowpath();
+
 	/*
 	 * First patch paravirt functions, such that we overwrite the indirect
 	 * call with the direct call.
@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Learning CPU idle governor
+ *
+ * Based on the timer events oriented (TEO) governor.
+ */
+
+/**
+ * DOC: learn-description
+ *
+ * The teo and menu governors pick the deepest idle state that fits the
+ * predicted idle duration and correct that prediction with fixed rules. This
+ * governor instead learns, per CPU, how long the CPU actually stays idle
+ * given what was predicted, and picks the idle state with the lowest expected
+ * energy over that distribution.
+ *
+ * Idle durations are mapped to bins aligned with the target residencies of
+ * the idle states, like in teo: bin i spans from the target residency of idle
+ * state i up to, but not including, the one of idle state i + 1.
+ *
+ * Before selecting a state, the governor computes the predicted idle
+ * duration, the time till the closest timer event (the sleep length) or, if
+ * the irq timings predict an interrupt earlier than that, the time till that
+ * interrupt. The bin of the prediction selects a row of the per-CPU model.
+ * Every row holds decaying weights of the bins the measured idle duration
+ * fell into the previous times this prediction was made. It starts out
+ * trusting the prediction, with all of its weight in the predicted bin.
+ *
+ * The energy spent in idle state s over an idle period of length d is modeled
+ * as E(s) + P(s) * d. P(s) is the power draw of the state and E(s) the energy
+ * of entering and leaving it, chosen such that state s breaks even with
+ * state 0 after its target residency. The driver's power_usage figures are
+ * used if they decrease with depth, otherwise every state draws half the
+ * power of the previous one. The expected energy of a state is then the sum
+ * over the bins of the row of the weight of the bin times the energy for the
+ * middle of the bin, and the governor selects the enabled state with the
+ * lowest one among those whose exit latency meets the latency constraint
+ * and whose target residency does not exceed the sleep length.
+ *
+ * After wakeup, a selection is accounted as a hit, as "early" if the CPU
+ * woke up before the target residency of the selected state (too deep), or
+ * as "late" if an enabled deeper state would have fit the measured idle
+ * duration (too shallow). The counts are exposed per CPU in
+ * /sys/devices/system/cpu/cpuN/cpuidle_learn/ and can be compared with the
+ * "above" and "below" counts of the idle states under other governors.
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpuidle.h>
+#include <linux/device.h>
+#include <linux/interrupt.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/sched/clock.h>
+#include <linux/tick.h>
+#include <linux/workqueue.h>
+
+/*
+ * The PULSE value is added to the model when the measured idle duration falls
+ * into a bin and the DECAY_SHIFT value is used for decreasing the weights of
+ * a row every time it is updated.
+ */
+#define PULSE		1024
+#define DECAY_SHIFT	3
+
+/* Power of the shallowest state when the driver doesn't provide figures */
+#define LEARN_POWER_MAX	1024
+
+/**
+ * struct learn_cpu - CPU data used by the learning cpuidle governor.
+ * @time_span_ns: Time between idle state selection and post-wakeup update.
+ * @sleep_length_ns: Time till the closest timer event (at the selection time).
+ * @predicted_bin: Bin of the predicted idle duration (at the selection time).
+ * @model: Weights of the measured idle duration bins for each predicted bin.
+ * @power: Modeled power draw of each idle state.
+ * @energy: Modeled energy of entering and leaving each idle state.
+ * @hits: Selections fitting the measured idle duration.
+ * @early: Selections of states too deep for the measured idle duration.
+ * @late: Selections of states too shallow for the measured idle duration.
+ * @irq_predictions: Predictions based on the irq timings.
+ */
+struct learn_cpu {
+	s64 time_span_ns;
+	s64 sleep_length_ns;
+	int predicted_bin;
+	unsigned int model[CPUIDLE_STATE_MAX][CPUIDLE_STATE_MAX];
+	u64 power[CPUIDLE_STATE_MAX];
+	u64 energy[CPUIDLE_STATE_MAX];
+	u64 hits;
+	u64 early;
+	u64 late;
+	u64 irq_predictions;
+};
+
+static DEFINE_PER_CPU(struct learn_cpu, learn_cpus);
+
+/**
+ * learn_bin - Find the bin of an idle duration.
+ * @drv: cpuidle driver containing state data.
+ * @duration_ns: Idle duration.
+ */
+static int learn_bin(struct cpuidle_driver *drv, s64 duration_ns)
+{
+	int i;
+
+	for (i = drv->state_count - 1; i > 0; i--)
+		if (drv->states[i].target_residency_ns <= duration_ns)
+			break;
+	return i;
+}
+
+/**
+ * learn_bin_span - Idle duration representing a bin.
+ * @drv: cpuidle driver containing state data.
+ * @bin: Bin index.
+ * @sleep_length_ns: Time till the closest timer event.
+ *
+ * The closest timer wakes the CPU up anyway, so the idle duration can't
+ * exceed the sleep length.
+ */
+static s64 learn_bin_span(struct cpuidle_driver *drv, int bin,
+			  s64 sleep_length_ns)
+{
+	s64 span_ns = 2 * drv->states[bin].target_residency_ns;
+
+	if (bin < drv->state_count - 1)
+		span_ns = (drv->states[bin].target_residency_ns +
+			   drv->states[bin + 1].target_residency_ns) / 2;
+
+	return min(span_ns, sleep_length_ns);
+}
+
+/**
+ * learn_predict - Predict the idle duration.
+ * @cpu_data: Governor data of the CPU.
+ * @sleep_length_ns: Time till the closest timer event.
+ * @now: Current local_clock() time.
+ */
+static s64 learn_predict(struct learn_cpu *cpu_data, s64 sleep_length_ns,
+			 u64 now)
+{
+#ifdef CONFIG_IRQ_TIMINGS
+	u64 next_irq = irq_timings_next_event(now);
+
+	if (next_irq != U64_MAX && (s64)(next_irq - now) < sleep_length_ns) {
+		cpu_data->irq_predictions++;
+		return next_irq - now;
+	}
+#endif
+	return sleep_length_ns;
+}
+
+/**
+ * learn_update - Update the CPU model after wakeup.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ */
+static void learn_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct learn_cpu *cpu_data = per_cpu_ptr(&learn_cpus, dev->cpu);
+	unsigned int *row = cpu_data->model[cpu_data->predicted_bin];
+	int i, selected = dev->last_state_idx, measured_bin;
+	s64 measured_ns;
+
+	if (cpu_data->time_span_ns >= cpu_data->sleep_length_ns) {
+		/*
+		 * One of the safety nets has triggered or the CPU was woken up
+		 * by the closest timer, either way it could have been idle for
+		 * the entire sleep length.
+		 */
+		measured_ns = cpu_data->sleep_length_ns;
+	} else {
+		u64 lat_ns = drv->states[selected].exit_latency_ns;
+
+		/*
+		 * Take 1/2 of the exit latency as a very rough approximation
+		 * of the average delay between the wakeup and the first
+		 * instruction executed by the CPU, like teo does.
+		 */
+		measured_ns = dev->last_residency_ns;
+		if (measured_ns >= lat_ns)
+			measured_ns -= lat_ns / 2;
+		else
+			measured_ns /= 2;
+	}
+
+	measured_bin = learn_bin(drv, measured_ns);
+
+	for (i = 0; i < drv->state_count; i++)
+		row[i] -= row[i] >> DECAY_SHIFT;
+	row[measured_bin] += PULSE;
+
+	if (measured_ns < drv->states[selected].target_residency_ns) {
+		cpu_data->early++;
+		return;
+	}
+
+	for (i = measured_bin; i > selected; i--) {
+		if (!dev->states_usage[i].disable) {
+			cpu_data->late++;
+			return;
+		}
+	}
+	cpu_data->hits++;
+}
+
+/**
+ * learn_find_shallower_state - Find shallower idle state matching given
+ * duration.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ * @state_idx: Index of the capping idle state.
+ * @duration_ns: Idle duration value to match.
+ */
+static int learn_find_shallower_state(struct cpuidle_driver *drv,
+				      struct cpuidle_device *dev, int state_idx,
+				      s64 duration_ns)
+{
+	int i;
+
+	for (i = state_idx - 1; i >= 0; i--) {
+		if (dev->states_usage[i].disable)
+			continue;
+
+		state_idx = i;
+		if (drv->states[i].target_residency_ns <= duration_ns)
+			break;
+	}
+	return state_idx;
+}
+
+/**
+ * learn_select - Selects the next idle state to enter.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ * @stop_tick: Indication on whether or not to stop the scheduler tick.
+ */
+static int learn_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
+			bool *stop_tick)
+{
+	struct learn_cpu *cpu_data = per_cpu_ptr(&learn_cpus, dev->cpu);
+	s64 latency_req = cpuidle_governor_latency_req(dev->cpu);
+	s64 span_ns[CPUIDLE_STATE_MAX];
+	u64 cost, best_cost = U64_MAX;
+	ktime_t delta_tick;
+	s64 duration_ns;
+	unsigned int *row;
+	int i, j, idx = 0;
+	u64 now;
+
+	if (dev->last_state_idx >= 0) {
+		learn_update(drv, dev);
+		dev->last_state_idx = -1;
+	}
+
+	now = local_clock();
+	cpu_data->time_span_ns = now;
+
+	cpu_data->sleep_length_ns = tick_nohz_get_sleep_length(&delta_tick);
+	duration_ns = learn_predict(cpu_data, cpu_data->sleep_length_ns, now);
+	cpu_data->predicted_bin = learn_bin(drv, duration_ns);
+
+	/* Check if there is any choice in the first place. */
+	if (drv->state_count < 2)
+		goto end;
+
+	row = cpu_data->model[cpu_data->predicted_bin];
+	for (j = 0; j < drv->state_count; j++)
+		span_ns[j] = learn_bin_span(drv, j, cpu_data->sleep_length_ns);
+
+	for (i = 0; i < drv->state_count; i++) {
+		struct cpuidle_state *s = &drv->states[i];
+
+		if (dev->states_usage[i].disable)
+			continue;
+
+		if (s->exit_latency_ns > latency_req ||
+		    s->target_residency_ns > cpu_data->sleep_length_ns)
+			break;
+
+		cost = 0;
+		for (j = 0; j < drv->state_count; j++)
+			cost += (u64)row[j] * (cpu_data->energy[i] +
+					       cpu_data->power[i] * span_ns[j]);
+
+		/* Ties go to the deeper state */
+		if (cost <= best_cost) {
+			best_cost = cost;
+			idx = i;
+		}
+	}
+
+	/* Expected idle duration over the row, for the tick decision */
+	if (best_cost != U64_MAX) {
+		u64 weight = 0, sum = 0;
+
+		for (j = 0; j < drv->state_count; j++) {
+			weight += row[j];
+			sum += (u64)row[j] * span_ns[j];
+		}
+		if (weight)
+			duration_ns = div64_u64(sum, weight);
+	}
+
+end:
+	/*
+	 * Don't stop the tick if the selected state is a polling one or if the
+	 * expected idle duration is shorter than the tick period length.
+	 */
+	if (((drv->states[idx].flags & CPUIDLE_FLAG_POLLING) ||
+	    duration_ns < TICK_NSEC) && !tick_nohz_tick_stopped()) {
+		*stop_tick = false;
+
+		/*
+		 * The tick is not going to be stopped, so if the target
+		 * residency of the state to be returned is not within the time
+		 * till the closest timer including the tick, try to correct
+		 * that.
+		 */
+		if (idx > 0 &&
+		    drv->states[idx].target_residency_ns > delta_tick)
+			idx = learn_find_shallower_state(drv, dev, idx,
+							 delta_tick);
+	}
+
+	return idx;
+}
+
+/**
+ * learn_reflect - Note that governor data for the CPU need to be updated.
+ * @dev: Target CPU.
+ * @state: Entered state.
+ */
+static void learn_reflect(struct cpuidle_device *dev, int state)
+{
+	struct learn_cpu *cpu_data = per_cpu_ptr(&learn_cpus, dev->cpu);
+
+	dev->last_state_idx = state;
+	/*
+	 * If the wakeup was not "natural", but triggered by one of the safety
+	 * nets, assume that the CPU might have been idle for the entire sleep
+	 * length time.
+	 */
+	if (dev->poll_time_limit ||
+	    (tick_nohz_idle_got_tick() && cpu_data->sleep_length_ns > TICK_NSEC)) {
+		dev->poll_time_limit = false;
+		cpu_data->time_span_ns = cpu_data->sleep_length_ns;
+	} else {
+		cpu_data->time_span_ns = local_clock() - cpu_data->time_span_ns;
+	}
+}
+
+/**
+ * learn_init_energy - Set up the energy model of the idle states.
+ * @drv: cpuidle driver containing state data.
+ * @cpu_data: Governor data of the CPU.
+ */
+static void learn_init_energy(struct cpuidle_driver *drv,
+			      struct learn_cpu *cpu_data)
+{
+	bool valid = drv->states[0].power_usage > 0;
+	int i;
+
+	for (i = 1; i < drv->state_count && valid; i++)
+		valid = drv->states[i].power_usage > 0 &&
+			drv->states[i].power_usage <
+			drv->states[i - 1].power_usage;
+
+	for (i = 0; i < drv->state_count; i++) {
+		if (valid)
+			cpu_data->power[i] = drv->states[i].power_usage;
+		else
+			cpu_data->power[i] = LEARN_POWER_MAX >> min(i, 10);
+
+		/* Break even with state 0 after the target residency */
+		cpu_data->energy[i] = drv->states[i].target_residency_ns *
+				      (cpu_data->power[0] - cpu_data->power[i]);
+	}
+}
+
+/* CPUs using this governor; the irq timings are on while there are any */
+static atomic_t learn_nr_devices = ATOMIC_INIT(0);
+
+/*
+ * The static key cannot be flipped from the enable and disable callbacks,
+ * which may run under the CPU hotplug lock, so leave it to a work item. It
+ * only has to catch up with the last change of learn_nr_devices, and the
+ * work item never runs concurrently with itself.
+ */
+static void learn_timings_fn(struct work_struct *work)
+{
+#ifdef CONFIG_IRQ_TIMINGS
+	static bool timings_on;
+	bool want = atomic_read(&learn_nr_devices) > 0;
+
+	if (want == timings_on)
+		return;
+
+	timings_on = want;
+	if (want)
+		irq_timings_enable();
+	else
+		irq_timings_disable();
+#endif
+}
+static DECLARE_WORK(learn_timings_work, learn_timings_fn);
+
+/**
+ * learn_enable_device - Initialize the governor's data for the target CPU.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ */
+static int learn_enable_device(struct cpuidle_driver *drv,
+			       struct cpuidle_device *dev)
+{
+	struct learn_cpu *cpu_data = per_cpu_ptr(&learn_cpus, dev->cpu);
+	int i;
+
+	memset(cpu_data, 0, sizeof(*cpu_data));
+
+	/* Trust the prediction until there is something to learn from */
+	for (i = 0; i < CPUIDLE_STATE_MAX; i++)
+		cpu_data->model[i][i] = PULSE;
+
+	learn_init_energy(drv, cpu_data);
+
+	/* The irq timings are recorded from the first user on */
+	if (atomic_inc_return(&learn_nr_devices) == 1 &&
+	    IS_ENABLED(CONFIG_IRQ_TIMINGS))
+		schedule_work(&learn_timings_work);
+
+	return 0;
+}
+
+/**
+ * learn_disable_device - Stop using the governor on the target CPU.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ */
+static void learn_disable_device(struct cpuidle_driver *drv,
+				 struct cpuidle_device *dev)
+{
+	/* ... and stop being recorded when the governor is switched away */
+	if (atomic_dec_and_test(&learn_nr_devices) &&
+	    IS_ENABLED(CONFIG_IRQ_TIMINGS))
+		schedule_work(&learn_timings_work);
+}
+
+static struct cpuidle_governor learn_governor = {
+	.name =		"learn",
+	.rating =	15,
+	.enable =	learn_enable_device,
+	.disable =	learn_disable_device,
+	.select =	learn_select,
+	.reflect =	learn_reflect,
+};
+
+static int __init learn_governor_init(void)
+{
+	return cpuidle_register_governor(&learn_governor);
+}
+
+postcore_initcall(learn_governor_init);
+
+#define LEARN_STAT_ATTR(_name)						\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct learn_cpu *cpu_data = per_cpu_ptr(&learn_cpus, dev->id);	\
+									\
+	return sysfs_emit(buf, "%llu\n", READ_ONCE(cpu_data->_name));	\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+LEARN_STAT_ATTR(hits);
+LEARN_STAT_ATTR(early);
+LEARN_STAT_ATTR(late);
+LEARN_STAT_ATTR(irq_predictions);
+
+static struct attribute *learn_stat_attrs[] = {
+	&dev_attr_hits.attr,
+	&dev_attr_early.attr,
+	&dev_attr_late.attr,
+	&dev_attr_irq_predictions.attr,
+	NULL
+};
+
+static const struct attribute_group learn_stat_group = {
+	.name = "cpuidle_learn",
+	.attrs = learn_stat_attrs,
+};
+
+static int __init learn_sysfs_init(void)
+{
+	struct device *cpu_dev;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cpu_dev = get_cpu_device(cpu);
+		if (cpu_dev && sysfs_create_group(&cpu_dev->kobj,
+						  &learn_stat_group))
+			pr_warn("cpuidle: no learn statistics for CPU%d\n", cpu);
+	}
+	return 0;
+}
+late_initcall(learn_sysfs_init);
@@ -576,6 +576,8 @@ __cpufreq_cooling_register(struct device_node *np,
 	if (IS_ERR(cdev))
 		goto remove_qos_req;
 
+	cdev->em_pd = cpufreq_cdev->em;
+
 	return cdev;
 
 remove_qos_req:
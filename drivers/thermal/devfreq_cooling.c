@@ -435,6 +435,7 @@ of_devfreq_cooling_register_power(struct device_node *np, struct devfreq *df,
 	}
 
 	dfc->cdev = cdev;
+	cdev->em_pd = dfc->em_pd;
 
 	return cdev;
 
@@ -8,7 +8,10 @@
 
 #define pr_fmt(fmt) "Power allocator: " fmt
 
+#include <linux/debugfs.h>
+#include <linux/energy_model.h>
 #include <linux/rculist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/thermal.h>
 
@@ -49,6 +52,62 @@ static inline s64 div_frac(s64 x, s64 y)
 	return div_s64(x << FRAC_BITS, y);
 }
 
+#define POWER_GROUP_TRACE_SIZE	64
+
+/**
+ * struct power_group_event - record of an allocation in a power group
+ * @time:	jiffies at the allocation
+ * @tz_id:	thermal zone allocating for its actors
+ * @temperature:	temperature of the thermal zone
+ * @zone_budget:	group budget from the PID controller of the thermal
+ *			zone, U32_MAX if it is below its switch on temperature
+ * @group_budget:	budget of the group, the lowest of all its zones
+ * @req_power:	weighted power requested by the actors of the thermal zone
+ * @max_power:	maximum power of the actors of the thermal zone
+ * @share:	share of the group budget granted to the thermal zone
+ */
+struct power_group_event {
+	unsigned long time;
+	int tz_id;
+	int temperature;
+	u32 zone_budget;
+	u32 group_budget;
+	u32 req_power;
+	u32 max_power;
+	u32 share;
+};
+
+/**
+ * struct power_group - thermal zones sharing one power budget
+ * @node:	entry in the list of power groups
+ * @zones:	power allocator parameters of the thermal zones in the group
+ * @lock:	protects @zones, the group fields of their parameters and the
+ *		trace
+ * @id:		the power_group of the thermal zones' parameters
+ * @debugfs:	debugfs directory of the group
+ * @trace_head:	number of allocations recorded in @trace
+ * @trace:	the most recent allocations
+ *
+ * All of the power actors in the group heat the same package, so every
+ * thermal zone runs its PID controller against the power of the whole group
+ * and the lowest of the resulting budgets applies to the group. That budget
+ * is split between the zones like the budget of a zone is split between its
+ * actors, and every zone applies its share to its own actors.
+ */
+struct power_group {
+	struct list_head node;
+	struct list_head zones;
+	struct mutex lock;
+	int id;
+	struct dentry *debugfs;
+	unsigned int trace_head;
+	struct power_group_event trace[POWER_GROUP_TRACE_SIZE];
+};
+
+static LIST_HEAD(power_groups);
+static DEFINE_MUTEX(power_groups_lock);
+static struct dentry *power_groups_debugfs;
+
 /**
  * struct power_allocator_params - parameters for the power allocator governor
  * @allocated_tzp:	whether we have allocated tzp for this thermal zone and
@@ -65,6 +124,14 @@ static inline s64 div_frac(s64 x, s64 y)
  *					controlling for.
  * @sustainable_power:	Sustainable power (heat) that this thermal zone can
  *			dissipate
+ * @group:	power group of the thermal zone, %NULL if it has its own budget
+ * @group_node:	entry in the list of thermal zones of @group
+ * @budget:	group budget from the PID controller of this thermal zone,
+ *		U32_MAX while it is below its switch on temperature
+ * @req_power:	weighted power requested by the actors of this thermal zone
+ * @max_power:	maximum power of the actors of this thermal zone
+ * @group_limited:	whether the actors of this thermal zone were limited by
+ *			the group while it was below its switch on temperature
  */
 struct power_allocator_params {
 	bool allocated_tzp;
@@ -73,6 +140,12 @@ struct power_allocator_params {
 	int trip_switch_on;
 	int trip_max_desired_temperature;
 	u32 sustainable_power;
+	struct power_group *group;
+	struct list_head group_node;
+	u32 budget;
+	u32 req_power;
+	u32 max_power;
+	bool group_limited;
 };
 
 /**
@@ -380,8 +453,247 @@ static void divvy_up_power(u32 *req_power, u32 *max_power, int num_actors,
 		}
 }
 
+/**
+ * actor_efficiency() - relative performance per watt of a power actor
+ * @cdev:	cooling device of the power actor
+ *
+ * Performance is not comparable between different kinds of devices, so the
+ * performance per watt of @cdev at its current performance state is taken
+ * relative to the one at its highest performance state. Actors running at
+ * an efficient state then keep more of their request than those running
+ * flat out at an inefficient one.
+ *
+ * The performance state is derived from the cooling state rather than from
+ * the requested power: the latter covers all the CPUs of a cpufreq policy
+ * and is scaled by their load, while the Energy Model holds the power of a
+ * single CPU at full load. Cooling state n caps the device at its n-th
+ * highest performance state.
+ *
+ * Return: the relative performance per watt as a fixed-point number,
+ * clamped to [1/4, 4], or 1 if @cdev has no Energy Model.
+ */
+static u32 actor_efficiency(struct thermal_cooling_device *cdev)
+{
+	struct em_perf_domain *pd = cdev->em_pd;
+	struct em_perf_state *ps, *max_ps;
+	unsigned long state;
+	u64 eff;
+	int i;
+
+	if (!pd || cdev->ops->get_cur_state(cdev, &state))
+		return int_to_frac(1);
+
+	i = pd->nr_perf_states - 1;
+	i -= min_t(unsigned long, state, i);
+
+	ps = &pd->table[i];
+	max_ps = &pd->table[pd->nr_perf_states - 1];
+	if (!ps->power || !max_ps->frequency)
+		return int_to_frac(1);
+
+	eff = div64_u64(int_to_frac((u64)ps->frequency * max_ps->power),
+			(u64)max_ps->frequency * ps->power);
+
+	return clamp_t(u64, eff, int_to_frac(1) / 4, int_to_frac(4));
+}
+
+/**
+ * power_group_share() - get the share of the group budget of a thermal zone
+ * @tz:		thermal zone we are operating in
+ * @control_temp:	the target temperature in millicelsius
+ * @throttling:	whether @tz is above its switch on temperature
+ * @req_power:	weighted power requested by the actors of @tz
+ * @max_power:	maximum power of the actors of @tz
+ *
+ * Run the PID controller of @tz against the power of the whole group, if it
+ * is throttling, and split the lowest budget of the zones in the group
+ * between them according to their weighted requests. The requests of the
+ * other zones are the ones from their last allocation.
+ *
+ * Return: the power budget of the actors of @tz for the next period.
+ */
+static u32 power_group_share(struct thermal_zone_device *tz, int control_temp,
+			     bool throttling, u32 req_power, u32 max_power)
+{
+	struct power_allocator_params *params = tz->governor_data, *p;
+	struct power_group *group = params->group;
+	u32 group_max = 0, group_req = 0, budget = U32_MAX;
+	u32 *zone_req, *zone_max, *granted, *extra;
+	struct power_group_event *ev;
+	int i, self = 0, num_zones = 0;
+	u32 share = max_power;
+
+	mutex_lock(&group->lock);
+
+	params->req_power = req_power;
+	params->max_power = max_power;
+	list_for_each_entry(p, &group->zones, group_node) {
+		group_max += p->max_power;
+		group_req += p->req_power;
+		num_zones++;
+	}
+
+	if (throttling)
+		params->budget = pid_controller(tz, control_temp, group_max);
+	else
+		params->budget = U32_MAX;
+
+	list_for_each_entry(p, &group->zones, group_node)
+		budget = min(budget, p->budget);
+
+	if (budget >= group_max)
+		goto out;
+
+	zone_req = kcalloc(num_zones * 4, sizeof(*zone_req), GFP_KERNEL);
+	if (!zone_req) {
+		share = min_t(u64, max_power,
+			      div_u64((u64)budget * req_power,
+				      max(group_req, 1U)));
+		goto out;
+	}
+
+	zone_max = &zone_req[num_zones];
+	granted = &zone_req[2 * num_zones];
+	extra = &zone_req[3 * num_zones];
+
+	i = 0;
+	list_for_each_entry(p, &group->zones, group_node) {
+		if (p == params)
+			self = i;
+		zone_req[i] = p->req_power;
+		zone_max[i] = p->max_power;
+		i++;
+	}
+
+	divvy_up_power(zone_req, zone_max, num_zones, group_req, budget,
+		       granted, extra);
+	share = granted[self];
+	kfree(zone_req);
+
+out:
+	ev = &group->trace[group->trace_head++ % POWER_GROUP_TRACE_SIZE];
+	ev->time = jiffies;
+	ev->tz_id = tz->id;
+	ev->temperature = tz->temperature;
+	ev->zone_budget = params->budget;
+	ev->group_budget = min(budget, group_max);
+	ev->req_power = req_power;
+	ev->max_power = max_power;
+	ev->share = share;
+
+	mutex_unlock(&group->lock);
+
+	return share;
+}
+
+static int power_group_trace_show(struct seq_file *m, void *v)
+{
+	struct power_group *group = m->private;
+	unsigned int i, start = 0;
+
+	mutex_lock(&group->lock);
+	if (group->trace_head > POWER_GROUP_TRACE_SIZE)
+		start = group->trace_head - POWER_GROUP_TRACE_SIZE;
+
+	for (i = start; i < group->trace_head; i++) {
+		struct power_group_event *ev;
+
+		ev = &group->trace[i % POWER_GROUP_TRACE_SIZE];
+		seq_printf(m, "%lu: tz %d temp %d", ev->time, ev->tz_id,
+			   ev->temperature);
+		if (ev->zone_budget == U32_MAX)
+			seq_puts(m, " budget off");
+		else
+			seq_printf(m, " budget %u", ev->zone_budget);
+		seq_printf(m, " group %u req %u max %u share %u\n",
+			   ev->group_budget, ev->req_power, ev->max_power,
+			   ev->share);
+	}
+	mutex_unlock(&group->lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(power_group_trace);
+
+static void power_group_leave(struct power_allocator_params *params)
+{
+	struct power_group *group = params->group;
+
+	if (!group)
+		return;
+
+	mutex_lock(&power_groups_lock);
+	mutex_lock(&group->lock);
+	list_del(&params->group_node);
+	mutex_unlock(&group->lock);
+	params->group = NULL;
+
+	if (list_empty(&group->zones)) {
+		list_del(&group->node);
+		debugfs_remove_recursive(group->debugfs);
+		kfree(group);
+	}
+	mutex_unlock(&power_groups_lock);
+}
+
+/*
+ * Follow the power group of the thermal zone parameters, which can be changed
+ * through sysfs at any time.
+ */
+static void power_group_join(struct thermal_zone_device *tz,
+			     struct power_allocator_params *params)
+{
+	int id = tz->tzp->power_group;
+	struct power_group *group;
+	char name[16];
+
+	if (params->group && params->group->id == id)
+		return;
+
+	power_group_leave(params);
+	if (!id)
+		return;
+
+	mutex_lock(&power_groups_lock);
+	list_for_each_entry(group, &power_groups, node)
+		if (group->id == id)
+			goto found;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group) {
+		dev_warn(&tz->device, "power_allocator: can't join power group %d\n",
+			 id);
+		goto unlock;
+	}
+
+	group->id = id;
+	mutex_init(&group->lock);
+	INIT_LIST_HEAD(&group->zones);
+	list_add(&group->node, &power_groups);
+
+	if (!power_groups_debugfs)
+		power_groups_debugfs = debugfs_create_dir("power_allocator",
+							  NULL);
+	snprintf(name, sizeof(name), "group%d", id);
+	group->debugfs = debugfs_create_dir(name, power_groups_debugfs);
+	debugfs_create_file("trace", 0400, group->debugfs, group,
+			    &power_group_trace_fops);
+
+found:
+	params->budget = U32_MAX;
+	params->req_power = 0;
+	params->max_power = 0;
+	params->group_limited = false;
+
+	mutex_lock(&group->lock);
+	list_add_tail(&params->group_node, &group->zones);
+	mutex_unlock(&group->lock);
+	params->group = group;
+unlock:
+	mutex_unlock(&power_groups_lock);
+}
+
 static int allocate_power(struct thermal_zone_device *tz,
-			  int control_temp)
+			  int control_temp, bool throttling)
 {
 	struct thermal_instance *instance;
 	struct power_allocator_params *params = tz->governor_data;
@@ -448,7 +760,11 @@ static int allocate_power(struct thermal_zone_device *tz,
 		else
 			weight = instance->weight;
 
-		weighted_req_power[i] = frac_to_int(weight * req_power[i]);
+		if (params->group)
+			weight = mul_frac(weight,
+					  actor_efficiency(cdev));
+
+		weighted_req_power[i] = frac_to_int((u64)weight * req_power[i]);
 
 		if (cdev->ops->state2power(cdev, instance->lower,
 					   &max_power[i]))
@@ -461,7 +777,19 @@ static int allocate_power(struct thermal_zone_device *tz,
 		i++;
 	}
 
-	power_range = pid_controller(tz, control_temp, max_allocatable_power);
+	if (params->group) {
+		power_range = power_group_share(tz, control_temp, throttling,
+						total_weighted_req_power,
+						max_allocatable_power);
+		/* Nothing to limit, the caller allows the maximum power */
+		if (!throttling && power_range >= max_allocatable_power) {
+			ret = -EAGAIN;
+			goto out;
+		}
+	} else {
+		power_range = pid_controller(tz, control_temp,
+					     max_allocatable_power);
+	}
 
 	divvy_up_power(weighted_req_power, max_power, num_actors,
 		       total_weighted_req_power, power_range, granted_power,
@@ -489,6 +817,7 @@ static int allocate_power(struct thermal_zone_device *tz,
 				      max_allocatable_power, tz->temperature,
 				      control_temp - tz->temperature);
 
+out:
 	kfree(req_power);
 
 	return ret;
@@ -686,6 +1015,8 @@ static void power_allocator_unbind(struct thermal_zone_device *tz)
 
 	dev_dbg(&tz->device, "Unbinding from thermal zone %d\n", tz->id);
 
+	power_group_leave(params);
+
 	if (params->allocated_tzp) {
 		kfree(tz->tzp);
 		tz->tzp = NULL;
@@ -711,12 +1042,26 @@ static int power_allocator_throttle(struct thermal_zone_device *tz, int trip)
 	if (trip != params->trip_max_desired_temperature)
 		return 0;
 
+	power_group_join(tz, params);
+
 	ret = tz->ops->get_trip_temp(tz, params->trip_switch_on,
 				     &switch_on_temp);
 	if (!ret && (tz->temperature < switch_on_temp)) {
 		update = (tz->last_temperature >= switch_on_temp);
 		tz->passive = 0;
 		reset_pid_controller(params);
+		/* Hotter zones of the group may still need our actors limited */
+		if (params->group) {
+			if (!tz->ops->get_trip_temp(tz,
+					params->trip_max_desired_temperature,
+					&control_temp) &&
+			    !allocate_power(tz, control_temp, false)) {
+				params->group_limited = true;
+				return 0;
+			}
+			update |= params->group_limited;
+			params->group_limited = false;
+		}
 		allow_maximum_power(tz, update);
 		return 0;
 	}
@@ -732,7 +1077,9 @@ static int power_allocator_throttle(struct thermal_zone_device *tz, int trip)
 		return ret;
 	}
 
-	return allocate_power(tz, control_temp);
+	params->group_limited = false;
+
+	return allocate_power(tz, control_temp, true);
 }
 
 static struct thermal_governor thermal_gov_power_allocator = {
@@ -98,6 +98,9 @@ static __always_inline int queued_spin_trylock(struct qspinlock *lock)
 }
 
 extern void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val);
+#ifdef CONFIG_NUMA_AWARE_SPINLOCKS
+extern void native_queued_spin_lock_slowpath(struct qspinlock *lock, u32 val);
+#endif
 
 #ifndef queued_spin_lock
 /**
@@ -17,6 +17,7 @@
 #include <linux/refcount.h>
 #include <linux/percpu-refcount.h>
 #include <linux/percpu-rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 #include <linux/bpf-cgroup-defs.h>
@@ -166,8 +167,14 @@ struct cgroup_subsys_state {
 	struct list_head sibling;
 	struct list_head children;
 
-	/* flush target list anchored at cgrp->rstat_css_list */
-	struct list_head rstat_css_node;
+	/*
+	 * Per-cpu rstat updated tree links.  Only set up for the self css
+	 * and for subsystems implementing ->css_rstat_flush().
+	 */
+	struct css_rstat_cpu __percpu *rstat_cpu;
+
+	/* jiffies of the last css_rstat_flush() rooted at this css */
+	unsigned long rstat_flush_time;
 
 	/*
 	 * PI: Subsys-unique ID.  0 is unused and root is always 1.  The
@@ -312,7 +319,7 @@ struct cgroup_base_stat {
  * per-cpu in cgroup_rstat_cpu which is then lazily propagated up the
  * hierarchy on reads.
  *
- * When a stat gets updated, the cgroup_rstat_cpu and its ancestors are
+ * When a stat gets updated, the css_rstat_cpu and its ancestors are
  * linked into the updated tree.  On the following read, propagation only
  * considers and consumes the updated tree.  This makes reading O(the
  * number of descendants which have been active since last read) instead of
@@ -323,9 +330,31 @@ struct cgroup_base_stat {
  * become very expensive.  By propagating selectively, increasing reading
  * frequency decreases the cost of each read.
  *
- * This struct hosts both the fields which implement the above -
- * updated_children and updated_next - and the fields which track basic
- * resource statistics on top of it - bsync, bstat and last_bstat.
+ * Each subsystem implementing ->css_rstat_flush() keeps its own updated
+ * trees linking its csses, protected by its own locks, so that flushing
+ * one controller's stats neither walks nor waits for the others.  The
+ * basic resource statistics use the trees of the cgroup's self css.
+ */
+struct css_rstat_cpu {
+	/*
+	 * Child csses with stat updates on this cpu since the last read
+	 * are linked on the parent's ->updated_children through
+	 * ->updated_next.
+	 *
+	 * In addition to being more compact, singly-linked list pointing
+	 * to the css makes it unnecessary for each per-cpu struct to
+	 * point back to the associated css.
+	 *
+	 * Protected by the per-cpu rstat lock of the css' subsystem.
+	 */
+	struct cgroup_subsys_state *updated_children;	/* terminated by self */
+	struct cgroup_subsys_state *updated_next;	/* NULL iff not on the list */
+};
+
+/*
+ * This struct hosts the updated tree links of the self css and the fields
+ * which track basic resource statistics on top of it - bsync, bstat and
+ * last_bstat.
  */
 struct cgroup_rstat_cpu {
 	/*
@@ -341,19 +370,8 @@ struct cgroup_rstat_cpu {
 	 */
 	struct cgroup_base_stat last_bstat;
 
-	/*
-	 * Child cgroups with stat updates on this cpu since the last read
-	 * are linked on the parent's ->updated_children through
-	 * ->updated_next.
-	 *
-	 * In addition to being more compact, singly-linked list pointing
-	 * to the cgroup makes it unnecessary for each per-cpu struct to
-	 * point back to the associated cgroup.
-	 *
-	 * Protected by per-cpu cgroup_rstat_cpu_lock.
-	 */
-	struct cgroup *updated_children;	/* terminated by self cgroup */
-	struct cgroup *updated_next;		/* NULL iff not on the list */
+	/* updated tree links of the self css */
+	struct css_rstat_cpu updated;
 };
 
 struct cgroup_freezer_state {
@@ -475,10 +493,13 @@ struct cgroup {
 
 	/* per-cpu recursive resource statistics */
 	struct cgroup_rstat_cpu __percpu *rstat_cpu;
-	struct list_head rstat_css_list;
 
-	/* cgroup basic resource statistics */
+	/*
+	 * cgroup basic resource statistics.  ->bstat_seq lets readers
+	 * snapshot ->bstat without taking the rstat lock.
+	 */
 	struct cgroup_base_stat last_bstat;
+	seqcount_spinlock_t bstat_seq;
 	struct cgroup_base_stat bstat;
 	struct prev_cputime prev_cputime;	/* for printing out cputime */
 
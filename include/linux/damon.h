@@ -103,6 +103,40 @@ enum damos_action {
 	NR_DAMOS_ACTIONS,
 };
 
+/**
+ * enum damos_quota_goal_metric - Represents the metric of a DAMOS quota goal.
+ *
+ * @DAMOS_QUOTA_SOME_MEM_PSI_US:	System level some memory PSI in us.
+ * @DAMOS_QUOTA_FREE_MEM_BP:		Free memory rate of the system in bp.
+ * @NR_DAMOS_QUOTA_GOAL_METRICS:	Number of DAMOS quota goal metrics.
+ *
+ * The memory PSI metric is the total time that some tasks of the system were
+ * stalled on memory during the last charge window.  The free memory rate is
+ * in basis points, [0,10000].
+ */
+enum damos_quota_goal_metric {
+	DAMOS_QUOTA_SOME_MEM_PSI_US,
+	DAMOS_QUOTA_FREE_MEM_BP,
+	NR_DAMOS_QUOTA_GOAL_METRICS,
+};
+
+/**
+ * struct damos_quota_goal - DAMOS scheme quota auto-tuning goal.
+ * @target_value:	Target value of the metric to achieve.  Zero disables.
+ * @current_value:	Value of the metric measured for the last charge window.
+ *
+ * Each goal is indexed by its &enum damos_quota_goal_metric in
+ * &struct damos_quota->goals.
+ */
+struct damos_quota_goal {
+	unsigned long target_value;
+	unsigned long current_value;
+
+/* private: */
+	/* metric-dependent fields */
+	u64 last_psi_total;
+};
+
 /**
  * struct damos_quota - Controls the aggressiveness of the given scheme.
  * @ms:			Maximum milliseconds that the scheme can use.
@@ -113,6 +147,10 @@ enum damos_action {
  * @weight_nr_accesses:	Weight of the region's nr_accesses for prioritization.
  * @weight_age:		Weight of the region's age for prioritization.
  *
+ * @goals:		Goals for the automatic tuning of the quota.
+ *
+ * @esz:		Effective size quota in bytes.
+ *
  * To avoid consuming too much CPU time or IO resources for applying the
  * &struct damos->action to large memory, DAMON allows users to set time and/or
  * size quotas.  The quotas can be set by writing non-zero values to &ms and
@@ -125,6 +163,16 @@ enum damos_action {
  * throughput of the scheme's action.  DAMON then compares it against &sz and
  * uses smaller one as the effective quota.
  *
+ * If any of &goals has a non-zero target value, DAMON further tunes the
+ * effective quota for every charge window using a simple feedback loop, so
+ * that the measured values of the goal metrics converge to their targets.
+ * For each goal, the ratio of the measured value to the target value is used
+ * as the score of the goal, and the highest score is fed to the loop.  The
+ * effective quota is increased while the score is under the target, and
+ * decreased proportionally once it is over.  The time and size quotas, if
+ * set, are still respected as upper limits of the tuned quota.  &esz shows the
+ * resulting effective quota.
+ *
  * For selecting regions within the quota, DAMON prioritizes current scheme's
  * target memory regions using the &struct damon_operations->get_scheme_score.
  * You could customize the prioritization logic by setting &weight_sz,
@@ -140,12 +188,17 @@ struct damos_quota {
 	unsigned int weight_nr_accesses;
 	unsigned int weight_age;
 
+	struct damos_quota_goal goals[NR_DAMOS_QUOTA_GOAL_METRICS];
+
+	unsigned long esz;
+
 /* private: */
 	/* For throughput estimation */
 	unsigned long total_charged_sz;
 	unsigned long total_charged_ns;
 
-	unsigned long esz;	/* Effective size quota in bytes */
+	/* For the feedback loop of the goals-based quota tuning */
+	unsigned long esz_bp;
 
 	/* For charging the quota */
 	unsigned long charged_sz;
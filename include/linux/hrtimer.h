@@ -195,6 +195,10 @@ enum  hrtimer_base_type {
  * @nr_retries:		Total number of hrtimer interrupt retries
  * @nr_hangs:		Total number of hrtimer interrupt hangs
  * @max_hang_time:	Maximum time spent in hrtimer_interrupt
+ * @nr_coalesced:	Total number of timers expired along with an earlier
+ *			timer by hrtimer_coalesce= while not first in line
+ * @nr_wakeups_avoided:	Total number of timers queued on a remote CPU which
+ *			expires within their slack window anyway
  * @softirq_expiry_lock: Lock which is taken while softirq based hrtimer are
  *			 expired
  * @timer_waiters:	A hrtimer_cancel() invocation waits for the timer
@@ -226,6 +230,8 @@ struct hrtimer_cpu_base {
 	unsigned short			nr_hangs;
 	unsigned int			max_hang_time;
 #endif
+	unsigned int			nr_coalesced;
+	unsigned int			nr_wakeups_avoided;
 #ifdef CONFIG_PREEMPT_RT
 	spinlock_t			softirq_expiry_lock;
 	atomic_t			timer_waiters;
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_HYBRID_RWSEM_H
+#define _LINUX_HYBRID_RWSEM_H
+
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/rcuwait.h>
+#include <linux/rwsem.h>
+#include <linux/lockdep.h>
+
+/*
+ * Reader-biased read-write semaphore.
+ *
+ * While @rbias is set, readers only touch their CPU's counter and never
+ * write a shared cacheline. A writer revokes the bias and waits for the
+ * counters to drain; unlike percpu_rw_semaphore this needs no RCU grace
+ * period, so the writer latency is bounded by the longest read-side
+ * critical section. Until the bias is restored, readers and writers
+ * serialize on the embedded rw_semaphore, with its usual spinning and
+ * writer hand-off. The bias is restored by a reader once a multiple of the
+ * last revocation time has passed, so write-heavy phases don't keep paying
+ * for revocations.
+ */
+struct hybrid_rw_semaphore {
+	bool			rbias;
+	unsigned int __percpu	*read_count;
+	u64			inhibit_until;
+	struct rcuwait		writer;
+	struct rw_semaphore	rwsem;
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+	struct lockdep_map	dep_map;
+#endif
+};
+
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+#define __HYBRID_RWSEM_DEP_MAP_INIT(lockname)	.dep_map = { .name = #lockname },
+#else
+#define __HYBRID_RWSEM_DEP_MAP_INIT(lockname)
+#endif
+
+#define __DEFINE_HYBRID_RWSEM(name, is_static)				\
+static DEFINE_PER_CPU(unsigned int, __hybrid_rwsem_rc_##name);		\
+is_static struct hybrid_rw_semaphore name = {				\
+	.rbias = true,							\
+	.read_count = &__hybrid_rwsem_rc_##name,			\
+	.writer = __RCUWAIT_INITIALIZER(name.writer),			\
+	.rwsem = __RWSEM_INITIALIZER(name.rwsem),			\
+	__HYBRID_RWSEM_DEP_MAP_INIT(name)				\
+}
+
+#define DEFINE_HYBRID_RWSEM(name)		\
+	__DEFINE_HYBRID_RWSEM(name, /* not static */)
+#define DEFINE_STATIC_HYBRID_RWSEM(name)	\
+	__DEFINE_HYBRID_RWSEM(name, static)
+
+extern bool __hybrid_down_read(struct hybrid_rw_semaphore *, bool);
+
+static inline bool __hybrid_down_read_fast(struct hybrid_rw_semaphore *sem)
+{
+	bool ret = false;
+
+	preempt_disable();
+	if (likely(READ_ONCE(sem->rbias))) {
+		this_cpu_inc(*sem->read_count);
+		/*
+		 * Either the writer sees our increment, or we see it clearing
+		 * the bias.
+		 */
+		smp_mb(); /* A matches D */
+		/*
+		 * The acquire matches the release of whoever restored the
+		 * bias, which acquired the rwsem after the last writer.
+		 */
+		if (likely(smp_load_acquire(&sem->rbias)))
+			ret = true;
+		else
+			this_cpu_dec(*sem->read_count);
+	}
+	preempt_enable();
+
+	return ret;
+}
+
+static inline void hybrid_down_read(struct hybrid_rw_semaphore *sem)
+{
+	might_sleep();
+
+	rwsem_acquire_read(&sem->dep_map, 0, 0, _RET_IP_);
+
+	if (!__hybrid_down_read_fast(sem))
+		__hybrid_down_read(sem, false);
+
+	lock_acquired(&sem->dep_map, _RET_IP_);
+}
+
+static inline bool hybrid_down_read_trylock(struct hybrid_rw_semaphore *sem)
+{
+	bool ret;
+
+	ret = __hybrid_down_read_fast(sem) || __hybrid_down_read(sem, true);
+	if (ret) {
+		rwsem_acquire_read(&sem->dep_map, 0, 1, _RET_IP_);
+		lock_acquired(&sem->dep_map, _RET_IP_);
+	}
+
+	return ret;
+}
+
+static inline void hybrid_up_read(struct hybrid_rw_semaphore *sem)
+{
+	rwsem_release(&sem->dep_map, _RET_IP_);
+
+	preempt_disable();
+	/*
+	 * If the writer sees our decrement, it also sees our critical
+	 * section.
+	 */
+	smp_mb(); /* B matches C */
+	this_cpu_dec(*sem->read_count);
+	/*
+	 * Only loads the writer's task pointer unless one is waiting, so it
+	 * stays cheap while the bias is set.
+	 */
+	rcuwait_wake_up(&sem->writer);
+	preempt_enable();
+}
+
+extern void hybrid_down_write(struct hybrid_rw_semaphore *);
+extern void hybrid_up_write(struct hybrid_rw_semaphore *);
+
+extern int __hybrid_init_rwsem(struct hybrid_rw_semaphore *, const char *,
+			       struct lock_class_key *,
+			       struct lock_class_key *);
+
+extern void hybrid_free_rwsem(struct hybrid_rw_semaphore *);
+
+#define hybrid_init_rwsem(sem)						\
+({									\
+	static struct lock_class_key __key, __rwsem_key;		\
+	__hybrid_init_rwsem(sem, #sem, &__key, &__rwsem_key);		\
+})
+
+#define hybrid_rwsem_is_held(sem)	lockdep_is_held(sem)
+#define hybrid_rwsem_assert_held(sem)	lockdep_assert_held(sem)
+
+#endif
@@ -832,6 +832,42 @@ static inline void init_irq_proc(void)
 void irq_timings_enable(void);
 void irq_timings_disable(void);
 u64 irq_timings_next_event(u64 now);
+u64 irq_timings_next_interval(int irq, u64 now);
+#endif
+
+#ifdef CONFIG_IRQ_MODERATION
+/**
+ * struct irq_moderation - adaptive moderation of a device interrupt
+ * @handler:	handler for a single interrupt, called in hard irq context
+ * @poll:	polls the device from the irq thread and returns the number
+ *		of events handled
+ * @dev_id:	cookie passed to @handler and @poll
+ * @enter_rate:	interrupts per second above which polling starts
+ * @exit_rate:	events per second below which polling stops
+ * @poll_us:	polling period in microseconds
+ * @irq:	interrupt number, for internal use
+ * @polling:	polling is active, for internal use
+ * @stopping:	the interrupt is being freed, for internal use
+ * @nr_irqs:	number of interrupts seen, for internal use
+ * @nr_polling:	number of switches to polling
+ */
+struct irq_moderation {
+	irq_handler_t		handler;
+	unsigned int		(*poll)(void *dev_id);
+	void			*dev_id;
+	unsigned int		enter_rate;
+	unsigned int		exit_rate;
+	unsigned int		poll_us;
+	unsigned int		irq;
+	bool			polling;
+	bool			stopping;
+	unsigned int		nr_irqs;
+	unsigned long		nr_polling;
+};
+
+extern int irq_moderation_request(struct irq_moderation *mod, unsigned int irq,
+				  unsigned long flags, const char *name);
+extern void irq_moderation_free(struct irq_moderation *mod);
 #endif
 
 struct seq_file;
@@ -50,6 +50,10 @@ struct pt_regs;
  * @request_mutex:	mutex to protect request/free before locking desc->lock
  * @dir:		/proc/irq/ procfs entry
  * @debugfs_file:	dentry for the debugfs file
+ * @balance_count:	interrupt count at the last balancer sample
+ * @balance_rate:	interrupts per second over the last balancer period
+ * @balance_moved:	jiffies of the last move by the balancer
+ * @balance_target:	CPU + 1 the balancer moved the interrupt to, 0 if none
  * @name:		flow handler name for /proc/interrupts output
  */
 struct irq_desc {
@@ -94,6 +98,12 @@ struct irq_desc {
 	struct dentry		*debugfs_file;
 	const char		*dev_name;
 #endif
+#ifdef CONFIG_IRQ_BALANCE
+	unsigned int		balance_count;
+	unsigned int		balance_target;
+	unsigned long		balance_rate;
+	unsigned long		balance_moved;
+#endif
 #ifdef CONFIG_SPARSE_IRQ
 	struct rcu_head		rcu;
 	struct kobject		kobj;
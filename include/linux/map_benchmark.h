@@ -14,6 +14,13 @@
 #define DMA_MAP_BIDIRECTIONAL   0
 #define DMA_MAP_TO_DEVICE       1
 #define DMA_MAP_FROM_DEVICE     2
+#define DMA_MAP_MIXED           3 /* cycle through the three above */
+
+#define DMA_MAP_SINGLE_MODE     0 /* dma_map_single() of one buffer */
+#define DMA_MAP_SG_MODE         1 /* dma_map_sgtable() of nents buffers */
+#define DMA_MAP_MAX_NENTS       256
+
+#define DMA_MAP_FORCE_BOUNCE    (1U << 0) /* map through swiotlb */
 
 struct map_benchmark {
 	__u64 avg_map_100ns; /* average map latency in 100ns */
@@ -27,5 +34,15 @@ struct map_benchmark {
 	__u32 dma_dir; /* DMA data direction */
 	__u32 dma_trans_ns; /* time for DMA transmission in ns */
 	__u32 granule;  /* how many PAGE_SIZE will do map/unmap once a time */
+	__u32 mode; /* DMA_MAP_SINGLE_MODE or DMA_MAP_SG_MODE */
+	__u32 nents; /* scatterlist entries of granule pages each */
+	__u32 flags; /* DMA_MAP_FORCE_BOUNCE */
+	__u32 reserved;
+	__u64 map_p50_ns; /* map latency percentiles */
+	__u64 map_p99_ns;
+	__u64 map_p999_ns;
+	__u64 unmap_p50_ns; /* as above */
+	__u64 unmap_p99_ns;
+	__u64 unmap_p999_ns;
 };
 #endif /* _KERNEL_DMA_BENCHMARK_H */
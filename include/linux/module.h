@@ -66,6 +66,14 @@ struct module_version_attribute {
 	const char *version;
 };
 
+/* Async inits waited for by request_module(), see module_async_wait_end() */
+struct module_async_wait {
+	struct list_head list;
+	u64 since;
+	u64 until;
+	int ret;
+};
+
 extern ssize_t __modver_version_show(struct module_attribute *,
 				     struct module_kobject *, char *);
 
@@ -360,6 +368,14 @@ struct klp_modinfo {
 };
 #endif
 
+/* Time spent in the stages of loading a module, in nanoseconds */
+struct module_load_times {
+	u64 read;		/* reading the image from user space */
+	u64 decompress;		/* in-kernel decompression */
+	u64 link;		/* everything between decompression and init */
+	u64 init;		/* the module's init function */
+};
+
 struct module {
 	enum module_state state;
 
@@ -432,6 +448,9 @@ struct module {
 
 	unsigned long taints;	/* same bits as kernel:taint_flags */
 
+	/* Shown in /sys/module/<name>/load_time */
+	struct module_load_times load_times;
+
 #ifdef CONFIG_GENERIC_BUG
 	/* Support for BUG */
 	unsigned num_bugs;
@@ -669,6 +688,8 @@ int lookup_module_symbol_attrs(unsigned long addr, unsigned long *size, unsigned
 
 int register_module_notifier(struct notifier_block *nb);
 int unregister_module_notifier(struct notifier_block *nb);
+void module_async_wait_begin(struct module_async_wait *w);
+int module_async_wait_end(struct module_async_wait *w, bool wait);
 
 extern void print_modules(void);
 
@@ -801,6 +822,16 @@ static inline int unregister_module_notifier(struct notifier_block *nb)
 	return 0;
 }
 
+static inline void module_async_wait_begin(struct module_async_wait *w)
+{
+}
+
+static inline int module_async_wait_end(struct module_async_wait *w,
+					bool wait)
+{
+	return 0;
+}
+
 #define module_put_and_kthread_exit(code) kthread_exit(code)
 
 static inline void print_modules(void)
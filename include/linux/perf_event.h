@@ -776,6 +776,9 @@ struct perf_event {
 	/* for aux_output events */
 	struct perf_event		*aux_event;
 
+	/* for sample_aggregate events */
+	struct perf_aggr_table		*aggr_table;
+
 	void (*destroy)(struct perf_event *);
 	struct rcu_head			rcu_head;
 
@@ -87,6 +87,14 @@ dma_addr_t swiotlb_map(struct device *dev, phys_addr_t phys,
  * @for_alloc:  %true if the pool is used for memory allocation
  * @nareas:  The area number in the pool.
  * @area_nslabs: The slot number in the area.
+ * @pcp:	Per-CPU caches of free slot runs, %NULL if the pool is too small
+ *		to afford them.
+ * @pools:	The dynamically added pools, an RCU list.
+ * @node:	Entry of a dynamically added pool in its parent's @pools.
+ * @dyn:	State of the dynamic pool growth, %NULL if the pool doesn't
+ *		grow.
+ * @idle:	%true if a dynamically added pool was found unused by the last
+ *		reclaim pass.
  */
 struct io_tlb_mem {
 	phys_addr_t start;
@@ -102,14 +110,50 @@ struct io_tlb_mem {
 	unsigned int area_nslabs;
 	struct io_tlb_area *areas;
 	struct io_tlb_slot *slots;
+	struct io_tlb_pcp __percpu *pcp;
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+	struct list_head pools;
+	struct list_head node;
+	struct io_tlb_dyn *dyn;
+	bool idle;
+#endif
 };
 extern struct io_tlb_mem io_tlb_default_mem;
 
-static inline bool is_swiotlb_buffer(struct device *dev, phys_addr_t paddr)
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+struct io_tlb_mem *__swiotlb_find_pool(struct io_tlb_mem *mem,
+				       phys_addr_t paddr);
+#endif
+
+/**
+ * swiotlb_find_pool() - find the IO TLB pool holding a bounce buffer
+ * @dev:	device which has mapped the buffer
+ * @paddr:	physical address within the bounce buffer
+ *
+ * The pool can only be looked up for addresses that are mapped, as
+ * dynamically added pools go away once they have no mappings left.
+ *
+ * Return: the pool, or %NULL if @paddr is not a bounce buffer of @dev.
+ */
+static inline struct io_tlb_mem *swiotlb_find_pool(struct device *dev,
+						   phys_addr_t paddr)
 {
 	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
 
-	return mem && paddr >= mem->start && paddr < mem->end;
+	if (!mem)
+		return NULL;
+	if (paddr >= mem->start && paddr < mem->end)
+		return mem;
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+	if (READ_ONCE(mem->dyn))
+		return __swiotlb_find_pool(mem, paddr);
+#endif
+	return NULL;
+}
+
+static inline bool is_swiotlb_buffer(struct device *dev, phys_addr_t paddr)
+{
+	return swiotlb_find_pool(dev, paddr) != NULL;
 }
 
 static inline bool is_swiotlb_force_bounce(struct device *dev)
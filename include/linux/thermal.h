@@ -33,6 +33,7 @@ struct thermal_zone_device;
 struct thermal_cooling_device;
 struct thermal_instance;
 struct thermal_attr;
+struct em_perf_domain;
 
 enum thermal_trend {
 	THERMAL_TREND_STABLE, /* temperature is stable */
@@ -109,6 +110,8 @@ struct thermal_cooling_device {
 	struct mutex lock; /* protect thermal_instances list */
 	struct list_head thermal_instances;
 	struct list_head node;
+	/* Energy Model the cooling states follow, from the deepest one up */
+	struct em_perf_domain *em_pd;
 };
 
 /**
@@ -292,6 +295,13 @@ struct thermal_zone_params {
 	 * 		Used by thermal zone drivers (default 0).
 	 */
 	int offset;
+
+	/*
+	 * Thermal zones with the same non-zero power group share one power
+	 * budget in the power allocator, and their sustainable power is the
+	 * one of the whole group.
+	 */
+	s32 power_group;
 };
 
 /* Function declarations */
@@ -59,6 +59,8 @@ struct sockaddr_ll {
 #define PACKET_ROLLOVER_STATS		21
 #define PACKET_FANOUT_DATA		22
 #define PACKET_IGNORE_OUTGOING		23
+/* Kept clear of the options allocated in sequence above */
+#define PACKET_FANOUT_MERGE		256
 
 #define PACKET_FANOUT_HASH		0
 #define PACKET_FANOUT_LB		1
@@ -128,6 +130,15 @@ struct tpacket_auxdata {
 
 /* Rx ring - feature request bits */
 #define TP_FT_REQ_FILL_RXHASH	0x1
+/* TPACKET_V3: split the blocks into one run per CPU, in CPU number order, and
+ * fill each run only with packets received on its CPU. tp_block_nr must be a
+ * multiple of nr_cpu_ids, the highest possible CPU id plus one, as read from
+ * /sys/devices/system/cpu/possible. Run n is made of blocks
+ * n * tp_block_nr / nr_cpu_ids and up and is indexed by the CPU id, so runs
+ * of CPU ids that are not possible stay empty. Block seq_num is shared by all
+ * runs, walk blocks in seq_num order for the merged view.
+ */
+#define TP_FT_REQ_PERCPU	0x2
 
 struct tpacket_hdr {
 	unsigned long	tp_status;
@@ -290,6 +301,35 @@ union tpacket_req_u {
 	struct tpacket_req3	req3;
 };
 
+/* PACKET_FANOUT_MERGE: an index of the packets all members of a fanout group
+ * capture, in timestamp order. It is mapped after the rx and tx rings of the
+ * socket that set it up, and starts with struct tpacket_merge_hdr followed
+ * by tp_entry_nr entries. Entries wait up to tp_window_ns for older packets
+ * of other members before the kernel publishes them, 512 entries at most;
+ * packets later than that are indexed out of order.
+ *
+ * With TPACKET_V3 an entry can be published while the block holding its
+ * frame is still being filled. Wait for TP_STATUS_USER in the block before
+ * reading the frame.
+ */
+struct tpacket_merge_req {
+	unsigned int	tp_entry_nr;	/* Power of 2 */
+	unsigned int	tp_window_ns;	/* Reordering window */
+};
+
+struct tpacket_merge_hdr {
+	__u32	tp_producer;	/* Entries published by the kernel */
+	__u32	tp_consumer;	/* Entries consumed by user space */
+	__u32	tp_entry_nr;
+	__u32	tp_drops;	/* Packets not indexed, the ring was full */
+};
+
+struct tpacket_merge_entry {
+	__u64	tp_ts;		/* Packet timestamp in ns, as in its frame */
+	__u64	tp_ino;		/* Inode number of the member socket */
+	__u64	tp_offset;	/* Of the frame in the member's rx ring */
+};
+
 struct packet_mreq {
 	int		mr_ifindex;
 	unsigned short	mr_type;
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_KMSG_MMAP_H
+#define _UAPI_LINUX_KMSG_MMAP_H
+
+#include <linux/types.h>
+
+/*
+ * Read-only mapping of the kernel log buffer through /dev/kmsg.
+ *
+ * mmap() of /dev/kmsg at offset 0 with PROT_READ and MAP_SHARED maps the
+ * printk ringbuffer as it is used by the kernel, without copying. The
+ * mapping starts with a page holding struct kmsg_mmap_header, followed by
+ * the descriptor array, the info array and the text data ring, each starting
+ * at the page aligned offset given in the header. Any number of readers may
+ * map the buffer at the same time.
+ *
+ * Records are identified by their 64-bit sequence number. The record with
+ * sequence number @seq is described by descs[@seq % desc_count] and
+ * infos[@seq % desc_count]. A reader must use the same protocol as the
+ * kernel readers to read a record consistently while writers keep going:
+ *
+ *   1. Load @state_var of the descriptor with acquire semantics. The record
+ *      may only be read if KMSG_MMAP_DESC_STATE() of it is
+ *      KMSG_MMAP_DESC_FINALIZED.
+ *
+ *   2. Copy the info and the text. The text data block spans the logical
+ *      positions [@text_begin, @text_next) of the text data ring, whose
+ *      index in the ring is the position modulo text_size. If the block
+ *      wraps, i.e. @text_begin / text_size differs from
+ *      @text_next / text_size, the block instead starts at index 0 and ends
+ *      at index @text_next % text_size. Each block starts with an unsigned
+ *      long descriptor ID that is followed by the text. Only @text_len
+ *      bytes of the text are valid. Blocks with bit 0 of either position set
+ *      carry no text.
+ *
+ *   3. Issue a read barrier and load @state_var again. If it changed, the
+ *      record was recycled during the copy and the copy must be discarded.
+ *
+ *   4. The copy is valid if the @seq of the copied info matches the wanted
+ *      sequence number. A larger @seq means that the wanted record was
+ *      already overwritten, a smaller one that it does not exist yet.
+ *
+ * The oldest available record can be found by scanning the infos of the
+ * finalized descriptors for the smallest sequence number.
+ *
+ * The layout uses the native word size of the kernel. Compat tasks cannot
+ * map the buffer.
+ */
+
+#define KMSG_MMAP_MAGIC			0x4b4d5347	/* "KMSG" */
+#define KMSG_MMAP_VERSION		1
+
+#define KMSG_MMAP_DESC_RESERVED		0x0
+#define KMSG_MMAP_DESC_COMMITTED	0x1
+#define KMSG_MMAP_DESC_FINALIZED	0x2
+#define KMSG_MMAP_DESC_REUSABLE		0x3
+
+#define KMSG_MMAP_DESC_FLAGS_SHIFT	(sizeof(unsigned long) * 8 - 2)
+#define KMSG_MMAP_DESC_STATE(sv)	(3UL & ((sv) >> KMSG_MMAP_DESC_FLAGS_SHIFT))
+
+struct kmsg_mmap_header {
+	__u32		magic;		/* KMSG_MMAP_MAGIC */
+	__u32		version;	/* KMSG_MMAP_VERSION */
+	__u32		desc_count_bits;
+	__u32		text_size_bits;
+	__u32		desc_size;	/* sizeof(struct kmsg_mmap_desc) */
+	__u32		info_size;	/* sizeof(struct kmsg_mmap_info) */
+	__aligned_u64	descs_offset;
+	__aligned_u64	infos_offset;
+	__aligned_u64	text_offset;
+	__aligned_u64	map_size;	/* total size of the mapping */
+};
+
+struct kmsg_mmap_desc {
+	unsigned long	state_var;	/* descriptor ID and state */
+	unsigned long	text_begin;
+	unsigned long	text_next;
+};
+
+struct kmsg_mmap_info {
+	__u64		seq;		/* sequence number */
+	__u64		ts_nsec;	/* timestamp in nanoseconds */
+	__u16		text_len;	/* length of text message */
+	__u8		facility;	/* syslog facility */
+	__u8		flags:5;	/* internal record flags */
+	__u8		level:3;	/* syslog level */
+	__u32		caller_id;	/* thread id or processor id */
+	char		subsystem[16];
+	char		device[48];
+};
+
+#endif /* _UAPI_LINUX_KMSG_MMAP_H */
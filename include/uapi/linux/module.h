@@ -6,5 +6,7 @@
 #define MODULE_INIT_IGNORE_MODVERSIONS	1
 #define MODULE_INIT_IGNORE_VERMAGIC	2
 #define MODULE_INIT_COMPRESSED_FILE	4
+/* Return once the module is linked, run its init function asynchronously */
+#define MODULE_INIT_ASYNC		8
 
 #endif /* _UAPI_LINUX_MODULE_H */
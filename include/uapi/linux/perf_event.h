@@ -455,7 +455,9 @@ struct perf_event_attr {
 				inherit_thread :  1, /* children only inherit if cloned with CLONE_THREAD */
 				remove_on_exec :  1, /* event is removed from task on exec */
 				sigtrap        :  1, /* send synchronous SIGTRAP on event */
-				__reserved_1   : 26;
+				sample_aggregate : 1, /* count callchains in kernel */
+				adaptive_watermark : 1, /* kernel tunes wakeup_watermark */
+				__reserved_1   : 24;
 
 	union {
 		__u32		wakeup_events;	  /* wakeup every n events */
@@ -675,7 +677,7 @@ struct perf_event_mmap_page {
 	 */
 	__u64	time_zero;
 
-	__u32	size;			/* Header size up to __reserved[] fields. */
+	__u32	size;			/* Size of the fields the kernel fills */
 	__u32	__reserved_1;
 
 	/*
@@ -734,6 +736,25 @@ struct perf_event_mmap_page {
 	__u64	aux_tail;
 	__u64	aux_offset;
 	__u64	aux_size;
+
+	/*
+	 * Wakeup statistics of the data buffer, updated by the kernel.
+	 *
+	 * @data_watermark is the wakeup watermark currently in effect. It only
+	 * differs from perf_event_attr::wakeup_watermark for events with
+	 * perf_event_attr::adaptive_watermark set, where the kernel tunes it
+	 * between an eighth of wakeup_watermark (but at least a page) and half
+	 * of @data_size.
+	 *
+	 * @data_wakeups counts the reader wakeups generated by the data buffer,
+	 * @data_early_wakeups those of them that were issued ahead of the
+	 * watermark because the buffer was about to overflow.
+	 *
+	 * These fields are only valid if @size covers them.
+	 */
+	__u64	data_watermark;
+	__u64	data_wakeups;
+	__u64	data_early_wakeups;
 };
 
 /*
@@ -1204,6 +1225,23 @@ enum perf_event_type {
 	 */
 	PERF_RECORD_AUX_OUTPUT_HW_ID		= 21,
 
+	/*
+	 * Emitted instead of PERF_RECORD_SAMPLE by events with
+	 * sample_aggregate set: the number of samples that hit the same
+	 * callchain (and the same task, if PERF_SAMPLE_TID is set; pid and tid
+	 * are zero otherwise) since the last record for it.
+	 *
+	 * struct {
+	 *	struct perf_event_header	header;
+	 *	u32				pid, tid;
+	 *	u64				count;
+	 *	u64				nr;
+	 *	u64				ips[nr];
+	 *	struct sample_id		sample_id;
+	 * };
+	 */
+	PERF_RECORD_CALLCHAIN_COUNT		= 22,
+
 	PERF_RECORD_MAX,			/* non-ABI */
 };
 
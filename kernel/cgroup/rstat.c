@@ -1,14 +1,35 @@
 // SPDX-License-Identifier: GPL-2.0-only
 #include "cgroup-internal.h"
 
+#include <linux/moduleparam.h>
 #include <linux/sched/cputime.h>
 
 #include <linux/bpf.h>
 #include <linux/btf.h>
 #include <linux/btf_ids.h>
 
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "cgroup."
+
+/*
+ * The basic resource statistics and bpf collectors hang off the self css
+ * and use cgroup_rstat_lock and cgroup_rstat_cpu_lock.  Every subsystem
+ * implementing ->css_rstat_flush() gets its own pair indexed by ss->id.
+ */
 static DEFINE_SPINLOCK(cgroup_rstat_lock);
 static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
+static spinlock_t rstat_ss_lock[CGROUP_SUBSYS_COUNT];
+static DEFINE_PER_CPU(raw_spinlock_t, rstat_ss_cpu_lock[CGROUP_SUBSYS_COUNT]);
+
+/*
+ * Readers going through the _ratelimited() flush variants accept stats
+ * which are up to this many milliseconds old instead of flushing.  0
+ * makes them flush every time.
+ */
+static unsigned int rstat_staleness_ms;
+module_param(rstat_staleness_ms, uint, 0644);
 
 static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu);
 
@@ -17,18 +38,37 @@ static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
 	return per_cpu_ptr(cgrp->rstat_cpu, cpu);
 }
 
+static struct css_rstat_cpu *css_rstat_cpu(struct cgroup_subsys_state *css,
+					   int cpu)
+{
+	return per_cpu_ptr(css->rstat_cpu, cpu);
+}
+
+static spinlock_t *ss_rstat_lock(struct cgroup_subsys *ss)
+{
+	return ss ? &rstat_ss_lock[ss->id] : &cgroup_rstat_lock;
+}
+
+static raw_spinlock_t *ss_rstat_cpu_lock(struct cgroup_subsys *ss, int cpu)
+{
+	if (ss)
+		return per_cpu_ptr(&rstat_ss_cpu_lock[ss->id], cpu);
+	return per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu);
+}
+
 /**
- * cgroup_rstat_updated - keep track of updated rstat_cpu
- * @cgrp: target cgroup
+ * css_rstat_updated - keep track of updated rstat_cpu
+ * @css: target css
  * @cpu: cpu on which rstat_cpu was updated
  *
- * @cgrp's rstat_cpu on @cpu was updated.  Put it on the parent's matching
- * rstat_cpu->updated_children list.  See the comment on top of
- * cgroup_rstat_cpu definition for details.
+ * @css's rstat_cpu on @cpu was updated.  Put it on the parent's matching
+ * rstat_cpu->updated_children list.  @css must either be a cgroup's self
+ * css or belong to a subsystem implementing ->css_rstat_flush().  See the
+ * comment on top of css_rstat_cpu definition for details.
  */
-void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
+void css_rstat_updated(struct cgroup_subsys_state *css, int cpu)
 {
-	raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu);
+	raw_spinlock_t *cpu_lock = ss_rstat_cpu_lock(css->ss, cpu);
 	unsigned long flags;
 
 	/*
@@ -36,63 +76,77 @@ void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
 	 * temporary inaccuracies, which is fine.
 	 *
 	 * Because @parent's updated_children is terminated with @parent
-	 * instead of NULL, we can tell whether @cgrp is on the list by
+	 * instead of NULL, we can tell whether @css is on the list by
 	 * testing the next pointer for NULL.
 	 */
-	if (data_race(cgroup_rstat_cpu(cgrp, cpu)->updated_next))
+	if (data_race(css_rstat_cpu(css, cpu)->updated_next))
 		return;
 
 	raw_spin_lock_irqsave(cpu_lock, flags);
 
-	/* put @cgrp and all ancestors on the corresponding updated lists */
+	/* put @css and all ancestors on the corresponding updated lists */
 	while (true) {
-		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
-		struct cgroup *parent = cgroup_parent(cgrp);
-		struct cgroup_rstat_cpu *prstatc;
+		struct css_rstat_cpu *rstatc = css_rstat_cpu(css, cpu);
+		struct cgroup_subsys_state *parent = css->parent;
+		struct css_rstat_cpu *prstatc;
 
 		/*
-		 * Both additions and removals are bottom-up.  If a cgroup
-		 * is already in the tree, all ancestors are.
+		 * Both additions and removals are bottom-up.  If a css is
+		 * already in the tree, all ancestors are.
 		 */
 		if (rstatc->updated_next)
 			break;
 
 		/* Root has no parent to link it to, but mark it busy */
 		if (!parent) {
-			rstatc->updated_next = cgrp;
+			rstatc->updated_next = css;
 			break;
 		}
 
-		prstatc = cgroup_rstat_cpu(parent, cpu);
+		prstatc = css_rstat_cpu(parent, cpu);
 		rstatc->updated_next = prstatc->updated_children;
-		prstatc->updated_children = cgrp;
+		prstatc->updated_children = css;
 
-		cgrp = parent;
+		css = parent;
 	}
 
 	raw_spin_unlock_irqrestore(cpu_lock, flags);
 }
+EXPORT_SYMBOL_GPL(css_rstat_updated);
 
 /**
- * cgroup_rstat_cpu_pop_updated - iterate and dismantle rstat_cpu updated tree
+ * cgroup_rstat_updated - keep track of updated basic resource statistics
+ * @cgrp: target cgroup
+ * @cpu: cpu on which rstat_cpu was updated
+ *
+ * css_rstat_updated() on @cgrp's self css.
+ */
+void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
+{
+	css_rstat_updated(&cgrp->self, cpu);
+}
+
+/**
+ * css_rstat_cpu_pop_updated - iterate and dismantle rstat_cpu updated tree
  * @pos: current position
  * @root: root of the tree to traversal
  * @cpu: target cpu
  *
  * Walks the updated rstat_cpu tree on @cpu from @root.  %NULL @pos starts
  * the traversal and %NULL return indicates the end.  During traversal,
- * each returned cgroup is unlinked from the tree.  Must be called with the
- * matching cgroup_rstat_cpu_lock held.
+ * each returned css is unlinked from the tree.  Must be called with the
+ * per-cpu rstat lock of @root's subsystem held.
  *
  * The only ordering guarantee is that, for a parent and a child pair
  * covered by a given traversal, if a child is visited, its parent is
  * guaranteed to be visited afterwards.
  */
-static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
-						   struct cgroup *root, int cpu)
+static struct cgroup_subsys_state *
+css_rstat_cpu_pop_updated(struct cgroup_subsys_state *pos,
+			  struct cgroup_subsys_state *root, int cpu)
 {
-	struct cgroup_rstat_cpu *rstatc;
-	struct cgroup *parent;
+	struct css_rstat_cpu *rstatc;
+	struct cgroup_subsys_state *parent;
 
 	if (pos == root)
 		return NULL;
@@ -104,15 +158,15 @@ static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
 	if (!pos) {
 		pos = root;
 		/* return NULL if this subtree is not on-list */
-		if (!cgroup_rstat_cpu(pos, cpu)->updated_next)
+		if (!css_rstat_cpu(pos, cpu)->updated_next)
 			return NULL;
 	} else {
-		pos = cgroup_parent(pos);
+		pos = pos->parent;
 	}
 
 	/* walk down to the first leaf */
 	while (true) {
-		rstatc = cgroup_rstat_cpu(pos, cpu);
+		rstatc = css_rstat_cpu(pos, cpu);
 		if (rstatc->updated_children == pos)
 			break;
 		pos = rstatc->updated_children;
@@ -124,17 +178,17 @@ static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
 	 * However, due to the way we traverse, @pos will be the first
 	 * child in most cases. The only exception is @root.
 	 */
-	parent = cgroup_parent(pos);
+	parent = pos->parent;
 	if (parent) {
-		struct cgroup_rstat_cpu *prstatc;
-		struct cgroup **nextp;
+		struct css_rstat_cpu *prstatc;
+		struct cgroup_subsys_state **nextp;
 
-		prstatc = cgroup_rstat_cpu(parent, cpu);
+		prstatc = css_rstat_cpu(parent, cpu);
 		nextp = &prstatc->updated_children;
 		while (*nextp != pos) {
-			struct cgroup_rstat_cpu *nrstatc;
+			struct css_rstat_cpu *nrstatc;
 
-			nrstatc = cgroup_rstat_cpu(*nextp, cpu);
+			nrstatc = css_rstat_cpu(*nextp, cpu);
 			WARN_ON_ONCE(*nextp == parent);
 			nextp = &nrstatc->updated_next;
 		}
@@ -170,22 +224,22 @@ __weak noinline void bpf_rstat_flush(struct cgroup *cgrp,
 
 __diag_pop();
 
-/* see cgroup_rstat_flush() */
-static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
-	__releases(&cgroup_rstat_lock) __acquires(&cgroup_rstat_lock)
+/* see css_rstat_flush() */
+static void css_rstat_flush_locked(struct cgroup_subsys_state *css,
+				   bool may_sleep)
 {
+	spinlock_t *lock = ss_rstat_lock(css->ss);
 	int cpu;
 
-	lockdep_assert_held(&cgroup_rstat_lock);
+	lockdep_assert_held(lock);
 
 	for_each_possible_cpu(cpu) {
-		raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock,
-						       cpu);
-		struct cgroup *pos = NULL;
+		raw_spinlock_t *cpu_lock = ss_rstat_cpu_lock(css->ss, cpu);
+		struct cgroup_subsys_state *pos = NULL;
 		unsigned long flags;
 
 		/*
-		 * The _irqsave() is needed because cgroup_rstat_lock is
+		 * The _irqsave() is needed because the rstat lock is
 		 * spinlock_t which is a sleeping lock on PREEMPT_RT. Acquiring
 		 * this lock with the _irq() suffix only disables interrupts on
 		 * a non-PREEMPT_RT kernel. The raw_spinlock_t below disables
@@ -193,51 +247,149 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 		 * that interrupts are always disabled and later restored.
 		 */
 		raw_spin_lock_irqsave(cpu_lock, flags);
-		while ((pos = cgroup_rstat_cpu_pop_updated(pos, cgrp, cpu))) {
-			struct cgroup_subsys_state *css;
-
-			cgroup_base_stat_flush(pos, cpu);
-			bpf_rstat_flush(pos, cgroup_parent(pos), cpu);
-
-			rcu_read_lock();
-			list_for_each_entry_rcu(css, &pos->rstat_css_list,
-						rstat_css_node)
-				css->ss->css_rstat_flush(css, cpu);
-			rcu_read_unlock();
+		while ((pos = css_rstat_cpu_pop_updated(pos, css, cpu))) {
+			if (pos->ss) {
+				pos->ss->css_rstat_flush(pos, cpu);
+			} else {
+				struct cgroup *cgrp = pos->cgroup;
+
+				cgroup_base_stat_flush(cgrp, cpu);
+				bpf_rstat_flush(cgrp, cgroup_parent(cgrp), cpu);
+			}
 		}
 		raw_spin_unlock_irqrestore(cpu_lock, flags);
 
 		/* if @may_sleep, play nice and yield if necessary */
-		if (may_sleep && (need_resched() ||
-				  spin_needbreak(&cgroup_rstat_lock))) {
-			spin_unlock_irq(&cgroup_rstat_lock);
+		if (may_sleep && (need_resched() || spin_needbreak(lock))) {
+			spin_unlock_irq(lock);
 			if (!cond_resched())
 				cpu_relax();
-			spin_lock_irq(&cgroup_rstat_lock);
+			spin_lock_irq(lock);
 		}
 	}
+
+	WRITE_ONCE(css->rstat_flush_time, jiffies);
 }
 
 /**
- * cgroup_rstat_flush - flush stats in @cgrp's subtree
- * @cgrp: target cgroup
+ * css_rstat_flush - flush stats in @css's subtree
+ * @css: target css
  *
- * Collect all per-cpu stats in @cgrp's subtree into the global counters
- * and propagate them upwards.  After this function returns, all cgroups in
- * the subtree have up-to-date ->stat.
+ * Collect all per-cpu stats in @css's subtree into the global counters
+ * and propagate them upwards.  After this function returns, all csses in
+ * the subtree have up-to-date ->stat.  Only the updated trees of @css's
+ * subsystem are walked and only its rstat locks are taken, flushes of
+ * other subsystems proceed in parallel.
  *
- * This also gets all cgroups in the subtree including @cgrp off the
+ * This also gets all csses in the subtree including @css off the
  * ->updated_children lists.
  *
  * This function may block.
  */
-void cgroup_rstat_flush(struct cgroup *cgrp)
+void css_rstat_flush(struct cgroup_subsys_state *css)
 {
+	spinlock_t *lock = ss_rstat_lock(css->ss);
+
 	might_sleep();
 
-	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
-	spin_unlock_irq(&cgroup_rstat_lock);
+	spin_lock_irq(lock);
+	css_rstat_flush_locked(css, true);
+	spin_unlock_irq(lock);
+}
+EXPORT_SYMBOL_GPL(css_rstat_flush);
+
+static void css_rstat_flush_irqsafe(struct cgroup_subsys_state *css)
+{
+	spinlock_t *lock = ss_rstat_lock(css->ss);
+	unsigned long flags;
+
+	spin_lock_irqsave(lock, flags);
+	css_rstat_flush_locked(css, false);
+	spin_unlock_irqrestore(lock, flags);
+}
+
+/* whether any cpu has updates pending in @css's subtree, may race */
+static bool css_rstat_pending(struct cgroup_subsys_state *css)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (data_race(css_rstat_cpu(css, cpu)->updated_next))
+			return true;
+	return false;
+}
+
+/**
+ * css_rstat_flush_ratelimited - flush stats in @css's subtree if too old
+ * @css: target css
+ *
+ * Like css_rstat_flush() but skipped if nothing in @css's subtree was
+ * updated since the last flush, or if @css's subtree was flushed less
+ * than cgroup.rstat_staleness_ms ago.  For readers which can live with a
+ * recent snapshot and must not contend on the rstat locks every time.
+ *
+ * This function may block.
+ */
+void css_rstat_flush_ratelimited(struct cgroup_subsys_state *css)
+{
+	unsigned int staleness = READ_ONCE(rstat_staleness_ms);
+
+	might_sleep();
+
+	if (staleness &&
+	    time_before(jiffies, READ_ONCE(css->rstat_flush_time) +
+				 msecs_to_jiffies(staleness)))
+		return;
+
+	if (!css_rstat_pending(css))
+		return;
+
+	css_rstat_flush(css);
+}
+EXPORT_SYMBOL_GPL(css_rstat_flush_ratelimited);
+
+/* flush @cgrp's self css and then the csses of all rstat subsystems */
+static void cgroup_rstat_flush_all(struct cgroup *cgrp,
+				   void (*flush)(struct cgroup_subsys_state *))
+{
+	struct cgroup_subsys *ss;
+	int ssid;
+
+	flush(&cgrp->self);
+
+	for_each_subsys(ss, ssid) {
+		struct cgroup_subsys_state *css;
+
+		if (!ss->css_rstat_flush)
+			continue;
+
+		rcu_read_lock();
+		css = rcu_dereference(cgrp->subsys[ssid]);
+		if (css && !css_tryget(css))
+			css = NULL;
+		rcu_read_unlock();
+
+		if (css) {
+			flush(css);
+			css_put(css);
+		}
+	}
+}
+
+/**
+ * cgroup_rstat_flush - flush stats in @cgrp's subtree
+ * @cgrp: target cgroup
+ *
+ * Flush the basic resource statistics and the stats of every subsystem
+ * implementing ->css_rstat_flush() in @cgrp's subtree.  Controllers which
+ * only care about their own stats should use css_rstat_flush().
+ *
+ * This function may block.
+ */
+void cgroup_rstat_flush(struct cgroup *cgrp)
+{
+	might_sleep();
+	cgroup_rstat_flush_all(cgrp, css_rstat_flush);
 }
 
 /**
@@ -248,19 +400,31 @@ void cgroup_rstat_flush(struct cgroup *cgrp)
  */
 void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp)
 {
-	unsigned long flags;
+	cgroup_rstat_flush_all(cgrp, css_rstat_flush_irqsafe);
+}
 
-	spin_lock_irqsave(&cgroup_rstat_lock, flags);
-	cgroup_rstat_flush_locked(cgrp, false);
-	spin_unlock_irqrestore(&cgroup_rstat_lock, flags);
+/**
+ * cgroup_rstat_flush_ratelimited - ratelimited version of cgroup_rstat_flush()
+ * @cgrp: target cgroup
+ *
+ * css_rstat_flush_ratelimited() on @cgrp's self css and on its csses of
+ * all subsystems implementing ->css_rstat_flush().
+ *
+ * This function may block.
+ */
+void cgroup_rstat_flush_ratelimited(struct cgroup *cgrp)
+{
+	might_sleep();
+	cgroup_rstat_flush_all(cgrp, css_rstat_flush_ratelimited);
 }
 
 /**
  * cgroup_rstat_flush_hold - flush stats in @cgrp's subtree and hold
  * @cgrp: target cgroup
  *
- * Flush stats in @cgrp's subtree and prevent further flushes.  Must be
- * paired with cgroup_rstat_flush_release().
+ * Flush the basic resource statistics in @cgrp's subtree and prevent
+ * further flushes of them.  Must be paired with
+ * cgroup_rstat_flush_release().
  *
  * This function may block.
  */
@@ -269,7 +433,7 @@ void cgroup_rstat_flush_hold(struct cgroup *cgrp)
 {
 	might_sleep();
 	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
+	css_rstat_flush_locked(&cgrp->self, true);
 }
 
 /**
@@ -292,11 +456,15 @@ int cgroup_rstat_init(struct cgroup *cgrp)
 			return -ENOMEM;
 	}
 
+	cgrp->self.rstat_cpu = &cgrp->rstat_cpu->updated;
+	cgrp->self.rstat_flush_time = jiffies;
+	seqcount_spinlock_init(&cgrp->bstat_seq, &cgroup_rstat_lock);
+
 	/* ->updated_children list is self terminated */
 	for_each_possible_cpu(cpu) {
 		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
 
-		rstatc->updated_children = cgrp;
+		rstatc->updated.updated_children = &cgrp->self;
 		u64_stats_init(&rstatc->bsync);
 	}
 
@@ -307,27 +475,77 @@ void cgroup_rstat_exit(struct cgroup *cgrp)
 {
 	int cpu;
 
-	cgroup_rstat_flush(cgrp);
+	/* the subsystem csses are flushed by css_rstat_exit() */
+	css_rstat_flush(&cgrp->self);
 
 	/* sanity check */
 	for_each_possible_cpu(cpu) {
-		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
+		struct css_rstat_cpu *rstatc = css_rstat_cpu(&cgrp->self, cpu);
 
-		if (WARN_ON_ONCE(rstatc->updated_children != cgrp) ||
+		if (WARN_ON_ONCE(rstatc->updated_children != &cgrp->self) ||
 		    WARN_ON_ONCE(rstatc->updated_next))
 			return;
 	}
 
 	free_percpu(cgrp->rstat_cpu);
 	cgrp->rstat_cpu = NULL;
+	cgrp->self.rstat_cpu = NULL;
 }
 
-void __init cgroup_rstat_boot(void)
+int css_rstat_init(struct cgroup_subsys_state *css)
 {
 	int cpu;
 
+	if (!css->ss->css_rstat_flush)
+		return 0;
+
+	css->rstat_cpu = alloc_percpu(struct css_rstat_cpu);
+	if (!css->rstat_cpu)
+		return -ENOMEM;
+
+	/* ->updated_children list is self terminated */
 	for_each_possible_cpu(cpu)
+		css_rstat_cpu(css, cpu)->updated_children = css;
+	css->rstat_flush_time = jiffies;
+
+	return 0;
+}
+
+void css_rstat_exit(struct cgroup_subsys_state *css)
+{
+	int cpu;
+
+	if (!css->rstat_cpu)
+		return;
+
+	css_rstat_flush(css);
+
+	/* sanity check */
+	for_each_possible_cpu(cpu) {
+		struct css_rstat_cpu *rstatc = css_rstat_cpu(css, cpu);
+
+		if (WARN_ON_ONCE(rstatc->updated_children != css) ||
+		    WARN_ON_ONCE(rstatc->updated_next))
+			return;
+	}
+
+	free_percpu(css->rstat_cpu);
+	css->rstat_cpu = NULL;
+}
+
+void __init cgroup_rstat_boot(void)
+{
+	int cpu, ssid;
+
+	for (ssid = 0; ssid < CGROUP_SUBSYS_COUNT; ssid++)
+		spin_lock_init(&rstat_ss_lock[ssid]);
+
+	for_each_possible_cpu(cpu) {
 		raw_spin_lock_init(per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu));
+		for (ssid = 0; ssid < CGROUP_SUBSYS_COUNT; ssid++)
+			raw_spin_lock_init(per_cpu_ptr(&rstat_ss_cpu_lock[ssid],
+						       cpu));
+	}
 }
 
 /*
@@ -375,14 +593,18 @@ static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu)
 
 	/* propagate percpu delta to global */
 	cgroup_base_stat_sub(&delta, &rstatc->last_bstat);
+	write_seqcount_begin(&cgrp->bstat_seq);
 	cgroup_base_stat_add(&cgrp->bstat, &delta);
+	write_seqcount_end(&cgrp->bstat_seq);
 	cgroup_base_stat_add(&rstatc->last_bstat, &delta);
 
 	/* propagate global delta to parent (unless that's root) */
 	if (cgroup_parent(parent)) {
 		delta = cgrp->bstat;
 		cgroup_base_stat_sub(&delta, &cgrp->last_bstat);
+		write_seqcount_begin(&parent->bstat_seq);
 		cgroup_base_stat_add(&parent->bstat, &delta);
+		write_seqcount_end(&parent->bstat_seq);
 		cgroup_base_stat_add(&cgrp->last_bstat, &delta);
 	}
 }
@@ -497,14 +719,24 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 #endif
 
 	if (cgroup_parent(cgrp)) {
-		cgroup_rstat_flush_hold(cgrp);
-		usage = cgrp->bstat.cputime.sum_exec_runtime;
-		cputime_adjust(&cgrp->bstat.cputime, &cgrp->prev_cputime,
+		unsigned int seq;
+
+		/*
+		 * Flushing is subject to cgroup.rstat_staleness_ms and the
+		 * snapshot is taken without holding off concurrent flushes.
+		 */
+		css_rstat_flush_ratelimited(&cgrp->self);
+		do {
+			seq = read_seqcount_begin(&cgrp->bstat_seq);
+			bstat = cgrp->bstat;
+		} while (read_seqcount_retry(&cgrp->bstat_seq, seq));
+
+		usage = bstat.cputime.sum_exec_runtime;
+		cputime_adjust(&bstat.cputime, &cgrp->prev_cputime,
 			       &utime, &stime);
 #ifdef CONFIG_SCHED_CORE
-		forceidle_time = cgrp->bstat.forceidle_sum;
+		forceidle_time = bstat.forceidle_sum;
 #endif
-		cgroup_rstat_flush_release();
 	} else {
 		root_cgroup_cputime(&bstat);
 		usage = bstat.cputime.sum_exec_runtime;
@@ -8,6 +8,8 @@
 #include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/dma-direct.h>
+#include <linux/dma-map-ops.h>
 #include <linux/dma-mapping.h>
 #include <linux/kernel.h>
 #include <linux/kthread.h>
@@ -16,54 +18,235 @@
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/swiotlb.h>
 #include <linux/timekeeping.h>
 
+/*
+ * Latencies are counted in log-linear buckets: exact below 16ns, then 8
+ * buckets per power of two, which bounds the error of a percentile to
+ * 12.5%. The last bucket holds everything from 16s on.
+ */
+#define MAP_BENCHMARK_SUB_BITS	3
+#define MAP_BENCHMARK_SUB	(1U << MAP_BENCHMARK_SUB_BITS)
+#define MAP_BENCHMARK_BUCKETS	256
+
+struct map_benchmark_hist {
+	u64 map[MAP_BENCHMARK_BUCKETS];
+	u64 unmap[MAP_BENCHMARK_BUCKETS];
+};
+
 struct map_benchmark_data {
 	struct map_benchmark bparam;
 	struct device *dev;
 	struct dentry  *debugfs;
+	struct dentry  *hist_debugfs;
 	enum dma_data_direction dir;
 	atomic64_t sum_map_100ns;
 	atomic64_t sum_unmap_100ns;
 	atomic64_t sum_sq_map;
 	atomic64_t sum_sq_unmap;
 	atomic64_t loops;
+	struct map_benchmark_hist __percpu *hist;
+	struct map_benchmark_hist total;
+};
+
+static const enum dma_data_direction map_benchmark_dirs[] = {
+	DMA_BIDIRECTIONAL,
+	DMA_TO_DEVICE,
+	DMA_FROM_DEVICE,
 };
 
+static unsigned int map_benchmark_bucket(u64 ns)
+{
+	unsigned int shift;
+
+	if (ns < 2 * MAP_BENCHMARK_SUB)
+		return ns;
+
+	shift = fls64(ns) - 1 - MAP_BENCHMARK_SUB_BITS;
+	return min_t(u64, shift * MAP_BENCHMARK_SUB + (ns >> shift),
+		     MAP_BENCHMARK_BUCKETS - 1);
+}
+
+/* The lowest latency counted in @bucket */
+static u64 map_benchmark_bucket_ns(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < 2 * MAP_BENCHMARK_SUB)
+		return bucket;
+
+	shift = bucket / MAP_BENCHMARK_SUB - 1;
+	return (u64)(bucket % MAP_BENCHMARK_SUB + MAP_BENCHMARK_SUB) << shift;
+}
+
+static u64 map_benchmark_samples(const u64 *hist)
+{
+	u64 total = 0;
+	unsigned int i;
+
+	for (i = 0; i < MAP_BENCHMARK_BUCKETS; i++)
+		total += hist[i];
+	return total;
+}
+
+/* @pct is in hundredths of a percent */
+static u64 map_benchmark_percentile(const u64 *hist, unsigned int pct)
+{
+	u64 total = map_benchmark_samples(hist), target, sum = 0;
+	unsigned int i;
+
+	if (!total)
+		return 0;
+
+	target = div64_u64(total * pct + 9999, 10000);
+	for (i = 0; i < MAP_BENCHMARK_BUCKETS; i++) {
+		sum += hist[i];
+		if (sum >= target)
+			break;
+	}
+	return map_benchmark_bucket_ns(min_t(unsigned int, i,
+					     MAP_BENCHMARK_BUCKETS - 1));
+}
+
+#ifdef CONFIG_SWIOTLB
+/*
+ * Map straight through swiotlb, whatever the device's dma_map_ops are, to
+ * measure the bounce buffer and its contention on its own.
+ */
+static void map_benchmark_bounce_unmap(struct device *dev,
+		struct sg_table *sgt, int nents, enum dma_data_direction dir)
+{
+	struct scatterlist *sg;
+	phys_addr_t phys;
+	int i;
+
+	for_each_sg(sgt->sgl, sg, nents, i) {
+		phys = dma_to_phys(dev, sg->dma_address);
+		if (!dev_is_dma_coherent(dev))
+			arch_sync_dma_for_cpu(phys, sg->length, dir);
+		swiotlb_tbl_unmap_single(dev, phys, sg->length, dir, 0);
+	}
+}
+
+static int map_benchmark_bounce_map(struct device *dev, struct sg_table *sgt,
+		enum dma_data_direction dir)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sgtable_sg(sgt, sg, i) {
+		sg->dma_address = swiotlb_map(dev, sg_phys(sg), sg->length,
+					      dir, 0);
+		if (sg->dma_address == DMA_MAPPING_ERROR) {
+			map_benchmark_bounce_unmap(dev, sgt, i, dir);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+#else
+static void map_benchmark_bounce_unmap(struct device *dev,
+		struct sg_table *sgt, int nents, enum dma_data_direction dir)
+{
+}
+
+static int map_benchmark_bounce_map(struct device *dev, struct sg_table *sgt,
+		enum dma_data_direction dir)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_SWIOTLB */
+
+static int map_benchmark_map(struct map_benchmark_data *map,
+		struct sg_table *sgt, enum dma_data_direction dir)
+{
+	struct scatterlist *sg = sgt->sgl;
+
+	if (map->bparam.flags & DMA_MAP_FORCE_BOUNCE)
+		return map_benchmark_bounce_map(map->dev, sgt, dir);
+
+	if (map->bparam.mode == DMA_MAP_SG_MODE)
+		return dma_map_sgtable(map->dev, sgt, dir, 0);
+
+	sg->dma_address = dma_map_single(map->dev, sg_virt(sg), sg->length,
+					 dir);
+	if (unlikely(dma_mapping_error(map->dev, sg->dma_address)))
+		return -ENOMEM;
+	return 0;
+}
+
+static void map_benchmark_unmap(struct map_benchmark_data *map,
+		struct sg_table *sgt, enum dma_data_direction dir)
+{
+	struct scatterlist *sg = sgt->sgl;
+
+	if (map->bparam.flags & DMA_MAP_FORCE_BOUNCE)
+		map_benchmark_bounce_unmap(map->dev, sgt, sgt->orig_nents,
+					   dir);
+	else if (map->bparam.mode == DMA_MAP_SG_MODE)
+		dma_unmap_sgtable(map->dev, sgt, dir, 0);
+	else
+		dma_unmap_single(map->dev, sg->dma_address, sg->length, dir);
+}
+
 static int map_benchmark_thread(void *data)
 {
-	void *buf;
-	dma_addr_t dma_addr;
 	struct map_benchmark_data *map = data;
 	int npages = map->bparam.granule;
 	u64 size = npages * PAGE_SIZE;
-	int ret = 0;
+	unsigned int nents = 1, iter = 0;
+	enum dma_data_direction dir;
+	struct scatterlist *sg;
+	struct sg_table sgt;
+	int ret, i;
 
-	buf = alloc_pages_exact(size, GFP_KERNEL);
-	if (!buf)
-		return -ENOMEM;
+	if (map->bparam.mode == DMA_MAP_SG_MODE)
+		nents = map->bparam.nents;
+
+	ret = sg_alloc_table(&sgt, nents, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	/* Separate buffers, like the pages of a real scatterlist */
+	for_each_sgtable_sg(&sgt, sg, i) {
+		void *buf = alloc_pages_exact(size, GFP_KERNEL);
+
+		if (!buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		sg_set_buf(sg, buf, size);
+	}
 
 	while (!kthread_should_stop())  {
 		u64 map_100ns, unmap_100ns, map_sq, unmap_sq;
 		ktime_t map_stime, map_etime, unmap_stime, unmap_etime;
 		ktime_t map_delta, unmap_delta;
 
+		dir = map->dir;
+		if (map->bparam.dma_dir == DMA_MAP_MIXED)
+			dir = map_benchmark_dirs[iter++ %
+						 ARRAY_SIZE(map_benchmark_dirs)];
+
 		/*
 		 * for a non-coherent device, if we don't stain them in the
 		 * cache, this will give an underestimate of the real-world
 		 * overhead of BIDIRECTIONAL or TO_DEVICE mappings;
 		 * 66 means evertything goes well! 66 is lucky.
 		 */
-		if (map->dir != DMA_FROM_DEVICE)
-			memset(buf, 0x66, size);
+		if (dir != DMA_FROM_DEVICE)
+			for_each_sgtable_sg(&sgt, sg, i)
+				memset(sg_virt(sg), 0x66, size);
 
 		map_stime = ktime_get();
-		dma_addr = dma_map_single(map->dev, buf, size, map->dir);
-		if (unlikely(dma_mapping_error(map->dev, dma_addr))) {
-			pr_err("dma_map_single failed on %s\n",
+		ret = map_benchmark_map(map, &sgt, dir);
+		if (unlikely(ret)) {
+			pr_err("dma mapping failed on %s\n",
 				dev_name(map->dev));
-			ret = -ENOMEM;
 			goto out;
 		}
 		map_etime = ktime_get();
@@ -73,10 +256,14 @@ static int map_benchmark_thread(void *data)
 		ndelay(map->bparam.dma_trans_ns);
 
 		unmap_stime = ktime_get();
-		dma_unmap_single(map->dev, dma_addr, size, map->dir);
+		map_benchmark_unmap(map, &sgt, dir);
 		unmap_etime = ktime_get();
 		unmap_delta = ktime_sub(unmap_etime, unmap_stime);
 
+		/* per-CPU histograms, so recording doesn't bounce cachelines */
+		this_cpu_inc(map->hist->map[map_benchmark_bucket(map_delta)]);
+		this_cpu_inc(map->hist->unmap[map_benchmark_bucket(unmap_delta)]);
+
 		/* calculate sum and sum of squares */
 
 		map_100ns = div64_ul(map_delta,  100);
@@ -92,7 +279,10 @@ static int map_benchmark_thread(void *data)
 	}
 
 out:
-	free_pages_exact(buf, size);
+	for_each_sgtable_sg(&sgt, sg, i)
+		if (sg_page(sg))
+			free_pages_exact(sg_virt(sg), size);
+	sg_free_table(&sgt);
 	return ret;
 }
 
@@ -104,7 +294,7 @@ static int do_map_benchmark(struct map_benchmark_data *map)
 	const cpumask_t *cpu_mask = cpumask_of_node(node);
 	u64 loops;
 	int ret = 0;
-	int i;
+	int cpu, i, j;
 
 	tsk = kmalloc_array(threads, sizeof(*tsk), GFP_KERNEL);
 	if (!tsk)
@@ -131,6 +321,8 @@ static int do_map_benchmark(struct map_benchmark_data *map)
 	atomic64_set(&map->sum_sq_map, 0);
 	atomic64_set(&map->sum_sq_unmap, 0);
 	atomic64_set(&map->loops, 0);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(map->hist, cpu), 0, sizeof(*map->hist));
 
 	for (i = 0; i < threads; i++) {
 		get_task_struct(tsk[i]);
@@ -167,6 +359,29 @@ static int do_map_benchmark(struct map_benchmark_data *map)
 				map->bparam.avg_unmap_100ns;
 		map->bparam.map_stddev = int_sqrt64(map_variance);
 		map->bparam.unmap_stddev = int_sqrt64(unmap_variance);
+
+		memset(&map->total, 0, sizeof(map->total));
+		for_each_possible_cpu(cpu) {
+			struct map_benchmark_hist *hist;
+
+			hist = per_cpu_ptr(map->hist, cpu);
+			for (j = 0; j < MAP_BENCHMARK_BUCKETS; j++) {
+				map->total.map[j] += hist->map[j];
+				map->total.unmap[j] += hist->unmap[j];
+			}
+		}
+		map->bparam.map_p50_ns =
+			map_benchmark_percentile(map->total.map, 5000);
+		map->bparam.map_p99_ns =
+			map_benchmark_percentile(map->total.map, 9900);
+		map->bparam.map_p999_ns =
+			map_benchmark_percentile(map->total.map, 9990);
+		map->bparam.unmap_p50_ns =
+			map_benchmark_percentile(map->total.unmap, 5000);
+		map->bparam.unmap_p99_ns =
+			map_benchmark_percentile(map->total.unmap, 9900);
+		map->bparam.unmap_p999_ns =
+			map_benchmark_percentile(map->total.unmap, 9990);
 	}
 
 out:
@@ -218,8 +433,38 @@ static long map_benchmark_ioctl(struct file *file, unsigned int cmd,
 			return -EINVAL;
 		}
 
+		switch (map->bparam.mode) {
+		case DMA_MAP_SINGLE_MODE:
+			break;
+		case DMA_MAP_SG_MODE:
+			if (map->bparam.nents < 1 ||
+			    map->bparam.nents > DMA_MAP_MAX_NENTS) {
+				pr_err("invalid number of sg entries\n");
+				return -EINVAL;
+			}
+			break;
+		default:
+			pr_err("invalid mapping mode\n");
+			return -EINVAL;
+		}
+
+		if (map->bparam.flags & ~DMA_MAP_FORCE_BOUNCE) {
+			pr_err("invalid flags\n");
+			return -EINVAL;
+		}
+
+		if ((map->bparam.flags & DMA_MAP_FORCE_BOUNCE) &&
+		    (!IS_ENABLED(CONFIG_SWIOTLB) ||
+		     !is_swiotlb_active(map->dev) ||
+		     map->bparam.granule * PAGE_SIZE >
+		     swiotlb_max_mapping_size(map->dev))) {
+			pr_err("can't bounce through swiotlb\n");
+			return -EINVAL;
+		}
+
 		switch (map->bparam.dma_dir) {
 		case DMA_MAP_BIDIRECTIONAL:
+		case DMA_MAP_MIXED:
 			map->dir = DMA_BIDIRECTIONAL;
 			break;
 		case DMA_MAP_FROM_DEVICE:
@@ -268,11 +513,37 @@ static const struct file_operations map_benchmark_fops = {
 	.unlocked_ioctl		= map_benchmark_ioctl,
 };
 
+static int map_benchmark_hist_show(struct seq_file *m, void *v)
+{
+	struct map_benchmark_data *map = m->private;
+	struct map_benchmark_hist *hist;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		hist = per_cpu_ptr(map->hist, cpu);
+		if (!map_benchmark_samples(hist->map))
+			continue;
+
+		seq_printf(m, "cpu%d map p50 %llu p99 %llu p999 %llu ns, unmap p50 %llu p99 %llu p999 %llu ns\n",
+			   cpu,
+			   map_benchmark_percentile(hist->map, 5000),
+			   map_benchmark_percentile(hist->map, 9900),
+			   map_benchmark_percentile(hist->map, 9990),
+			   map_benchmark_percentile(hist->unmap, 5000),
+			   map_benchmark_percentile(hist->unmap, 9900),
+			   map_benchmark_percentile(hist->unmap, 9990));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(map_benchmark_hist);
+
 static void map_benchmark_remove_debugfs(void *data)
 {
 	struct map_benchmark_data *map = (struct map_benchmark_data *)data;
 
+	debugfs_remove(map->hist_debugfs);
 	debugfs_remove(map->debugfs);
+	free_percpu(map->hist);
 }
 
 static int __map_benchmark_probe(struct device *dev)
@@ -286,7 +557,11 @@ static int __map_benchmark_probe(struct device *dev)
 		return -ENOMEM;
 	map->dev = dev;
 
-	ret = devm_add_action(dev, map_benchmark_remove_debugfs, map);
+	map->hist = alloc_percpu(struct map_benchmark_hist);
+	if (!map->hist)
+		return -ENOMEM;
+
+	ret = devm_add_action_or_reset(dev, map_benchmark_remove_debugfs, map);
 	if (ret) {
 		pr_err("Can't add debugfs remove action\n");
 		return ret;
@@ -302,6 +577,11 @@ static int __map_benchmark_probe(struct device *dev)
 		return PTR_ERR(entry);
 	map->debugfs = entry;
 
+	/* Per-CPU percentiles of the last run */
+	map->hist_debugfs = debugfs_create_file("dma_map_benchmark_hist", 0400,
+						NULL, map,
+						&map_benchmark_hist_fops);
+
 	return 0;
 }
 
@@ -34,6 +34,7 @@
 #include <linux/init.h>
 #include <linux/memblock.h>
 #include <linux/mm.h>
+#include <linux/percpu.h>
 #include <linux/pfn.h>
 #include <linux/scatterlist.h>
 #include <linux/set_memory.h>
@@ -41,6 +42,12 @@
 #include <linux/string.h>
 #include <linux/swiotlb.h>
 #include <linux/types.h>
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+#include <linux/rculist.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#endif
 #ifdef CONFIG_DMA_RESTRICTED_POOL
 #include <linux/of.h>
 #include <linux/of_fdt.h>
@@ -70,6 +77,8 @@ struct io_tlb_slot {
 
 static bool swiotlb_force_bounce;
 static bool swiotlb_force_disable;
+/* The default pool lives anywhere in memory and may grow */
+static bool swiotlb_can_grow __ro_after_init;
 
 struct io_tlb_mem io_tlb_default_mem;
 
@@ -94,6 +103,73 @@ struct io_tlb_area {
 	spinlock_t lock;
 };
 
+/*
+ * Runs of 1 << order slots, up to 32 slots (64KB), are cached per CPU.
+ * A CPU holds at most IO_TLB_PCP_SLOTS slots of each size, and at most
+ * 2 * IO_TLB_PCP_BATCH runs; the caches are refilled from and flushed to
+ * the areas half a cache at a time.
+ */
+#define IO_TLB_PCP_ORDERS	6
+#define IO_TLB_PCP_BATCH	8
+#define IO_TLB_PCP_SLOTS	64
+
+/**
+ * struct io_tlb_pcp - per-CPU cache of free IO TLB slot runs
+ *
+ * Slots in the cache are taken from their area's free list and accounted as
+ * used there. Every run is aligned to its size.
+ *
+ * @lock:	Protects the cache. Only ever contended by a drain after a
+ *		failed allocation.
+ * @nr:		The number of cached runs of each order.
+ * @index:	The index of the first slot of each cached run.
+ * @hits:	Allocations served from the cache.
+ * @refills:	Refills of the cache from an area.
+ * @flushes:	Flushes of cached runs back to their areas.
+ */
+struct io_tlb_pcp {
+	spinlock_t lock;
+	unsigned int nr[IO_TLB_PCP_ORDERS];
+	unsigned int index[IO_TLB_PCP_ORDERS][2 * IO_TLB_PCP_BATCH];
+	unsigned long hits;
+	unsigned long refills;
+	unsigned long flushes;
+};
+
+static bool swiotlb_pcp_drain(struct io_tlb_mem *mem);
+static unsigned long mem_used(struct io_tlb_mem *mem);
+
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+/*
+ * Pools added to the default one are SWIOTLB_DYN_POOL_SIZE large, or as
+ * large as the page allocator can provide. Another pool is added when
+ * SWIOTLB_DYN_GROW_PCT percent of all slots are in use, and a pool found
+ * unused twice in a row by the reclaim, which runs every
+ * SWIOTLB_DYN_RECLAIM_PERIOD, is given back.
+ */
+#define SWIOTLB_DYN_POOL_SIZE		SZ_4M
+#define SWIOTLB_DYN_MAX_POOLS		64
+#define SWIOTLB_DYN_GROW_PCT		75
+#define SWIOTLB_DYN_RECLAIM_PERIOD	(10 * HZ)
+
+/**
+ * struct io_tlb_dyn - dynamic growth of an IO TLB pool
+ *
+ * @mem:	The pool the others are added to.
+ * @lock:	Protects the updates of @mem->pools and @nr_pools.
+ * @nr_pools:	The number of pools added to @mem.
+ * @grow:	Adds a pool once @mem is kicked and the usage is high.
+ * @reclaim:	Frees the pools which stayed unused.
+ */
+struct io_tlb_dyn {
+	struct io_tlb_mem *mem;
+	spinlock_t lock;
+	unsigned int nr_pools;
+	struct work_struct grow;
+	struct delayed_work reclaim;
+};
+#endif /* CONFIG_SWIOTLB_DYNAMIC */
+
 /*
  * Round up number of slabs to the next power of 2. The last area is going
  * be smaller than the rest if default_nslabs is not power of two.
@@ -281,6 +357,9 @@ static void swiotlb_init_io_tlb_mem(struct io_tlb_mem *mem, phys_addr_t start,
 		mem->areas[i].index = 0;
 		mem->areas[i].used = 0;
 	}
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+	INIT_LIST_HEAD(&mem->pools);
+#endif
 
 	for (i = 0; i < mem->nslabs; i++) {
 		mem->slots[i].list = IO_TLB_SEGSIZE - io_tlb_offset(i);
@@ -370,6 +449,7 @@ void __init swiotlb_init_remap(bool addressing_limit, unsigned int flags,
 
 	swiotlb_init_io_tlb_mem(mem, __pa(tlb), nslabs, flags, false,
 				default_nareas);
+	swiotlb_can_grow = (flags & SWIOTLB_ANY) && !remap;
 
 	if (flags & SWIOTLB_VERBOSE)
 		swiotlb_print_info();
@@ -380,6 +460,38 @@ void __init swiotlb_init(bool addressing_limit, unsigned int flags)
 	swiotlb_init_remap(addressing_limit, flags, NULL);
 }
 
+/*
+ * Set up the per-CPU slot caches of a pool, unless they could hold more
+ * than a quarter of it.
+ */
+static void swiotlb_pcp_alloc(struct io_tlb_mem *mem)
+{
+	struct io_tlb_pcp __percpu *pcp;
+	int cpu;
+
+	if (mem->nslabs < num_possible_cpus() * IO_TLB_PCP_ORDERS *
+			  IO_TLB_PCP_SLOTS * 4)
+		return;
+
+	pcp = alloc_percpu(struct io_tlb_pcp);
+	if (!pcp) {
+		pr_warn("%s: Failed to allocate the slot caches\n", __func__);
+		return;
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pcp, cpu)->lock);
+
+	WRITE_ONCE(mem->pcp, pcp);
+}
+
+static int __init swiotlb_pcp_init(void)
+{
+	if (io_tlb_default_mem.nslabs && !io_tlb_default_mem.pcp)
+		swiotlb_pcp_alloc(&io_tlb_default_mem);
+	return 0;
+}
+subsys_initcall(swiotlb_pcp_init);
+
 /*
  * Systems with larger DMA zones (those that don't support ISA) can
  * initialize the swiotlb later using the slab allocator if needed.
@@ -451,6 +563,7 @@ int swiotlb_init_late(size_t size, gfp_t gfp_mask,
 			     (nslabs << IO_TLB_SHIFT) >> PAGE_SHIFT);
 	swiotlb_init_io_tlb_mem(mem, virt_to_phys(vstart), nslabs, 0, true,
 				default_nareas);
+	swiotlb_pcp_alloc(mem);
 
 	swiotlb_print_info();
 	return 0;
@@ -462,6 +575,264 @@ int swiotlb_init_late(size_t size, gfp_t gfp_mask,
 	return -ENOMEM;
 }
 
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+/*
+ * Called when an allocation had to leave the area of its CPU or failed.
+ * Only looks at the work unless it is idle, so a pool under pressure doesn't
+ * keep requeueing it.
+ */
+static void swiotlb_dyn_kick(struct io_tlb_mem *mem)
+{
+	struct io_tlb_dyn *dyn = READ_ONCE(mem->dyn);
+
+	if (dyn && !work_pending(&dyn->grow))
+		schedule_work(&dyn->grow);
+}
+
+struct io_tlb_mem *__swiotlb_find_pool(struct io_tlb_mem *mem,
+				       phys_addr_t paddr)
+{
+	struct io_tlb_mem *pool, *found = NULL;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &mem->pools, node) {
+		if (paddr >= pool->start && paddr < pool->end) {
+			found = pool;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return found;
+}
+EXPORT_SYMBOL_GPL(__swiotlb_find_pool);
+
+static struct io_tlb_mem *swiotlb_dyn_alloc_pool(struct io_tlb_mem *mem)
+{
+	int order = min_t(int, MAX_ORDER - 1,
+			  get_order(SWIOTLB_DYN_POOL_SIZE));
+	int min_order = get_order(IO_TLB_SEGSIZE << IO_TLB_SHIFT);
+	struct io_tlb_mem *pool;
+	struct page *page = NULL;
+	unsigned long nslabs;
+	unsigned int nareas;
+
+	for (; order >= min_order; order--) {
+		page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+		if (page)
+			break;
+	}
+	if (!page)
+		return NULL;
+
+	nslabs = SLABS_PER_PAGE << order;
+	nareas = min_t(unsigned int, mem->nareas, nslabs / IO_TLB_SEGSIZE);
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		goto error_pool;
+	pool->areas = kcalloc(nareas, sizeof(*pool->areas), GFP_KERNEL);
+	if (!pool->areas)
+		goto error_areas;
+	pool->slots = kvcalloc(nslabs, sizeof(*pool->slots), GFP_KERNEL);
+	if (!pool->slots)
+		goto error_slots;
+
+	if (set_memory_decrypted((unsigned long)page_address(page),
+				 1 << order)) {
+		/* Pages in an unknown state can't go back to the allocator */
+		kvfree(pool->slots);
+		kfree(pool->areas);
+		kfree(pool);
+		return NULL;
+	}
+	swiotlb_init_io_tlb_mem(pool, page_to_phys(page), nslabs, 0, true,
+				nareas);
+	return pool;
+
+error_slots:
+	kfree(pool->areas);
+error_areas:
+	kfree(pool);
+error_pool:
+	__free_pages(page, order);
+	return NULL;
+}
+
+static void swiotlb_dyn_free_pool(struct io_tlb_mem *pool)
+{
+	unsigned long vaddr = (unsigned long)phys_to_virt(pool->start);
+	unsigned int order = get_order(pool->end - pool->start);
+
+	if (!set_memory_encrypted(vaddr, 1 << order))
+		free_pages(vaddr, order);
+	kvfree(pool->slots);
+	kfree(pool->areas);
+	kfree(pool);
+}
+
+static void swiotlb_dyn_grow(struct work_struct *work)
+{
+	struct io_tlb_dyn *dyn = container_of(work, struct io_tlb_dyn, grow);
+	struct io_tlb_mem *mem = dyn->mem, *pool;
+	unsigned long used, total;
+
+	if (READ_ONCE(dyn->nr_pools) >= SWIOTLB_DYN_MAX_POOLS)
+		return;
+
+	used = mem_used(mem);
+	total = mem->nslabs;
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &mem->pools, node) {
+		used += mem_used(pool);
+		total += pool->nslabs;
+	}
+	rcu_read_unlock();
+
+	if (used * 100 < total * SWIOTLB_DYN_GROW_PCT)
+		return;
+
+	pool = swiotlb_dyn_alloc_pool(mem);
+	if (!pool) {
+		pr_warn_ratelimited("failed to add a pool\n");
+		return;
+	}
+
+	spin_lock(&dyn->lock);
+	list_add_tail_rcu(&pool->node, &mem->pools);
+	dyn->nr_pools++;
+	spin_unlock(&dyn->lock);
+
+	pr_debug("added a %lu KiB pool, %lu of %lu slots in use\n",
+		 (pool->nslabs << IO_TLB_SHIFT) >> 10, used, total);
+
+	schedule_delayed_work(&dyn->reclaim, SWIOTLB_DYN_RECLAIM_PERIOD);
+}
+
+/*
+ * Make an unused pool unallocatable by accounting all its slots as used.
+ * Returns false if there are mappings in it.
+ */
+static bool swiotlb_dyn_seal_pool(struct io_tlb_mem *pool)
+{
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < pool->nareas; i++) {
+		struct io_tlb_area *area = &pool->areas[i];
+
+		spin_lock_irqsave(&area->lock, flags);
+		if (area->used) {
+			spin_unlock_irqrestore(&area->lock, flags);
+			goto unseal;
+		}
+		area->used = pool->area_nslabs;
+		spin_unlock_irqrestore(&area->lock, flags);
+	}
+	return true;
+
+unseal:
+	while (--i >= 0) {
+		spin_lock_irqsave(&pool->areas[i].lock, flags);
+		pool->areas[i].used = 0;
+		spin_unlock_irqrestore(&pool->areas[i].lock, flags);
+	}
+	return false;
+}
+
+/*
+ * Give back at most one pool per period, the one which was unused the last
+ * two times we looked. Sealing it first keeps the allocations out while
+ * the lookups of the mappings elsewhere finish walking past it.
+ */
+static void swiotlb_dyn_reclaim(struct work_struct *work)
+{
+	struct io_tlb_dyn *dyn = container_of(to_delayed_work(work),
+					      struct io_tlb_dyn, reclaim);
+	struct io_tlb_mem *mem = dyn->mem, *pool, *victim = NULL;
+	unsigned int nr_pools;
+
+	spin_lock(&dyn->lock);
+	list_for_each_entry(pool, &mem->pools, node) {
+		if (mem_used(pool)) {
+			pool->idle = false;
+			continue;
+		}
+		if (!victim && pool->idle && swiotlb_dyn_seal_pool(pool)) {
+			victim = pool;
+			continue;
+		}
+		pool->idle = true;
+	}
+	if (victim) {
+		list_del_rcu(&victim->node);
+		dyn->nr_pools--;
+	}
+	nr_pools = dyn->nr_pools;
+	spin_unlock(&dyn->lock);
+
+	if (victim) {
+		synchronize_rcu();
+		swiotlb_dyn_free_pool(victim);
+	}
+
+	if (nr_pools)
+		schedule_delayed_work(&dyn->reclaim,
+				      SWIOTLB_DYN_RECLAIM_PERIOD);
+}
+
+/*
+ * Growing needs the default pool to live anywhere in memory and to be used
+ * as allocated, without remapping or a separate unencrypted alias.
+ */
+static int __init swiotlb_dyn_init(void)
+{
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+	struct io_tlb_dyn *dyn;
+
+	if (!mem->nslabs || !swiotlb_can_grow || swiotlb_unencrypted_base)
+		return 0;
+
+	dyn = kzalloc(sizeof(*dyn), GFP_KERNEL);
+	if (!dyn)
+		return -ENOMEM;
+
+	dyn->mem = mem;
+	spin_lock_init(&dyn->lock);
+	INIT_WORK(&dyn->grow, swiotlb_dyn_grow);
+	INIT_DELAYED_WORK(&dyn->reclaim, swiotlb_dyn_reclaim);
+	WRITE_ONCE(mem->dyn, dyn);
+	return 0;
+}
+subsys_initcall(swiotlb_dyn_init);
+
+static void swiotlb_dyn_exit(struct io_tlb_mem *mem)
+{
+	struct io_tlb_dyn *dyn = mem->dyn;
+	struct io_tlb_mem *pool, *tmp;
+
+	if (!dyn)
+		return;
+
+	WRITE_ONCE(mem->dyn, NULL);
+	cancel_work_sync(&dyn->grow);
+	cancel_delayed_work_sync(&dyn->reclaim);
+	synchronize_rcu();
+
+	list_for_each_entry_safe(pool, tmp, &mem->pools, node)
+		swiotlb_dyn_free_pool(pool);
+	kfree(dyn);
+}
+#else
+static inline void swiotlb_dyn_kick(struct io_tlb_mem *mem)
+{
+}
+
+static inline void swiotlb_dyn_exit(struct io_tlb_mem *mem)
+{
+}
+#endif /* CONFIG_SWIOTLB_DYNAMIC */
+
 void __init swiotlb_exit(void)
 {
 	struct io_tlb_mem *mem = &io_tlb_default_mem;
@@ -476,6 +847,11 @@ void __init swiotlb_exit(void)
 		return;
 
 	pr_info("tearing down default memory pool\n");
+	swiotlb_dyn_exit(mem);
+	if (mem->pcp) {
+		swiotlb_pcp_drain(mem);
+		free_percpu(mem->pcp);
+	}
 	tbl_vaddr = (unsigned long)phys_to_virt(mem->start);
 	tbl_size = PAGE_ALIGN(mem->end - mem->start);
 	slots_size = PAGE_ALIGN(array_size(sizeof(*mem->slots), mem->nslabs));
@@ -511,7 +887,7 @@ static unsigned int swiotlb_align_offset(struct device *dev, u64 addr)
 static void swiotlb_bounce(struct device *dev, phys_addr_t tlb_addr, size_t size,
 			   enum dma_data_direction dir)
 {
-	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	struct io_tlb_mem *mem = swiotlb_find_pool(dev, tlb_addr);
 	int index = (tlb_addr - mem->start) >> IO_TLB_SHIFT;
 	phys_addr_t orig_addr = mem->slots[index].orig_addr;
 	size_t alloc_size = mem->slots[index].alloc_size;
@@ -600,15 +976,84 @@ static unsigned int wrap_area_index(struct io_tlb_mem *mem, unsigned int index)
 	return index;
 }
 
+/*
+ * For mappings with an alignment requirement don't bother looping to
+ * unaligned slots once we found an aligned one.  For allocations of
+ * PAGE_SIZE or larger only look for page aligned allocations.
+ */
+static unsigned int swiotlb_stride(struct device *dev, size_t alloc_size,
+		unsigned int alloc_align_mask)
+{
+	unsigned int iotlb_align_mask =
+		dma_get_min_align_mask(dev) & ~(IO_TLB_SIZE - 1);
+	unsigned int stride;
+
+	stride = (iotlb_align_mask >> IO_TLB_SHIFT) + 1;
+	if (alloc_size >= PAGE_SIZE)
+		stride = max(stride, stride << (PAGE_SHIFT - IO_TLB_SHIFT));
+	return max(stride, (alloc_align_mask >> IO_TLB_SHIFT) + 1);
+}
+
+/*
+ * Take @nslots free slots starting at @index off the free list, and update
+ * the free counts of the preceding slots in the segment.
+ */
+static void swiotlb_take_slots(struct io_tlb_mem *mem, unsigned int index,
+		unsigned int nslots)
+{
+	unsigned int count = 0, i;
+
+	for (i = index; i < index + nslots; i++)
+		mem->slots[i].list = 0;
+	for (i = index - 1;
+	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 &&
+	     mem->slots[i].list; i--)
+		mem->slots[i].list = ++count;
+}
+
+/*
+ * Return @nslots slots starting at @index to the free list by setting the
+ * corresponding entries to indicate the number of contiguous entries
+ * available. While returning the entries to the free list, we merge the
+ * entries with slots below and above the pool being returned.
+ */
+static void swiotlb_put_slots(struct io_tlb_mem *mem, int index, int nslots)
+{
+	int count, i;
+
+	if (index + nslots < ALIGN(index + 1, IO_TLB_SEGSIZE))
+		count = mem->slots[index + nslots].list;
+	else
+		count = 0;
+
+	/*
+	 * Step 1: return the slots to the free list, merging the slots with
+	 * superceeding slots
+	 */
+	for (i = index + nslots - 1; i >= index; i--) {
+		mem->slots[i].list = ++count;
+		mem->slots[i].orig_addr = INVALID_PHYS_ADDR;
+		mem->slots[i].alloc_size = 0;
+	}
+
+	/*
+	 * Step 2: merge the returned slots with the preceding slots, if
+	 * available (non zero)
+	 */
+	for (i = index - 1;
+	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 && mem->slots[i].list;
+	     i--)
+		mem->slots[i].list = ++count;
+}
+
 /*
  * Find a suitable number of IO TLB entries size that will fit this request and
  * allocate a buffer from that IO TLB pool.
  */
-static int swiotlb_do_find_slots(struct device *dev, int area_index,
-		phys_addr_t orig_addr, size_t alloc_size,
+static int swiotlb_do_find_slots(struct device *dev, struct io_tlb_mem *mem,
+		int area_index, phys_addr_t orig_addr, size_t alloc_size,
 		unsigned int alloc_align_mask)
 {
-	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
 	struct io_tlb_area *area = mem->areas + area_index;
 	unsigned long boundary_mask = dma_get_seg_boundary(dev);
 	dma_addr_t tbl_dma_addr =
@@ -617,7 +1062,7 @@ static int swiotlb_do_find_slots(struct device *dev, int area_index,
 	unsigned int iotlb_align_mask =
 		dma_get_min_align_mask(dev) & ~(IO_TLB_SIZE - 1);
 	unsigned int nslots = nr_slots(alloc_size), stride;
-	unsigned int index, wrap, count = 0, i;
+	unsigned int index, wrap, i;
 	unsigned int offset = swiotlb_align_offset(dev, orig_addr);
 	unsigned long flags;
 	unsigned int slot_base;
@@ -626,15 +1071,7 @@ static int swiotlb_do_find_slots(struct device *dev, int area_index,
 	BUG_ON(!nslots);
 	BUG_ON(area_index >= mem->nareas);
 
-	/*
-	 * For mappings with an alignment requirement don't bother looping to
-	 * unaligned slots once we found an aligned one.  For allocations of
-	 * PAGE_SIZE or larger only look for page aligned allocations.
-	 */
-	stride = (iotlb_align_mask >> IO_TLB_SHIFT) + 1;
-	if (alloc_size >= PAGE_SIZE)
-		stride = max(stride, stride << (PAGE_SHIFT - IO_TLB_SHIFT));
-	stride = max(stride, (alloc_align_mask >> IO_TLB_SHIFT) + 1);
+	stride = swiotlb_stride(dev, alloc_size, alloc_align_mask);
 
 	spin_lock_irqsave(&area->lock, flags);
 	if (unlikely(nslots > mem->area_nslabs - area->used))
@@ -672,15 +1109,10 @@ static int swiotlb_do_find_slots(struct device *dev, int area_index,
 	return -1;
 
 found:
-	for (i = slot_index; i < slot_index + nslots; i++) {
-		mem->slots[i].list = 0;
+	swiotlb_take_slots(mem, slot_index, nslots);
+	for (i = slot_index; i < slot_index + nslots; i++)
 		mem->slots[i].alloc_size = alloc_size - (offset +
 				((i - slot_index) << IO_TLB_SHIFT));
-	}
-	for (i = slot_index - 1;
-	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 &&
-	     mem->slots[i].list; i--)
-		mem->slots[i].list = ++count;
 
 	/*
 	 * Update the indices to avoid searching in the next round.
@@ -694,25 +1126,346 @@ static int swiotlb_do_find_slots(struct device *dev, int area_index,
 	return slot_index;
 }
 
-static int swiotlb_find_slots(struct device *dev, phys_addr_t orig_addr,
+static inline unsigned int io_tlb_pcp_capacity(unsigned int order)
+{
+	return min(2 * IO_TLB_PCP_BATCH, IO_TLB_PCP_SLOTS >> order);
+}
+
+/*
+ * Take up to @count free runs of @nslots slots, aligned to their size, out
+ * of an area. Called with the area lock held.
+ */
+static unsigned int swiotlb_area_get_runs(struct io_tlb_mem *mem,
+		int area_index, unsigned int nslots, unsigned int *runs,
+		unsigned int count)
+{
+	struct io_tlb_area *area = mem->areas + area_index;
+	unsigned int slot_base = area_index * mem->area_nslabs;
+	unsigned int index, wrap, slot_index, n = 0;
+
+	if (nslots > mem->area_nslabs - area->used)
+		return 0;
+
+	index = wrap = wrap_area_index(mem, ALIGN(area->index, nslots));
+	do {
+		slot_index = slot_base + index;
+		if (mem->slots[slot_index].list >= nslots) {
+			swiotlb_take_slots(mem, slot_index, nslots);
+			area->used += nslots;
+			runs[n++] = slot_index;
+			if (n == count ||
+			    nslots > mem->area_nslabs - area->used)
+				break;
+		}
+		index = wrap_area_index(mem, index + nslots);
+	} while (index != wrap);
+
+	area->index = wrap_area_index(mem, index + nslots);
+	return n;
+}
+
+static void swiotlb_area_put_run(struct io_tlb_mem *mem, unsigned int index,
+		unsigned int nslots)
+{
+	struct io_tlb_area *area = &mem->areas[index / mem->area_nslabs];
+
+	spin_lock(&area->lock);
+	swiotlb_put_slots(mem, index, nslots);
+	area->used -= nslots;
+	spin_unlock(&area->lock);
+}
+
+/*
+ * Return the @count oldest runs of @order in the cache to their areas.
+ * Called with the cache lock held and interrupts disabled.
+ */
+static void swiotlb_pcp_flush(struct io_tlb_mem *mem, struct io_tlb_pcp *pcp,
+		unsigned int order, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		swiotlb_area_put_run(mem, pcp->index[order][i], 1U << order);
+
+	pcp->nr[order] -= count;
+	memmove(pcp->index[order], pcp->index[order] + count,
+		pcp->nr[order] * sizeof(pcp->index[order][0]));
+	pcp->flushes++;
+}
+
+/*
+ * Return all cached runs to the areas, when an allocation failed without
+ * them. Returns %true if anything was returned.
+ */
+static bool swiotlb_pcp_drain(struct io_tlb_mem *mem)
+{
+	struct io_tlb_pcp *pcp;
+	unsigned long flags;
+	bool drained = false;
+	unsigned int order;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pcp = per_cpu_ptr(mem->pcp, cpu);
+		spin_lock_irqsave(&pcp->lock, flags);
+		for (order = 0; order < IO_TLB_PCP_ORDERS; order++) {
+			if (!pcp->nr[order])
+				continue;
+			swiotlb_pcp_flush(mem, pcp, order, pcp->nr[order]);
+			drained = true;
+		}
+		spin_unlock_irqrestore(&pcp->lock, flags);
+	}
+	return drained;
+}
+
+/*
+ * Check that the cached run at @index satisfies the constraints that
+ * swiotlb_do_find_slots() applies while searching.
+ */
+static bool swiotlb_pcp_fits(struct device *dev, unsigned int index,
+		unsigned int nslots, phys_addr_t orig_addr, size_t alloc_size,
+		unsigned int alloc_align_mask)
+{
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	unsigned long boundary_mask = dma_get_seg_boundary(dev);
+	dma_addr_t tbl_dma_addr =
+		phys_to_dma_unencrypted(dev, mem->start) & boundary_mask;
+	unsigned int iotlb_align_mask =
+		dma_get_min_align_mask(dev) & ~(IO_TLB_SIZE - 1);
+
+	if (orig_addr &&
+	    (slot_addr(tbl_dma_addr, index) & iotlb_align_mask) !=
+	    (orig_addr & iotlb_align_mask))
+		return false;
+
+	if (!IS_ALIGNED(index, swiotlb_stride(dev, alloc_size,
+					      alloc_align_mask)))
+		return false;
+
+	return !iommu_is_span_boundary(index, nslots, nr_slots(tbl_dma_addr),
+				       get_max_slots(boundary_mask));
+}
+
+/*
+ * Serve an allocation of a power of two number of slots from the local
+ * cache, refilling it from the local area if it is empty. Returns the index
+ * of the first slot, or -1 if the allocation has to take the slow path.
+ */
+static int swiotlb_pcp_get(struct device *dev, phys_addr_t orig_addr,
 		size_t alloc_size, unsigned int alloc_align_mask)
 {
 	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
-	int start = raw_smp_processor_id() & (mem->nareas - 1);
+	struct io_tlb_pcp __percpu *cache = READ_ONCE(mem->pcp);
+	unsigned int offset = swiotlb_align_offset(dev, orig_addr);
+	unsigned int nslots = nr_slots(alloc_size), order, i;
+	struct io_tlb_area *area;
+	struct io_tlb_pcp *pcp;
+	unsigned long flags;
+	int index = -1;
+
+	if (!cache || !is_power_of_2(nslots))
+		return -1;
+	order = ilog2(nslots);
+	if (order >= IO_TLB_PCP_ORDERS)
+		return -1;
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(cache);
+	spin_lock(&pcp->lock);
+	if (!pcp->nr[order]) {
+		i = smp_processor_id() & (mem->nareas - 1);
+		area = mem->areas + i;
+
+		spin_lock(&area->lock);
+		pcp->nr[order] = swiotlb_area_get_runs(mem, i, nslots,
+				pcp->index[order],
+				max(io_tlb_pcp_capacity(order) / 2, 1U));
+		spin_unlock(&area->lock);
+		if (pcp->nr[order])
+			pcp->refills++;
+	}
+	if (pcp->nr[order] &&
+	    swiotlb_pcp_fits(dev, pcp->index[order][pcp->nr[order] - 1],
+			     nslots, orig_addr, alloc_size, alloc_align_mask)) {
+		index = pcp->index[order][--pcp->nr[order]];
+		pcp->hits++;
+	}
+	spin_unlock(&pcp->lock);
+	local_irq_restore(flags);
+
+	if (index < 0)
+		return -1;
+
+	for (i = index; i < index + nslots; i++)
+		mem->slots[i].alloc_size = alloc_size - (offset +
+				((i - index) << IO_TLB_SHIFT));
+	return index;
+}
+
+/*
+ * Park a released run in the local cache, if it has a cacheable size and
+ * alignment. Returns %false if the run has to go back to its area.
+ */
+static bool swiotlb_pcp_put(struct io_tlb_mem *mem, unsigned int index,
+		unsigned int nslots)
+{
+	struct io_tlb_pcp __percpu *cache = READ_ONCE(mem->pcp);
+	unsigned int order, i;
+	struct io_tlb_pcp *pcp;
+	unsigned long flags;
+
+	if (!cache || !is_power_of_2(nslots) || !IS_ALIGNED(index, nslots))
+		return false;
+	order = ilog2(nslots);
+	if (order >= IO_TLB_PCP_ORDERS)
+		return false;
+
+	for (i = index; i < index + nslots; i++) {
+		mem->slots[i].orig_addr = INVALID_PHYS_ADDR;
+		mem->slots[i].alloc_size = 0;
+	}
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(cache);
+	spin_lock(&pcp->lock);
+	if (pcp->nr[order] >= io_tlb_pcp_capacity(order))
+		swiotlb_pcp_flush(mem, pcp, order,
+				  max(io_tlb_pcp_capacity(order) / 2, 1U));
+	pcp->index[order][pcp->nr[order]++] = index;
+	spin_unlock(&pcp->lock);
+	local_irq_restore(flags);
+
+	return true;
+}
+
+static unsigned long mem_cached(struct io_tlb_mem *mem)
+{
+	unsigned long cached = 0;
+	unsigned int order;
+	int cpu;
+
+	if (!mem->pcp)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		for (order = 0; order < IO_TLB_PCP_ORDERS; order++)
+			cached += (unsigned long)READ_ONCE(
+				per_cpu_ptr(mem->pcp, cpu)->nr[order]) << order;
+	return cached;
+}
+
+/*
+ * Search the areas of @pool, starting with the one of the current CPU. Having
+ * to go elsewhere means the pool is getting tight, which is the hint to add
+ * another one.
+ */
+static int swiotlb_pool_find_slots(struct device *dev, struct io_tlb_mem *pool,
+		phys_addr_t orig_addr, size_t alloc_size,
+		unsigned int alloc_align_mask)
+{
+	int start = raw_smp_processor_id() & (pool->nareas - 1);
 	int i = start, index;
 
 	do {
-		index = swiotlb_do_find_slots(dev, i, orig_addr, alloc_size,
-					      alloc_align_mask);
-		if (index >= 0)
+		index = swiotlb_do_find_slots(dev, pool, i, orig_addr,
+					      alloc_size, alloc_align_mask);
+		if (index >= 0) {
+			if (i != start)
+				swiotlb_dyn_kick(dev->dma_io_tlb_mem);
 			return index;
-		if (++i >= mem->nareas)
+		}
+		if (++i >= pool->nareas)
 			i = 0;
 	} while (i != start);
 
 	return -1;
 }
 
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+static int swiotlb_dyn_find_slots(struct device *dev, phys_addr_t orig_addr,
+		size_t alloc_size, unsigned int alloc_align_mask,
+		struct io_tlb_mem **retpool)
+{
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem, *pool;
+	int index = -1;
+
+	if (!READ_ONCE(mem->dyn))
+		return -1;
+
+	/*
+	 * The reclaim makes a pool unallocatable before unlinking it, so a
+	 * pool found here stays around as long as we have slots in it.
+	 */
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &mem->pools, node) {
+		index = swiotlb_pool_find_slots(dev, pool, orig_addr,
+						alloc_size, alloc_align_mask);
+		if (index >= 0) {
+			*retpool = pool;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return index;
+}
+#else
+static inline int swiotlb_dyn_find_slots(struct device *dev,
+		phys_addr_t orig_addr, size_t alloc_size,
+		unsigned int alloc_align_mask, struct io_tlb_mem **retpool)
+{
+	return -1;
+}
+#endif /* CONFIG_SWIOTLB_DYNAMIC */
+
+/*
+ * Allocate slots for a mapping and return their index in the pool stored in
+ * @retpool, which is the device's pool unless it had to go to one of the
+ * dynamically added pools.
+ */
+static int swiotlb_find_slots(struct device *dev, phys_addr_t orig_addr,
+		size_t alloc_size, unsigned int alloc_align_mask,
+		struct io_tlb_mem **retpool)
+{
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	bool drained = false;
+	int index;
+
+	*retpool = mem;
+	index = swiotlb_pcp_get(dev, orig_addr, alloc_size, alloc_align_mask);
+	if (index >= 0)
+		return index;
+
+retry:
+	index = swiotlb_pool_find_slots(dev, mem, orig_addr, alloc_size,
+					alloc_align_mask);
+	if (index >= 0)
+		return index;
+
+	index = swiotlb_dyn_find_slots(dev, orig_addr, alloc_size,
+				       alloc_align_mask, retpool);
+	if (index >= 0)
+		return index;
+
+	/*
+	 * The free slots may all be sitting in the per-CPU caches. Drain them
+	 * once only; other CPUs keep refilling their caches, so looping until
+	 * nothing is drained could go on forever.
+	 */
+	if (!drained && mem->pcp && swiotlb_pcp_drain(mem)) {
+		drained = true;
+		goto retry;
+	}
+
+	swiotlb_dyn_kick(mem);
+	return -1;
+}
+
+/*
+ * Slots in use by mappings; the slots sitting in the per-CPU caches are
+ * free even though their areas account them as used.
+ */
 static unsigned long mem_used(struct io_tlb_mem *mem)
 {
 	int i;
@@ -720,7 +1473,7 @@ static unsigned long mem_used(struct io_tlb_mem *mem)
 
 	for (i = 0; i < mem->nareas; i++)
 		used += mem->areas[i].used;
-	return used;
+	return used - min(used, mem_cached(mem));
 }
 
 phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
@@ -728,7 +1481,7 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 		unsigned int alloc_align_mask, enum dma_data_direction dir,
 		unsigned long attrs)
 {
-	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem, *pool;
 	unsigned int offset = swiotlb_align_offset(dev, orig_addr);
 	unsigned int i;
 	int index;
@@ -750,7 +1503,7 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 	}
 
 	index = swiotlb_find_slots(dev, orig_addr,
-				   alloc_size + offset, alloc_align_mask);
+				   alloc_size + offset, alloc_align_mask, &pool);
 	if (index == -1) {
 		if (!(attrs & DMA_ATTR_NO_WARN))
 			dev_warn_ratelimited(dev,
@@ -765,8 +1518,8 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 	 * needed.
 	 */
 	for (i = 0; i < nr_slots(alloc_size + offset); i++)
-		mem->slots[index + i].orig_addr = slot_addr(orig_addr, i);
-	tlb_addr = slot_addr(mem->start, index) + offset;
+		pool->slots[index + i].orig_addr = slot_addr(orig_addr, i);
+	tlb_addr = slot_addr(pool->start, index) + offset;
 	/*
 	 * When dir == DMA_FROM_DEVICE we could omit the copy from the orig
 	 * to the tlb buffer, if we knew for sure the device will
@@ -780,47 +1533,21 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 
 static void swiotlb_release_slots(struct device *dev, phys_addr_t tlb_addr)
 {
-	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	struct io_tlb_mem *mem = swiotlb_find_pool(dev, tlb_addr);
 	unsigned long flags;
 	unsigned int offset = swiotlb_align_offset(dev, tlb_addr);
 	int index = (tlb_addr - offset - mem->start) >> IO_TLB_SHIFT;
 	int nslots = nr_slots(mem->slots[index].alloc_size + offset);
 	int aindex = index / mem->area_nslabs;
 	struct io_tlb_area *area = &mem->areas[aindex];
-	int count, i;
 
-	/*
-	 * Return the buffer to the free list by setting the corresponding
-	 * entries to indicate the number of contiguous entries available.
-	 * While returning the entries to the free list, we merge the entries
-	 * with slots below and above the pool being returned.
-	 */
 	BUG_ON(aindex >= mem->nareas);
 
-	spin_lock_irqsave(&area->lock, flags);
-	if (index + nslots < ALIGN(index + 1, IO_TLB_SEGSIZE))
-		count = mem->slots[index + nslots].list;
-	else
-		count = 0;
-
-	/*
-	 * Step 1: return the slots to the free list, merging the slots with
-	 * superceeding slots
-	 */
-	for (i = index + nslots - 1; i >= index; i--) {
-		mem->slots[i].list = ++count;
-		mem->slots[i].orig_addr = INVALID_PHYS_ADDR;
-		mem->slots[i].alloc_size = 0;
-	}
+	if (swiotlb_pcp_put(mem, index, nslots))
+		return;
 
-	/*
-	 * Step 2: merge the returned slots with the preceding slots, if
-	 * available (non zero)
-	 */
-	for (i = index - 1;
-	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 && mem->slots[i].list;
-	     i--)
-		mem->slots[i].list = ++count;
+	spin_lock_irqsave(&area->lock, flags);
+	swiotlb_put_slots(mem, index, nslots);
 	area->used -= nslots;
 	spin_unlock_irqrestore(&area->lock, flags);
 }
@@ -924,6 +1651,56 @@ static int io_tlb_used_get(void *data, u64 *val)
 }
 DEFINE_DEBUGFS_ATTRIBUTE(fops_io_tlb_used, io_tlb_used_get, NULL, "%llu\n");
 
+static int io_tlb_areas_show(struct seq_file *m, void *v)
+{
+	struct io_tlb_mem *mem = m->private;
+	unsigned int i;
+
+	for (i = 0; i < mem->nareas; i++)
+		seq_printf(m, "%u: used %lu index %u\n", i,
+			   READ_ONCE(mem->areas[i].used),
+			   READ_ONCE(mem->areas[i].index));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(io_tlb_areas);
+
+static int io_tlb_pcp_show(struct seq_file *m, void *v)
+{
+	struct io_tlb_mem *mem = m->private;
+	struct io_tlb_pcp *pcp;
+	unsigned long cached;
+	unsigned int order;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pcp = per_cpu_ptr(mem->pcp, cpu);
+		cached = 0;
+		for (order = 0; order < IO_TLB_PCP_ORDERS; order++)
+			cached += (unsigned long)READ_ONCE(pcp->nr[order]) << order;
+		seq_printf(m, "%d: cached %lu hits %lu refills %lu flushes %lu\n",
+			   cpu, cached, READ_ONCE(pcp->hits),
+			   READ_ONCE(pcp->refills), READ_ONCE(pcp->flushes));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(io_tlb_pcp);
+
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+static int io_tlb_pools_show(struct seq_file *m, void *v)
+{
+	struct io_tlb_mem *mem = m->private, *pool;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &mem->pools, node)
+		seq_printf(m, "%pa: nslabs %lu used %lu%s\n", &pool->start,
+			   pool->nslabs, mem_used(pool),
+			   READ_ONCE(pool->idle) ? " idle" : "");
+	rcu_read_unlock();
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(io_tlb_pools);
+#endif
+
 static void swiotlb_create_debugfs_files(struct io_tlb_mem *mem,
 					 const char *dirname)
 {
@@ -934,6 +1711,16 @@ static void swiotlb_create_debugfs_files(struct io_tlb_mem *mem,
 	debugfs_create_ulong("io_tlb_nslabs", 0400, mem->debugfs, &mem->nslabs);
 	debugfs_create_file("io_tlb_used", 0400, mem->debugfs, NULL,
 			&fops_io_tlb_used);
+	debugfs_create_file("io_tlb_areas", 0400, mem->debugfs, mem,
+			&io_tlb_areas_fops);
+	if (mem->pcp)
+		debugfs_create_file("io_tlb_pcp", 0400, mem->debugfs, mem,
+				&io_tlb_pcp_fops);
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+	if (mem->dyn)
+		debugfs_create_file("io_tlb_pools", 0400, mem->debugfs, mem,
+				&io_tlb_pools_fops);
+#endif
 }
 
 static int __init __maybe_unused swiotlb_create_default_debugfs(void)
@@ -950,18 +1737,18 @@ late_initcall(swiotlb_create_default_debugfs);
 
 struct page *swiotlb_alloc(struct device *dev, size_t size)
 {
-	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem, *pool;
 	phys_addr_t tlb_addr;
 	int index;
 
 	if (!mem)
 		return NULL;
 
-	index = swiotlb_find_slots(dev, 0, size, 0);
+	index = swiotlb_find_slots(dev, 0, size, 0, &pool);
 	if (index == -1)
 		return NULL;
 
-	tlb_addr = slot_addr(mem->start, index);
+	tlb_addr = slot_addr(pool->start, index);
 
 	return pfn_to_page(PFN_DOWN(tlb_addr));
 }
@@ -17,6 +17,7 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/tick.h>
 #include <linux/sysfs.h>
 #include <linux/dcache.h>
@@ -2426,6 +2427,10 @@ static void perf_remove_from_context(struct perf_event *event, unsigned long fla
 /*
  * Cross CPU call to disable a performance event
  */
+static void perf_aggr_flush(struct perf_event *event);
+static void perf_aggr_free(struct perf_event *event);
+static void perf_aggr_enable(struct perf_event *event);
+
 static void __perf_event_disable(struct perf_event *event,
 				 struct perf_cpu_context *cpuctx,
 				 struct perf_event_context *ctx,
@@ -2434,6 +2439,9 @@ static void __perf_event_disable(struct perf_event *event,
 	if (event->state < PERF_EVENT_STATE_INACTIVE)
 		return;
 
+	/* Don't keep aggregated samples back from the reader. */
+	perf_aggr_flush(event);
+
 	if (ctx->is_active & EVENT_TIME) {
 		update_context_time(ctx);
 		update_cgrp_time_from_event(event);
@@ -2947,6 +2955,7 @@ static void __perf_event_enable(struct perf_event *event,
 	if (ctx->is_active)
 		ctx_sched_out(ctx, cpuctx, EVENT_TIME);
 
+	perf_aggr_enable(event);
 	perf_event_set_state(event, PERF_EVENT_STATE_INACTIVE);
 	perf_cgroup_event_enable(event, ctx);
 
@@ -4980,6 +4989,16 @@ static void _free_event(struct perf_event *event)
 {
 	irq_work_sync(&event->pending_irq);
 
+	/*
+	 * Emit what is still aggregated while the buffer, or the parent's for
+	 * inherited events, is still there to take it.
+	 */
+	if (event->aggr_table) {
+		preempt_disable();
+		perf_aggr_flush(event);
+		preempt_enable();
+	}
+
 	unaccount_event(event);
 
 	security_perf_event_free(event);
@@ -5007,6 +5026,7 @@ static void _free_event(struct perf_event *event)
 	perf_event_free_bpf_prog(event);
 	perf_addr_filters_splice(event, NULL);
 	kfree(event->addr_filter_ranges);
+	perf_aggr_free(event);
 
 	if (event->destroy)
 		event->destroy(event);
@@ -5845,9 +5865,11 @@ static void perf_event_init_userpage(struct perf_event *event)
 
 	/* Allow new userspace to detect that bit 0 is deprecated */
 	userpg->cap_bit0_is_deprecated = 1;
-	userpg->size = offsetof(struct perf_event_mmap_page, __reserved);
+	userpg->size = offsetofend(struct perf_event_mmap_page,
+				   data_early_wakeups);
 	userpg->data_offset = PAGE_SIZE;
 	userpg->data_size = perf_data_size(rb);
+	userpg->data_watermark = rb->watermark;
 
 unlock:
 	rcu_read_unlock();
@@ -6361,6 +6383,9 @@ static int perf_mmap(struct file *file, struct vm_area_struct *vma)
 	if (vma->vm_flags & VM_WRITE)
 		flags |= RING_BUFFER_WRITABLE;
 
+	if (event->attr.adaptive_watermark)
+		flags |= RING_BUFFER_ADAPTIVE;
+
 	if (!rb) {
 		rb = rb_alloc(nr_pages,
 			      event->attr.watermark ? event->attr.wakeup_watermark : 0,
@@ -7566,6 +7591,203 @@ void perf_prepare_sample(struct perf_event_header *header,
 	WARN_ON_ONCE(header->size & 7);
 }
 
+/*
+ * In-kernel callchain aggregation for sample_aggregate events.
+ *
+ * Instead of emitting a PERF_RECORD_SAMPLE per overflow, the callchain of the
+ * sample is counted in a small open addressing hash table of the event, which
+ * is drained as PERF_RECORD_CALLCHAIN_COUNT records when it gets full, when
+ * the event is disabled and otherwise at least every PERF_AGGR_FLUSH_NS while
+ * samples keep coming in, counted from the time the event was enabled.
+ * Callchains deeper than PERF_AGGR_MAX_STACK are emitted as regular samples.
+ *
+ * The table is only ever touched from the CPU the event is active on, but
+ * an NMI can hit while it is drained; @busy makes such samples fall back to
+ * regular samples as well.
+ */
+#define PERF_AGGR_NR_ENTRIES	128
+#define PERF_AGGR_MAX_STACK	64
+#define PERF_AGGR_NR_PROBES	8
+#define PERF_AGGR_FLUSH_NS	NSEC_PER_SEC
+
+struct perf_aggr_entry {
+	u32				hash;
+	u32				pid;
+	u32				tid;
+	u64				count;
+	u64				nr;
+	u64				ips[PERF_AGGR_MAX_STACK];
+};
+
+struct perf_aggr_table {
+	atomic_t			busy;
+	unsigned int			nr_used;
+	u64				last_flush;
+	struct perf_aggr_entry		entries[PERF_AGGR_NR_ENTRIES];
+};
+
+static int perf_aggr_alloc(struct perf_event *event)
+{
+	if (!is_sampling_event(event) ||
+	    !(event->attr.sample_type & PERF_SAMPLE_CALLCHAIN))
+		return -EINVAL;
+
+	event->aggr_table = kvzalloc(sizeof(struct perf_aggr_table),
+				     GFP_KERNEL);
+	if (!event->aggr_table)
+		return -ENOMEM;
+
+	perf_aggr_enable(event);
+	return 0;
+}
+
+/* The event is not active yet, so nothing can sample into the table. */
+static void perf_aggr_enable(struct perf_event *event)
+{
+	if (event->aggr_table)
+		event->aggr_table->last_flush = perf_clock();
+}
+
+static void perf_aggr_free(struct perf_event *event)
+{
+	kvfree(event->aggr_table);
+	event->aggr_table = NULL;
+}
+
+static void perf_aggr_output(struct perf_event *event,
+			     struct perf_aggr_entry *entry)
+{
+	struct perf_output_handle handle;
+	struct perf_sample_data sample;
+	int ret;
+
+	struct {
+		struct perf_event_header	header;
+		u32				pid;
+		u32				tid;
+		u64				count;
+		u64				nr;
+	} count_event = {
+		.header = {
+			.type = PERF_RECORD_CALLCHAIN_COUNT,
+			.misc = 0,
+			.size = sizeof(count_event) + entry->nr * sizeof(u64),
+		},
+		.pid	= entry->pid,
+		.tid	= entry->tid,
+		.count	= entry->count,
+		.nr	= entry->nr,
+	};
+
+	perf_event_header__init_id(&count_event.header, &sample, event);
+
+	ret = perf_output_begin(&handle, &sample, event,
+				count_event.header.size);
+	if (ret)
+		return;
+
+	perf_output_put(&handle, count_event);
+	__output_copy(&handle, entry->ips, entry->nr * sizeof(u64));
+	perf_event__output_id_sample(event, &handle, &sample);
+	perf_output_end(&handle);
+}
+
+/* Must be called with @table->busy held. */
+static void __perf_aggr_flush(struct perf_event *event,
+			      struct perf_aggr_table *table)
+{
+	struct perf_aggr_entry *entry;
+	int i;
+
+	for (i = 0; i < PERF_AGGR_NR_ENTRIES && table->nr_used; i++) {
+		entry = &table->entries[i];
+		if (!entry->count)
+			continue;
+
+		perf_aggr_output(event, entry);
+		entry->count = 0;
+		table->nr_used--;
+	}
+	table->last_flush = perf_clock();
+}
+
+static void perf_aggr_flush(struct perf_event *event)
+{
+	struct perf_aggr_table *table = event->aggr_table;
+
+	if (!table || atomic_cmpxchg(&table->busy, 0, 1))
+		return;
+
+	__perf_aggr_flush(event, table);
+	atomic_set_release(&table->busy, 0);
+}
+
+/*
+ * Count the callchain of the prepared sample @data. Returns false if the
+ * sample has to be emitted as a regular sample.
+ */
+static bool perf_aggr_sample(struct perf_event *event,
+			     struct perf_sample_data *data)
+{
+	struct perf_callchain_entry *callchain = data->callchain;
+	struct perf_aggr_table *table = event->aggr_table;
+	struct perf_aggr_entry *entry;
+	u32 pid = 0, tid = 0;
+	u32 hash;
+	u64 nr;
+	int i;
+
+	if (!callchain || !callchain->nr ||
+	    callchain->nr > PERF_AGGR_MAX_STACK)
+		return false;
+	nr = callchain->nr;
+
+	if (atomic_cmpxchg(&table->busy, 0, 1))
+		return false;
+
+	if (event->attr.sample_type & PERF_SAMPLE_TID) {
+		pid = data->tid_entry.pid;
+		tid = data->tid_entry.tid;
+	}
+
+	hash = jhash2((u32 *)callchain->ip, nr * sizeof(u64) / sizeof(u32),
+		      jhash_2words(pid, tid, 0));
+
+	for (i = 0; i < PERF_AGGR_NR_PROBES; i++) {
+		entry = &table->entries[(hash + i) % PERF_AGGR_NR_ENTRIES];
+		if (!entry->count)
+			goto new_entry;
+
+		if (entry->hash == hash && entry->pid == pid &&
+		    entry->tid == tid && entry->nr == nr &&
+		    !memcmp(entry->ips, callchain->ip, nr * sizeof(u64))) {
+			entry->count++;
+			goto out;
+		}
+	}
+
+	/* No free slot left for this callchain, start over. */
+	__perf_aggr_flush(event, table);
+	entry = &table->entries[hash % PERF_AGGR_NR_ENTRIES];
+
+new_entry:
+	entry->hash = hash;
+	entry->pid = pid;
+	entry->tid = tid;
+	entry->count = 1;
+	entry->nr = nr;
+	memcpy(entry->ips, callchain->ip, nr * sizeof(u64));
+	table->nr_used++;
+
+out:
+	if (table->nr_used >= PERF_AGGR_NR_ENTRIES * 3 / 4 ||
+	    perf_clock() - table->last_flush >= PERF_AGGR_FLUSH_NS)
+		__perf_aggr_flush(event, table);
+
+	atomic_set_release(&table->busy, 0);
+	return true;
+}
+
 static __always_inline int
 __perf_event_output(struct perf_event *event,
 		    struct perf_sample_data *data,
@@ -7584,6 +7806,10 @@ __perf_event_output(struct perf_event *event,
 
 	perf_prepare_sample(&header, data, event, regs);
 
+	err = 0;
+	if (event->aggr_table && perf_aggr_sample(event, data))
+		goto exit;
+
 	err = output_begin(&handle, data, event, header.size);
 	if (err)
 		goto exit;
@@ -11831,15 +12057,23 @@ perf_event_alloc(struct perf_event_attr *attr, int cpu,
 		}
 	}
 
+	if (event->attr.sample_aggregate) {
+		err = perf_aggr_alloc(event);
+		if (err)
+			goto err_callchain_buffer;
+	}
+
 	err = security_perf_event_alloc(event);
 	if (err)
-		goto err_callchain_buffer;
+		goto err_aggr;
 
 	/* symmetric to unaccount_event() in _free_event() */
 	account_event(event);
 
 	return event;
 
+err_aggr:
+	perf_aggr_free(event);
 err_callchain_buffer:
 	if (!event->parent) {
 		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN)
@@ -11982,6 +12216,10 @@ static int perf_copy_attr(struct perf_event_attr __user *uattr,
 	if (attr->sigtrap && !attr->remove_on_exec)
 		return -EINVAL;
 
+	/* The adaptive watermark is tuned in bytes, not in events. */
+	if (attr->adaptive_watermark && !attr->watermark)
+		return -EINVAL;
+
 out:
 	return ret;
 
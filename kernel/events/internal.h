@@ -9,6 +9,7 @@
 /* Buffer handling */
 
 #define RING_BUFFER_WRITABLE		0x01
+#define RING_BUFFER_ADAPTIVE		0x02
 
 struct perf_buffer {
 	refcount_t			refcount;
@@ -31,6 +32,16 @@ struct perf_buffer {
 
 	long				watermark;	/* wakeup watermark  */
 	long				aux_watermark;
+
+	/* adaptive wakeup watermark */
+	int				adaptive;
+	long				watermark_min;
+	long				watermark_max;
+	u64				wakeup_stamp;	/* time of last watermark wakeup */
+	unsigned long			early_tail;	/* data_tail at last early wakeup */
+	local_t				nr_wakeups;
+	local_t				nr_early_wakeups;
+
 	/* poll crap */
 	spinlock_t			event_lock;
 	struct list_head		event_list;
@@ -14,6 +14,7 @@
 #include <linux/circ_buf.h>
 #include <linux/poll.h>
 #include <linux/nospec.h>
+#include <linux/sched/clock.h>
 
 #include "internal.h"
 
@@ -25,6 +26,83 @@ static void perf_output_wakeup(struct perf_output_handle *handle)
 	irq_work_queue(&handle->event->pending_irq);
 }
 
+static void perf_output_data_wakeup(struct perf_output_handle *handle)
+{
+	struct perf_buffer *rb = handle->rb;
+
+	perf_output_wakeup(handle);
+
+	local_inc(&rb->nr_wakeups);
+	WRITE_ONCE(rb->user_page->data_wakeups, local_read(&rb->nr_wakeups));
+	WRITE_ONCE(rb->user_page->data_early_wakeups,
+		   local_read(&rb->nr_early_wakeups));
+	WRITE_ONCE(rb->user_page->data_watermark, READ_ONCE(rb->watermark));
+}
+
+/*
+ * Adaptive wakeup watermark.
+ *
+ * Every time @rb->head crosses a watermark boundary we look at how long it
+ * took to produce the last watermark worth of data and at how much of the
+ * buffer the reader has not consumed yet.
+ *
+ * A reader that has not even consumed the data of the previous wakeup is
+ * slower than the current batch size allows for; wake it up earlier to leave
+ * it more room before the buffer overflows. A reader that keeps up but gets
+ * woken more often than every PERF_RB_WAKEUP_MIN_NS gets larger batches
+ * instead, while a trickle of data that takes longer than
+ * PERF_RB_WAKEUP_MAX_NS to fill a batch gets smaller ones to bound the
+ * latency. The watermark stays between an eighth of the one requested by the
+ * user (but at least a page) and half of the buffer.
+ *
+ * All of this runs from the output path, possibly in NMI context, and is
+ * racy against other writers of the same buffer. That is fine, a lost update
+ * only delays the adjustment.
+ */
+#define PERF_RB_WAKEUP_MIN_NS	(10 * NSEC_PER_MSEC)
+#define PERF_RB_WAKEUP_MAX_NS	(100 * NSEC_PER_MSEC)
+
+static void rb_set_watermark(struct perf_buffer *rb, long watermark)
+{
+	watermark = clamp(watermark, rb->watermark_min, rb->watermark_max);
+	WRITE_ONCE(rb->watermark, watermark);
+}
+
+static void rb_adapt_watermark(struct perf_buffer *rb, unsigned long head,
+			       unsigned long tail, long watermark)
+{
+	unsigned long backlog = rb->overwrite ? 0 : head - tail;
+	u64 now = local_clock();
+	u64 delta = now - rb->wakeup_stamp;
+
+	rb->wakeup_stamp = now;
+
+	if (backlog > 2 * watermark || delta > PERF_RB_WAKEUP_MAX_NS)
+		rb_set_watermark(rb, watermark / 2);
+	else if (delta < PERF_RB_WAKEUP_MIN_NS)
+		rb_set_watermark(rb, watermark * 2);
+}
+
+/*
+ * Wake the reader ahead of the watermark when the buffer is about to
+ * overflow, once per reader progress; waking it again before it moved
+ * @data_tail would not help.
+ */
+static bool rb_need_early_wakeup(struct perf_buffer *rb, unsigned long head,
+				 unsigned long tail)
+{
+	unsigned long size = perf_data_size(rb);
+
+	if (rb->overwrite || head - tail < size - (size >> 3))
+		return false;
+
+	if (tail == READ_ONCE(rb->early_tail))
+		return false;
+
+	WRITE_ONCE(rb->early_tail, tail);
+	return true;
+}
+
 /*
  * We need to ensure a later event_id doesn't publish a head when a former
  * event isn't done writing. However since we need to deal with NMIs we
@@ -128,7 +206,7 @@ static void perf_output_put_handle(struct perf_output_handle *handle)
 	}
 
 	if (handle->wakeup != local_read(&rb->wakeup))
-		perf_output_wakeup(handle);
+		perf_output_data_wakeup(handle);
 
 out:
 	preempt_enable();
@@ -154,6 +232,7 @@ __perf_output_begin(struct perf_output_handle *handle,
 	struct perf_buffer *rb;
 	unsigned long tail, offset, head;
 	int have_lost, page_shift;
+	long watermark;
 	struct {
 		struct perf_event_header header;
 		u64			 id;
@@ -229,8 +308,17 @@ __perf_output_begin(struct perf_output_handle *handle,
 	 * none of the data stores below can be lifted up by the compiler.
 	 */
 
-	if (unlikely(head - local_read(&rb->wakeup) > rb->watermark))
-		local_add(rb->watermark, &rb->wakeup);
+	watermark = READ_ONCE(rb->watermark);
+	if (unlikely(head - local_read(&rb->wakeup) > watermark)) {
+		local_add(watermark, &rb->wakeup);
+		if (rb->adaptive)
+			rb_adapt_watermark(rb, head, tail, watermark);
+	} else if (unlikely(rb->adaptive) &&
+		   rb_need_early_wakeup(rb, head, tail)) {
+		local_set(&rb->wakeup, head);
+		local_inc(&rb->nr_early_wakeups);
+		rb_set_watermark(rb, watermark / 2);
+	}
 
 	page_shift = PAGE_SHIFT + page_order(rb);
 
@@ -316,6 +404,19 @@ ring_buffer_init(struct perf_buffer *rb, long watermark, int flags)
 	if (!rb->watermark)
 		rb->watermark = max_size / 2;
 
+	if (flags & RING_BUFFER_ADAPTIVE) {
+		rb->adaptive = 1;
+		/*
+		 * Let a slow reader be woken up to 8 times as often as asked
+		 * for, but not more often than every page.
+		 */
+		rb->watermark_min = max_t(long, rb->watermark >> 3, PAGE_SIZE);
+		rb->watermark_min = min(rb->watermark, rb->watermark_min);
+		rb->watermark_max = max(rb->watermark, max_size / 2);
+		rb->wakeup_stamp = local_clock();
+		rb->early_tail = ~0UL;
+	}
+
 	if (flags & RING_BUFFER_WRITABLE)
 		rb->overwrite = 0;
 	else
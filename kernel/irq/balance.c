@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * In-kernel balancing of unmanaged interrupts.
+ *
+ * Managed interrupts are spread once at allocation time and stay where
+ * they are. Everything else ends up where the irqchip put it at activation,
+ * which on a lot of systems is the first CPU of the default affinity, and
+ * relies on user space to spread it. This balancer periodically samples the
+ * interrupt counts, attributes the rate of every interrupt to the CPU it is
+ * effectively routed to and moves one interrupt per period from the most
+ * loaded CPU to the least loaded one when the former is saturated.
+ *
+ * Hysteresis comes from three places: the busiest CPU has to exceed the
+ * average by irq_balance.hysteresis percent, a move has to strictly reduce
+ * the imbalance between the two CPUs, and an interrupt is not moved again
+ * for irq_balance.cooldown_ms.
+ *
+ * Interrupts whose affinity was narrowed to a single CPU by somebody else
+ * are left alone. The decisions are recorded in debugfs, in
+ * irq_balance/trace.
+ */
+#define pr_fmt(fmt) "irq_balance: " fmt
+
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "internals.h"
+
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "irq_balance."
+
+/* Sampling period in milliseconds, 0 disables the balancer */
+static unsigned int interval_ms;
+/* Interrupts per second above which a CPU is considered saturated */
+static unsigned int threshold = 10000;
+/* Tolerated excess of the busiest CPU over the average, in percent */
+static unsigned int hysteresis = 25;
+/* Minimum time between two moves of the same interrupt */
+static unsigned int cooldown_ms = 10000;
+
+module_param(threshold, uint, 0644);
+module_param(hysteresis, uint, 0644);
+module_param(cooldown_ms, uint, 0644);
+
+#define IRQ_BALANCE_TRACE_SIZE	64
+
+struct irq_balance_event {
+	unsigned long	time;
+	unsigned int	irq;
+	unsigned int	from;
+	unsigned int	to;
+	unsigned long	rate;
+	unsigned long	from_load;
+	unsigned long	to_load;
+	int		err;
+};
+
+static DEFINE_MUTEX(irq_balance_mutex);
+static struct irq_balance_event irq_balance_trace[IRQ_BALANCE_TRACE_SIZE];
+static unsigned int irq_balance_trace_head;
+static unsigned long *irq_balance_load;
+static unsigned long irq_balance_last;
+static bool irq_balance_primed;
+
+static void irq_balance_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(irq_balance_work, irq_balance_fn);
+
+static void irq_balance_record(unsigned int irq, unsigned int from,
+			       unsigned int to, unsigned long rate, int err)
+{
+	struct irq_balance_event *ev;
+
+	ev = &irq_balance_trace[irq_balance_trace_head++ % IRQ_BALANCE_TRACE_SIZE];
+	ev->time = jiffies;
+	ev->irq = irq;
+	ev->from = from;
+	ev->to = to;
+	ev->rate = rate;
+	ev->from_load = irq_balance_load[from];
+	ev->to_load = irq_balance_load[to];
+	ev->err = err;
+}
+
+static bool irq_balance_eligible(struct irq_desc *desc)
+{
+	struct irq_data *d = &desc->irq_data;
+	const struct cpumask *mask;
+
+	if (!desc->action || !irqd_can_balance(d) ||
+	    irq_settings_is_per_cpu_devid(desc) ||
+	    !irq_can_set_affinity_usr(irq_desc_get_irq(desc)))
+		return false;
+
+	/* Leave interrupts pinned to a single CPU by others alone */
+	mask = irq_data_get_affinity_mask(d);
+	return cpumask_weight(mask) > 1 ||
+	       cpumask_first(mask) + 1 == desc->balance_target;
+}
+
+static unsigned int irq_balance_cpu(struct irq_desc *desc)
+{
+	const struct cpumask *mask;
+
+	mask = irq_data_get_effective_affinity_mask(&desc->irq_data);
+	if (cpumask_empty(mask))
+		mask = irq_data_get_affinity_mask(&desc->irq_data);
+	return cpumask_first(mask);
+}
+
+/*
+ * Sample the interrupt counts and attribute their rates to the CPUs.
+ * Returns the busiest CPU or nr_cpu_ids if there is nothing to balance.
+ */
+static unsigned int irq_balance_sample(unsigned long elapsed,
+				       unsigned int *coolest)
+{
+	unsigned long total = 0, max = 0, min = ULONG_MAX;
+	unsigned int cpu, busiest = nr_cpu_ids, nr = 0;
+	int irq;
+
+	memset(irq_balance_load, 0, nr_cpu_ids * sizeof(*irq_balance_load));
+
+	for_each_active_irq(irq) {
+		struct irq_desc *desc = irq_to_desc(irq);
+		unsigned int count;
+
+		if (!desc)
+			continue;
+
+		count = READ_ONCE(desc->tot_count);
+		desc->balance_rate = (unsigned long)(count - desc->balance_count) *
+				     HZ / elapsed;
+		desc->balance_count = count;
+
+		if (irqd_is_per_cpu(&desc->irq_data))
+			continue;
+
+		cpu = irq_balance_cpu(desc);
+		if (cpu < nr_cpu_ids)
+			irq_balance_load[cpu] += desc->balance_rate;
+	}
+
+	for_each_cpu_and(cpu, cpu_online_mask, irq_default_affinity) {
+		unsigned long load = irq_balance_load[cpu];
+
+		total += load;
+		nr++;
+		if (load > max || busiest == nr_cpu_ids) {
+			max = load;
+			busiest = cpu;
+		}
+		if (load < min) {
+			min = load;
+			*coolest = cpu;
+		}
+	}
+
+	if (nr < 2 || max < threshold)
+		return nr_cpu_ids;
+
+	/* Not saturated enough compared to the average */
+	if (max * 100 <= total / nr * (100 + hysteresis))
+		return nr_cpu_ids;
+
+	return busiest;
+}
+
+/*
+ * Pick the busiest interrupt on @from whose move to @to strictly reduces
+ * the imbalance between the two CPUs.
+ */
+static struct irq_desc *irq_balance_pick(unsigned int from, unsigned int to)
+{
+	unsigned long gap = irq_balance_load[from] - irq_balance_load[to];
+	unsigned long cooldown = msecs_to_jiffies(cooldown_ms);
+	struct irq_desc *best = NULL;
+	int irq;
+
+	for_each_active_irq(irq) {
+		struct irq_desc *desc = irq_to_desc(irq);
+
+		if (!desc || !desc->balance_rate || irq_balance_cpu(desc) != from)
+			continue;
+
+		/* Moving it over would just flip the imbalance */
+		if (2 * desc->balance_rate >= gap)
+			continue;
+
+		if (desc->balance_moved &&
+		    time_before(jiffies, desc->balance_moved + cooldown))
+			continue;
+
+		if (!irq_balance_eligible(desc))
+			continue;
+
+		if (!best || desc->balance_rate > best->balance_rate)
+			best = desc;
+	}
+	return best;
+}
+
+static void irq_balance_fn(struct work_struct *work)
+{
+	unsigned long now = jiffies, elapsed = now - irq_balance_last;
+	unsigned int from, to = nr_cpu_ids;
+	struct irq_desc *desc;
+	int err;
+
+	if (!READ_ONCE(interval_ms))
+		return;
+
+	mutex_lock(&irq_balance_mutex);
+	irq_lock_sparse();
+
+	irq_balance_last = now;
+	from = irq_balance_sample(max(elapsed, 1UL), &to);
+
+	/* The counts of the first period go back to before the enabling */
+	if (!irq_balance_primed) {
+		irq_balance_primed = true;
+		goto out;
+	}
+
+	if (from >= nr_cpu_ids || to >= nr_cpu_ids || from == to)
+		goto out;
+
+	desc = irq_balance_pick(from, to);
+	if (!desc)
+		goto out;
+
+	err = irq_set_affinity(irq_desc_get_irq(desc), cpumask_of(to));
+	if (!err) {
+		desc->balance_target = to + 1;
+		desc->balance_moved = now;
+	}
+	irq_balance_record(irq_desc_get_irq(desc), from, to,
+			   desc->balance_rate, err);
+out:
+	irq_unlock_sparse();
+	mutex_unlock(&irq_balance_mutex);
+
+	queue_delayed_work(system_unbound_wq, &irq_balance_work,
+			   msecs_to_jiffies(READ_ONCE(interval_ms)));
+}
+
+static int irq_balance_set_interval(const char *val,
+				    const struct kernel_param *kp)
+{
+	unsigned int old = interval_ms;
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (ret || !irq_balance_load)
+		return ret;
+
+	/* The work requeues itself while enabled, only kick it when enabling */
+	if (!old && interval_ms) {
+		mutex_lock(&irq_balance_mutex);
+		irq_balance_primed = false;
+		irq_balance_last = jiffies;
+		mutex_unlock(&irq_balance_mutex);
+		queue_delayed_work(system_unbound_wq, &irq_balance_work,
+				   msecs_to_jiffies(interval_ms));
+	}
+	return 0;
+}
+
+static const struct kernel_param_ops irq_balance_interval_ops = {
+	.set = irq_balance_set_interval,
+	.get = param_get_uint,
+};
+module_param_cb(interval_ms, &irq_balance_interval_ops, &interval_ms, 0644);
+
+static int irq_balance_trace_show(struct seq_file *m, void *p)
+{
+	unsigned int i, start = 0;
+
+	mutex_lock(&irq_balance_mutex);
+	if (irq_balance_trace_head > IRQ_BALANCE_TRACE_SIZE)
+		start = irq_balance_trace_head - IRQ_BALANCE_TRACE_SIZE;
+
+	for (i = start; i < irq_balance_trace_head; i++) {
+		struct irq_balance_event *ev;
+
+		ev = &irq_balance_trace[i % IRQ_BALANCE_TRACE_SIZE];
+		seq_printf(m, "%lu: irq %u cpu %u -> %u rate %lu/s load %lu -> %lu/s",
+			   ev->time, ev->irq, ev->from, ev->to, ev->rate,
+			   ev->from_load, ev->to_load);
+		if (ev->err)
+			seq_printf(m, " failed %d", ev->err);
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&irq_balance_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(irq_balance_trace);
+
+static int __init irq_balance_init(void)
+{
+	struct dentry *dir;
+
+	irq_balance_load = kcalloc(nr_cpu_ids, sizeof(*irq_balance_load),
+				   GFP_KERNEL);
+	if (!irq_balance_load)
+		return -ENOMEM;
+
+	dir = debugfs_create_dir("irq_balance", NULL);
+	debugfs_create_file("trace", 0400, dir, NULL, &irq_balance_trace_fops);
+
+	/* Enabled on the command line */
+	if (interval_ms) {
+		irq_balance_last = jiffies;
+		queue_delayed_work(system_unbound_wq, &irq_balance_work,
+				   msecs_to_jiffies(interval_ms));
+	}
+	return 0;
+}
+late_initcall(irq_balance_init);
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Adaptive interrupt moderation driven by the irq timings.
+ *
+ * Devices without hardware interrupt coalescing raise one interrupt per
+ * event, which at high event rates keeps a CPU busy with interrupt entry
+ * and exit alone. Drivers of such devices can hand their interrupt to this
+ * helper. As long as the rate is low, the driver handler runs in hard
+ * interrupt context as usual. When the interval predicted by the irq
+ * timings drops below the one matching irq_moderation::enter_rate, the
+ * interrupt is disabled and the irq thread polls the device every
+ * irq_moderation::poll_us instead. Once the polled event rate falls below
+ * irq_moderation::exit_rate, the interrupt is enabled again.
+ *
+ * Edge triggered interrupts arriving while polling are latched by the core
+ * and resent on enable, level triggered ones fire again, so no event gets
+ * lost on the switch back.
+ */
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/sched/clock.h>
+
+#include "internals.h"
+
+#define IRQ_MODERATION_POLL_US		1000
+
+/*
+ * Querying the irq timings flushes the per CPU timings buffer and scans for
+ * a pattern, which is too expensive to do for every interrupt at the rates
+ * we care about. Only ask every IRQ_MODERATION_SAMPLE interrupts; this
+ * delays the switch to polling by at most as many interrupts. Staying below
+ * IRQ_TIMINGS_SIZE keeps the timings of the interrupts in between from being
+ * overwritten before they are accounted.
+ */
+#define IRQ_MODERATION_SAMPLE		16
+static_assert(IRQ_MODERATION_SAMPLE <= IRQ_TIMINGS_SIZE);
+
+static irqreturn_t irq_moderation_hardirq(int irq, void *dev_id)
+{
+	struct irq_moderation *mod = dev_id;
+	u64 interval;
+
+	if (++mod->nr_irqs % IRQ_MODERATION_SAMPLE)
+		return mod->handler(irq, mod->dev_id);
+
+	interval = irq_timings_next_interval(irq, local_clock());
+	if (interval < NSEC_PER_SEC / mod->enter_rate &&
+	    !READ_ONCE(mod->stopping)) {
+		disable_irq_nosync(irq);
+		WRITE_ONCE(mod->polling, true);
+		mod->nr_polling++;
+		return IRQ_WAKE_THREAD;
+	}
+
+	return mod->handler(irq, mod->dev_id);
+}
+
+static irqreturn_t irq_moderation_thread(int irq, void *dev_id)
+{
+	struct irq_moderation *mod = dev_id;
+	unsigned long min_events;
+	unsigned int events;
+
+	/* Number of events per poll period below which polling stops */
+	min_events = DIV_ROUND_UP((unsigned long)mod->exit_rate * mod->poll_us,
+				  USEC_PER_SEC);
+
+	do {
+		events = mod->poll(mod->dev_id);
+		if (events < min_events || READ_ONCE(mod->stopping))
+			break;
+		usleep_range(mod->poll_us, mod->poll_us + mod->poll_us / 4);
+	} while (true);
+
+	WRITE_ONCE(mod->polling, false);
+	enable_irq(irq);
+
+	return IRQ_HANDLED;
+}
+
+/**
+ * irq_moderation_request - Request an interrupt with adaptive moderation
+ * @mod:	moderation descriptor, @handler, @poll and @dev_id filled in
+ * @irq:	interrupt line to request
+ * @flags:	interrupt flags, IRQF_SHARED is not supported
+ * @name:	name of the device generating the interrupt
+ *
+ * @mod->handler is called in hard interrupt context for every interrupt
+ * while the rate is low. @mod->poll is called from the irq thread while
+ * the rate is high and returns the number of events it handled. Rates of
+ * zero select the defaults: polling starts above @mod->enter_rate
+ * interrupts per second, 10000 by default, and stops below
+ * @mod->exit_rate events per second, half of the enter rate by default.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int irq_moderation_request(struct irq_moderation *mod, unsigned int irq,
+			   unsigned long flags, const char *name)
+{
+	int ret;
+
+	if (!mod->handler || !mod->poll || (flags & IRQF_SHARED))
+		return -EINVAL;
+
+	if (!mod->enter_rate)
+		mod->enter_rate = 10000;
+	if (!mod->exit_rate || mod->exit_rate > mod->enter_rate)
+		mod->exit_rate = mod->enter_rate / 2;
+	if (!mod->poll_us)
+		mod->poll_us = IRQ_MODERATION_POLL_US;
+
+	mod->irq = irq;
+	mod->polling = false;
+	mod->stopping = false;
+	mod->nr_irqs = 0;
+	mod->nr_polling = 0;
+
+	irq_timings_enable();
+
+	ret = request_threaded_irq(irq, irq_moderation_hardirq,
+				   irq_moderation_thread, flags, name, mod);
+	if (ret)
+		irq_timings_disable();
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(irq_moderation_request);
+
+/**
+ * irq_moderation_free - Free an interrupt requested with moderation
+ * @mod:	moderation descriptor passed to irq_moderation_request()
+ *
+ * Stops polling and frees the interrupt. The device must not generate
+ * further events by then.
+ */
+void irq_moderation_free(struct irq_moderation *mod)
+{
+	/*
+	 * No new polling period starts once stopping is set. Let a running
+	 * one re-enable the interrupt before it is shut down.
+	 */
+	WRITE_ONCE(mod->stopping, true);
+	synchronize_irq(mod->irq);
+
+	free_irq(mod->irq, mod);
+	irq_timings_disable();
+}
+EXPORT_SYMBOL_GPL(irq_moderation_free);
@@ -23,14 +23,18 @@ DEFINE_PER_CPU(struct irq_timings, irq_timings);
 
 static DEFINE_IDR(irqt_stats);
 
+/*
+ * Users enable the timings for as long as they need them; the recording
+ * stays on until the last one disables it.
+ */
 void irq_timings_enable(void)
 {
-	static_branch_enable(&irq_timing_enabled);
+	static_branch_inc(&irq_timing_enabled);
 }
 
 void irq_timings_disable(void)
 {
-	static_branch_disable(&irq_timing_enabled);
+	static_branch_dec(&irq_timing_enabled);
 }
 
 /*
@@ -507,6 +511,34 @@ static inline void irq_timings_store(int irq, struct irqt_stat *irqs, u64 ts)
 	__irq_timings_store(irq, irqs, interval);
 }
 
+/*
+ * Number of elements in the circular buffer: If it happens it
+ * was flushed before, then the number of elements could be
+ * smaller than IRQ_TIMINGS_SIZE, so the count is used,
+ * otherwise the array size is used as we wrapped. The index
+ * begins from zero when we did not wrap. That could be done
+ * in a nicer way with the proper circular array structure
+ * type but with the cost of extra computation in the
+ * interrupt handler hot path. We choose efficiency.
+ *
+ * Inject measured irq/timestamp to the pattern prediction
+ * model while decrementing the counter because we consume the
+ * data from our circular buffer.
+ */
+static void irq_timings_flush(struct irq_timings *irqts)
+{
+	struct irqt_stat __percpu *s;
+	u64 ts;
+	int i, irq;
+
+	for_each_irqts(i, irqts) {
+		irq = irq_timing_decode(irqts->values[i], &ts);
+		s = idr_find(&irqt_stats, irq);
+		if (s)
+			irq_timings_store(irq, this_cpu_ptr(s), ts);
+	}
+}
+
 /**
  * irq_timings_next_event - Return when the next event is supposed to arrive
  *
@@ -539,7 +571,7 @@ u64 irq_timings_next_event(u64 now)
 	struct irqt_stat *irqs;
 	struct irqt_stat __percpu *s;
 	u64 ts, next_evt = U64_MAX;
-	int i, irq = 0;
+	int i;
 
 	/*
 	 * This function must be called with the local irq disabled in
@@ -551,26 +583,7 @@ u64 irq_timings_next_event(u64 now)
 	if (!irqts->count)
 		return next_evt;
 
-	/*
-	 * Number of elements in the circular buffer: If it happens it
-	 * was flushed before, then the number of elements could be
-	 * smaller than IRQ_TIMINGS_SIZE, so the count is used,
-	 * otherwise the array size is used as we wrapped. The index
-	 * begins from zero when we did not wrap. That could be done
-	 * in a nicer way with the proper circular array structure
-	 * type but with the cost of extra computation in the
-	 * interrupt handler hot path. We choose efficiency.
-	 *
-	 * Inject measured irq/timestamp to the pattern prediction
-	 * model while decrementing the counter because we consume the
-	 * data from our circular buffer.
-	 */
-	for_each_irqts(i, irqts) {
-		irq = irq_timing_decode(irqts->values[i], &ts);
-		s = idr_find(&irqt_stats, irq);
-		if (s)
-			irq_timings_store(irq, this_cpu_ptr(s), ts);
-	}
+	irq_timings_flush(irqts);
 
 	/*
 	 * Look in the list of interrupts' statistics, the earliest
@@ -591,6 +604,44 @@ u64 irq_timings_next_event(u64 now)
 	return next_evt;
 }
 
+/**
+ * irq_timings_next_interval - Predict the next inter-arrival time of an irq
+ * @irq: the interrupt number
+ * @now: the current time
+ *
+ * Uses the same model as irq_timings_next_event() but for a single
+ * interrupt and as an interval, which gives an estimation of the
+ * interrupt rate. Only the timings recorded on the current CPU are
+ * taken into account, so it is meant to be called from the handler of
+ * @irq, with the local irq disabled.
+ *
+ * Returns the predicted interval in nanoseconds, U64_MAX if there are
+ * not enough timings for a prediction.
+ */
+u64 irq_timings_next_interval(int irq, u64 now)
+{
+	struct irq_timings *irqts = this_cpu_ptr(&irq_timings);
+	struct irqt_stat __percpu *s;
+	struct irqt_stat *irqs;
+	u64 next_evt;
+
+	lockdep_assert_irqs_disabled();
+
+	if (irqts->count)
+		irq_timings_flush(irqts);
+
+	s = idr_find(&irqt_stats, irq);
+	if (!s)
+		return U64_MAX;
+
+	irqs = this_cpu_ptr(s);
+	next_evt = __irq_timings_next_event(irqs, irq, now);
+	if (next_evt == U64_MAX)
+		return next_evt;
+
+	return next_evt - irqs->last_ts;
+}
+
 void irq_timings_free(int irq)
 {
 	struct irqt_stat __percpu *s;
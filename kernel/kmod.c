@@ -113,10 +113,11 @@ static int call_modprobe(char *module_name, int wait)
  *
  * Load a module using the user mode module loader. The function returns
  * zero on success or a negative errno code or positive exit code from
- * "modprobe" on failure. Note that a successful module load does not mean
- * the module did not then unload and exit on an error of its own. Callers
- * must check that the service they requested is now available not blindly
- * invoke it.
+ * "modprobe" on failure. With @wait, the error of a module init that
+ * modprobe left to run asynchronously is returned as well. Note that a
+ * successful module load does not mean the module did not then unload and
+ * exit on an error of its own. Callers must check that the service they
+ * requested is now available not blindly invoke it.
  *
  * If module auto-loading support is disabled then this function
  * simply returns -ENOENT.
@@ -125,7 +126,8 @@ int __request_module(bool wait, const char *fmt, ...)
 {
 	va_list args;
 	char module_name[MODULE_NAME_LEN];
-	int ret;
+	struct module_async_wait async_wait;
+	int ret, err;
 
 	/*
 	 * We don't allow synchronous module loading from async.  Module
@@ -167,7 +169,15 @@ int __request_module(bool wait, const char *fmt, ...)
 
 	trace_module_request(module_name, wait, _RET_IP_);
 
+	if (wait)
+		module_async_wait_begin(&async_wait);
 	ret = call_modprobe(module_name, wait ? UMH_WAIT_PROC : UMH_WAIT_EXEC);
+	if (wait) {
+		/* Report a failed MODULE_INIT_ASYNC init like modprobe would */
+		err = module_async_wait_end(&async_wait, !ret);
+		if (!ret)
+			ret = err;
+	}
 
 	atomic_inc(&kmod_concurrent_max);
 	wake_up(&kmod_wq);
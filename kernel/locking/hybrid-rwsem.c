@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: GPL-2.0-only
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/lockdep.h>
+#include <linux/hybrid-rwsem.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/errno.h>
+
+/*
+ * After a revocation the readers stay on the rwsem for this many times the
+ * revocation took, which bounds the share of time spent revoking while
+ * writers are frequent.
+ */
+#define HYBRID_RWSEM_INHIBIT_MULT	9
+
+int __hybrid_init_rwsem(struct hybrid_rw_semaphore *sem, const char *name,
+			struct lock_class_key *key,
+			struct lock_class_key *rwsem_key)
+{
+	sem->read_count = alloc_percpu(unsigned int);
+	if (unlikely(!sem->read_count))
+		return -ENOMEM;
+
+	sem->rbias = true;
+	sem->inhibit_until = 0;
+	rcuwait_init(&sem->writer);
+	__init_rwsem(&sem->rwsem, "&sem->rwsem", rwsem_key);
+#ifdef CONFIG_DEBUG_LOCK_ALLOC
+	debug_check_no_locks_freed((void *)sem, sizeof(*sem));
+	lockdep_init_map(&sem->dep_map, name, key, 0);
+#endif
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__hybrid_init_rwsem);
+
+void hybrid_free_rwsem(struct hybrid_rw_semaphore *sem)
+{
+	if (!sem->read_count)
+		return;
+
+	free_percpu(sem->read_count);
+	sem->read_count = NULL; /* catch use after free bugs */
+}
+EXPORT_SYMBOL_GPL(hybrid_free_rwsem);
+
+/*
+ * Slow path, taken while the bias is revoked: pass the rwsem to get in
+ * line with the writers, then hold the lock through the per-CPU counter
+ * like the fast path does. Writers hold the rwsem across their whole
+ * critical section, so a reader getting it here knows there is none.
+ */
+bool __sched __hybrid_down_read(struct hybrid_rw_semaphore *sem, bool try)
+{
+	if (!down_read_trylock(&sem->rwsem)) {
+		if (try)
+			return false;
+
+		lock_contended(&sem->dep_map, _RET_IP_);
+		down_read(&sem->rwsem);
+	}
+
+	this_cpu_inc(*sem->read_count);
+
+	/*
+	 * The writers clear the bias with the rwsem held for write, so it
+	 * can't be revoked under us. Make it visible after our acquire of the
+	 * rwsem, which orders the last writer's critical section before any
+	 * fast path reader that sees it.
+	 */
+	if (!READ_ONCE(sem->rbias) &&
+	    (s64)(local_clock() - READ_ONCE(sem->inhibit_until)) >= 0)
+		smp_store_release(&sem->rbias, true);
+
+	up_read(&sem->rwsem);
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(__hybrid_down_read);
+
+#define per_cpu_sum(var)						\
+({									\
+	typeof(var) __sum = 0;						\
+	int cpu;							\
+	compiletime_assert_atomic_type(__sum);				\
+	for_each_possible_cpu(cpu)					\
+		__sum += per_cpu(var, cpu);				\
+	__sum;								\
+})
+
+/*
+ * Return true if the modular sum of the sem->read_count per-CPU variable is
+ * zero. With the bias revoked and the rwsem held for write, new readers
+ * either back off or block on the rwsem, so a zero sum is stable.
+ */
+static bool readers_active_check(struct hybrid_rw_semaphore *sem)
+{
+	if (per_cpu_sum(*sem->read_count) != 0)
+		return false;
+
+	/*
+	 * If we observed the decrement; ensure we see the entire critical
+	 * section.
+	 */
+
+	smp_mb(); /* C matches B */
+
+	return true;
+}
+
+void __sched hybrid_down_write(struct hybrid_rw_semaphore *sem)
+{
+	bool revoke;
+	u64 start = 0, now;
+
+	might_sleep();
+	rwsem_acquire(&sem->dep_map, 0, 0, _RET_IP_);
+
+	/* Writer-writer exclusion, and keeps slow path readers out. */
+	if (!down_write_trylock(&sem->rwsem)) {
+		lock_contended(&sem->dep_map, _RET_IP_);
+		down_write(&sem->rwsem);
+	}
+
+	revoke = READ_ONCE(sem->rbias);
+	if (revoke) {
+		start = local_clock();
+		WRITE_ONCE(sem->rbias, false);
+		smp_mb(); /* D matches A */
+	}
+
+	/*
+	 * If they don't see the bias cleared, then we are guaranteed to see
+	 * their sem->read_count increment, and therefore will wait for them.
+	 * The same goes for readers that got in through the rwsem before us.
+	 */
+	rcuwait_wait_event(&sem->writer, readers_active_check(sem),
+			   TASK_UNINTERRUPTIBLE);
+
+	if (revoke) {
+		now = local_clock();
+		WRITE_ONCE(sem->inhibit_until,
+			   now + (now - start) * HYBRID_RWSEM_INHIBIT_MULT);
+	}
+	lock_acquired(&sem->dep_map, _RET_IP_);
+}
+EXPORT_SYMBOL_GPL(hybrid_down_write);
+
+void hybrid_up_write(struct hybrid_rw_semaphore *sem)
+{
+	rwsem_release(&sem->dep_map, _RET_IP_);
+
+	/*
+	 * The bias stays revoked; the rwsem hands the lock over to the next
+	 * writer or the waiting readers, and a reader restores the bias once
+	 * the inhibit period is over.
+	 */
+	up_write(&sem->rwsem);
+}
+EXPORT_SYMBOL_GPL(hybrid_up_write);
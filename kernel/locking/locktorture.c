@@ -660,6 +660,58 @@ static struct lock_torture_ops percpu_rwsem_lock_ops = {
 	.name		= "percpu_rwsem_lock"
 };
 
+#include <linux/hybrid-rwsem.h>
+static struct hybrid_rw_semaphore hybrid_rwsem;
+
+static void torture_hybrid_rwsem_init(void)
+{
+	BUG_ON(hybrid_init_rwsem(&hybrid_rwsem));
+}
+
+static void torture_hybrid_rwsem_exit(void)
+{
+	hybrid_free_rwsem(&hybrid_rwsem);
+}
+
+static int torture_hybrid_rwsem_down_write(int tid __maybe_unused)
+__acquires(hybrid_rwsem)
+{
+	hybrid_down_write(&hybrid_rwsem);
+	return 0;
+}
+
+static void torture_hybrid_rwsem_up_write(int tid __maybe_unused)
+__releases(hybrid_rwsem)
+{
+	hybrid_up_write(&hybrid_rwsem);
+}
+
+static int torture_hybrid_rwsem_down_read(int tid __maybe_unused)
+__acquires(hybrid_rwsem)
+{
+	hybrid_down_read(&hybrid_rwsem);
+	return 0;
+}
+
+static void torture_hybrid_rwsem_up_read(int tid __maybe_unused)
+__releases(hybrid_rwsem)
+{
+	hybrid_up_read(&hybrid_rwsem);
+}
+
+static struct lock_torture_ops hybrid_rwsem_lock_ops = {
+	.init		= torture_hybrid_rwsem_init,
+	.exit		= torture_hybrid_rwsem_exit,
+	.writelock	= torture_hybrid_rwsem_down_write,
+	.write_delay	= torture_rwsem_write_delay,
+	.task_boost     = torture_boost_dummy,
+	.writeunlock	= torture_hybrid_rwsem_up_write,
+	.readlock       = torture_hybrid_rwsem_down_read,
+	.read_delay     = torture_rwsem_read_delay,
+	.readunlock     = torture_hybrid_rwsem_up_read,
+	.name		= "hybrid_rwsem_lock"
+};
+
 /*
  * Lock torture writer kthread.  Repeatedly acquires and releases
  * the lock, checking for duplicate acquisitions.
@@ -912,6 +964,7 @@ static int __init lock_torture_init(void)
 #endif
 		&rwsem_lock_ops,
 		&percpu_rwsem_lock_ops,
+		&hybrid_rwsem_lock_ops,
 	};
 
 	if (!torture_init_begin(torture_type, verbose))
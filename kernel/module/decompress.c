@@ -199,6 +199,333 @@ static ssize_t module_xz_decompress(struct load_info *info,
 	xz_dec_end(xz_dec);
 	return retval;
 }
+#elif CONFIG_MODULE_COMPRESS_ZSTD
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/zstd.h>
+#define MODULE_COMPRESSION	zstd
+#define MODULE_DECOMPRESS_FN	module_zstd_decompress
+
+/* Largest module image decompressed in parallel */
+#define MODULE_ZSTD_MAX_SIZE	(512UL << 20)
+
+struct module_zstd_frame {
+	const void *src;
+	size_t src_size;
+	size_t dst_off;
+	size_t dst_size;
+};
+
+struct module_zstd_ctx {
+	struct module_zstd_frame *frames;
+	unsigned int nr_frames;
+	unsigned int nr_workers;
+	void *dst;
+};
+
+struct module_zstd_worker {
+	struct work_struct work;
+	struct module_zstd_ctx *ctx;
+	unsigned int first;
+	int ret;
+};
+
+/*
+ * Walk the frames of @buf. Fills @frames if not NULL and returns the number
+ * of data frames, or a negative error code. @total is the decompressed
+ * size, or ZSTD_CONTENTSIZE_UNKNOWN if a frame doesn't record it, and
+ * @window the largest window size.
+ */
+static int module_zstd_scan(const void *buf, size_t size,
+			    struct module_zstd_frame *frames,
+			    unsigned long long *total, size_t *window)
+{
+	unsigned int nr = 0;
+	size_t pos = 0;
+
+	*total = 0;
+	*window = 0;
+
+	while (pos < size) {
+		zstd_frame_header header;
+		size_t frame_size;
+
+		if (zstd_get_frame_header(&header, buf + pos, size - pos)) {
+			pr_err("zstd compressed module has an incomplete frame header\n");
+			return -EINVAL;
+		}
+
+		frame_size = zstd_find_frame_compressed_size(buf + pos,
+							     size - pos);
+		if (zstd_is_error(frame_size)) {
+			pr_err("zstd compressed module has a truncated frame\n");
+			return -EINVAL;
+		}
+
+		if (header.frameType == ZSTD_skippableFrame) {
+			pos += frame_size;
+			continue;
+		}
+
+		if (header.windowSize > (1ULL << ZSTD_WINDOWLOG_MAX)) {
+			pr_err("zstd compressed module has too large a window size\n");
+			return -EINVAL;
+		}
+		*window = max_t(size_t, *window, header.windowSize);
+
+		if (header.frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN ||
+		    *total == ZSTD_CONTENTSIZE_UNKNOWN) {
+			*total = ZSTD_CONTENTSIZE_UNKNOWN;
+		} else {
+			if (frames) {
+				frames[nr].src = buf + pos;
+				frames[nr].src_size = frame_size;
+				frames[nr].dst_off = *total;
+				frames[nr].dst_size = header.frameContentSize;
+			}
+			*total += header.frameContentSize;
+			if (*total > MODULE_ZSTD_MAX_SIZE)
+				*total = ZSTD_CONTENTSIZE_UNKNOWN;
+		}
+
+		pos += frame_size;
+		nr++;
+	}
+
+	return nr;
+}
+
+static void module_zstd_worker_fn(struct work_struct *work)
+{
+	struct module_zstd_worker *w =
+		container_of(work, struct module_zstd_worker, work);
+	struct module_zstd_ctx *ctx = w->ctx;
+	size_t wksp_size = zstd_dctx_workspace_bound();
+	zstd_dctx *dctx;
+	void *wksp;
+	unsigned int i;
+
+	wksp = kvmalloc(wksp_size, GFP_KERNEL);
+	if (!wksp) {
+		w->ret = -ENOMEM;
+		return;
+	}
+
+	dctx = zstd_init_dctx(wksp, wksp_size);
+	if (!dctx) {
+		w->ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = w->first; i < ctx->nr_frames; i += ctx->nr_workers) {
+		struct module_zstd_frame *f = &ctx->frames[i];
+		size_t ret;
+
+		ret = zstd_decompress_dctx(dctx, ctx->dst + f->dst_off,
+					   f->dst_size, f->src, f->src_size);
+		if (zstd_is_error(ret) || ret != f->dst_size) {
+			pr_err("decompression of frame %u failed: %s\n", i,
+			       zstd_is_error(ret) ? zstd_get_error_name(ret) :
+						    "size mismatch");
+			w->ret = -EINVAL;
+			break;
+		}
+	}
+out:
+	kvfree(wksp);
+}
+
+/*
+ * Decompress independent frames with known sizes in parallel, straight into
+ * the vmapped module image. Frame i is handled by worker i % nr_workers, the
+ * calling thread being worker 0.
+ */
+static ssize_t module_zstd_decompress_frames(struct load_info *info,
+					     const void *buf, size_t size,
+					     unsigned int nr_frames,
+					     size_t total)
+{
+	struct module_zstd_worker *workers;
+	struct module_zstd_ctx ctx;
+	unsigned long long dummy_total;
+	unsigned int i, n_pages;
+	size_t dummy_window;
+	ssize_t retval;
+
+	ctx.frames = kvmalloc_array(nr_frames, sizeof(*ctx.frames), GFP_KERNEL);
+	if (!ctx.frames)
+		return -ENOMEM;
+	retval = module_zstd_scan(buf, size, ctx.frames, &dummy_total,
+				  &dummy_window);
+	if (retval < 0)
+		goto out_frames;
+	if (retval != nr_frames) {
+		retval = -EINVAL;
+		goto out_frames;
+	}
+	ctx.nr_frames = nr_frames;
+	ctx.nr_workers = min(nr_frames, num_online_cpus());
+
+	n_pages = DIV_ROUND_UP(total, PAGE_SIZE);
+	if (info->max_pages < n_pages) {
+		retval = module_extend_max_pages(info,
+						 n_pages - info->max_pages);
+		if (retval)
+			goto out_frames;
+	}
+	for (i = 0; i < n_pages; i++) {
+		struct page *page = module_get_next_page(info);
+
+		if (IS_ERR(page)) {
+			retval = PTR_ERR(page);
+			goto out_frames;
+		}
+	}
+
+	info->hdr = vmap(info->pages, info->used_pages, VM_MAP, PAGE_KERNEL);
+	if (!info->hdr) {
+		retval = -ENOMEM;
+		goto out_frames;
+	}
+	ctx.dst = info->hdr;
+
+	workers = kcalloc(ctx.nr_workers, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		retval = -ENOMEM;
+		goto out_frames;
+	}
+
+	for (i = 0; i < ctx.nr_workers; i++) {
+		INIT_WORK(&workers[i].work, module_zstd_worker_fn);
+		workers[i].ctx = &ctx;
+		workers[i].first = i;
+		if (i)
+			queue_work(system_unbound_wq, &workers[i].work);
+	}
+
+	module_zstd_worker_fn(&workers[0].work);
+
+	retval = total;
+	for (i = 0; i < ctx.nr_workers; i++) {
+		if (i)
+			flush_work(&workers[i].work);
+		if (workers[i].ret)
+			retval = workers[i].ret;
+	}
+
+	kfree(workers);
+out_frames:
+	kvfree(ctx.frames);
+	return retval;
+}
+
+static ssize_t module_zstd_decompress_stream(struct load_info *info,
+					     const void *buf, size_t size,
+					     size_t window)
+{
+	zstd_out_buffer zstd_dec;
+	zstd_in_buffer zstd_buf;
+	zstd_dstream *dstream;
+	struct page *page = NULL;
+	size_t off = PAGE_SIZE;
+	size_t new_size = 0;
+	size_t wksp_size;
+	ssize_t retval;
+	void *wksp;
+	size_t ret;
+
+	wksp_size = zstd_dstream_workspace_bound(window);
+	wksp = kvmalloc(wksp_size, GFP_KERNEL);
+	if (!wksp)
+		return -ENOMEM;
+
+	dstream = zstd_init_dstream(window, wksp, wksp_size);
+	if (!dstream) {
+		pr_err("can't initialize zstd stream\n");
+		retval = -EINVAL;
+		goto out;
+	}
+
+	zstd_buf.src = buf;
+	zstd_buf.pos = 0;
+	zstd_buf.size = size;
+
+	/* Frames don't end on page boundaries, keep filling the last page */
+	do {
+		if (off == PAGE_SIZE) {
+			page = module_get_next_page(info);
+			if (IS_ERR(page)) {
+				retval = PTR_ERR(page);
+				goto out;
+			}
+			off = 0;
+		}
+
+		zstd_dec.dst = kmap_local_page(page);
+		zstd_dec.pos = off;
+		zstd_dec.size = PAGE_SIZE;
+
+		ret = zstd_decompress_stream(dstream, &zstd_dec, &zstd_buf);
+		kunmap_local(zstd_dec.dst);
+
+		if (zstd_is_error(ret)) {
+			pr_err("decompression failed: %s\n",
+			       zstd_get_error_name(ret));
+			retval = -EINVAL;
+			goto out;
+		}
+
+		new_size += zstd_dec.pos - off;
+		off = zstd_dec.pos;
+	} while (off == PAGE_SIZE || zstd_buf.pos < zstd_buf.size);
+
+	if (ret) {
+		pr_err("decompression failed: truncated frame\n");
+		retval = -EINVAL;
+		goto out;
+	}
+
+	retval = new_size;
+
+ out:
+	kvfree(wksp);
+	return retval;
+}
+
+/*
+ * Images made of several frames which record their decompressed size, as
+ * produced by e.g. pzstd, are decompressed in parallel. Anything else goes
+ * through the streaming decompressor.
+ */
+static ssize_t module_zstd_decompress(struct load_info *info,
+				      const void *buf, size_t size)
+{
+	static const u8 signature[] = { 0x28, 0xb5, 0x2f, 0xfd };
+	unsigned long long total;
+	size_t window;
+	int nr_frames;
+
+	if (size < sizeof(signature) ||
+	    memcmp(buf, signature, sizeof(signature))) {
+		pr_err("not a zstd compressed module\n");
+		return -EINVAL;
+	}
+
+	nr_frames = module_zstd_scan(buf, size, NULL, &total, &window);
+	if (nr_frames < 0)
+		return nr_frames;
+	if (!nr_frames) {
+		pr_err("zstd compressed module has no data\n");
+		return -EINVAL;
+	}
+
+	if (nr_frames > 1 && total != ZSTD_CONTENTSIZE_UNKNOWN &&
+	    num_online_cpus() > 1)
+		return module_zstd_decompress_frames(info, buf, size,
+						     nr_frames, total);
+
+	return module_zstd_decompress_stream(info, buf, size, window);
+}
 #else
 #error "Unexpected configuration for CONFIG_MODULE_DECOMPRESS"
 #endif
@@ -222,7 +549,10 @@ int module_decompress(struct load_info *info, const void *buf, size_t size)
 		goto err;
 	}
 
-	info->hdr = vmap(info->pages, info->used_pages, VM_MAP, PAGE_KERNEL);
+	/* Decompressors writing to the image in parallel map it themselves */
+	if (!info->hdr)
+		info->hdr = vmap(info->pages, info->used_pages, VM_MAP,
+				 PAGE_KERNEL);
 	if (!info->hdr) {
 		error = -ENOMEM;
 		goto err;
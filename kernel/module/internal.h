@@ -65,6 +65,8 @@ struct load_info {
 	unsigned long symoffs, stroffs, init_typeoffs, core_typeoffs;
 	struct _ddebug_info dyndbg;
 	bool sig_ok;
+	/* read and decompress stages, before struct module exists */
+	u64 read_ns, decompress_ns;
 #ifdef CONFIG_KALLSYMS
 	unsigned long mod_kallsyms_init_off;
 #endif
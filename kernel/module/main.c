@@ -54,6 +54,9 @@
 #include <linux/dynamic_debug.h>
 #include <linux/audit.h>
 #include <linux/cfi.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 #include <uapi/linux/module.h>
 #include "internal.h"
 
@@ -78,6 +81,13 @@ static void do_free_init(struct work_struct *w);
 static DECLARE_WORK(init_free_wq, do_free_init);
 static LLIST_HEAD(init_free_list);
 
+/* Work queue running the init of modules loaded with MODULE_INIT_ASYNC */
+static struct workqueue_struct *module_init_wq;
+static DEFINE_SPINLOCK(async_init_lock);
+static LIST_HEAD(async_init_list);
+static LIST_HEAD(async_init_waiters);
+static u64 async_init_seq;
+
 struct mod_tree_root mod_tree __cacheline_aligned = {
 	.addr_min = -1UL,
 };
@@ -970,6 +980,22 @@ static ssize_t show_taint(struct module_attribute *mattr,
 static struct module_attribute modinfo_taint =
 	__ATTR(taint, 0444, show_taint, NULL);
 
+static ssize_t show_load_time(struct module_attribute *mattr,
+			      struct module_kobject *mk, char *buffer)
+{
+	const struct module_load_times *t = &mk->mod->load_times;
+
+	/* in microseconds */
+	return sprintf(buffer, "read %llu\ndecompress %llu\nlink %llu\ninit %llu\n",
+		       div_u64(t->read, NSEC_PER_USEC),
+		       div_u64(t->decompress, NSEC_PER_USEC),
+		       div_u64(t->link, NSEC_PER_USEC),
+		       div_u64(t->init, NSEC_PER_USEC));
+}
+
+static struct module_attribute modinfo_load_time =
+	__ATTR(load_time, 0444, show_load_time, NULL);
+
 struct module_attribute *modinfo_attrs[] = {
 	&module_uevent,
 	&modinfo_version,
@@ -981,6 +1007,7 @@ struct module_attribute *modinfo_attrs[] = {
 #endif
 	&modinfo_initsize,
 	&modinfo_taint,
+	&modinfo_load_time,
 #ifdef CONFIG_MODULE_UNLOAD
 	&modinfo_refcnt,
 #endif
@@ -2466,6 +2493,9 @@ static void do_free_init(struct work_struct *w)
 /* Default value for module->async_probe_requested */
 static bool async_probe;
 module_param(async_probe, bool, 0644);
+/* Maximum number of concurrent asynchronous module inits, 0 for nr_cpus */
+static unsigned int init_workers;
+module_param(init_workers, uint, 0444);
 
 /*
  * This is where the real work happens.
@@ -2477,6 +2507,7 @@ static noinline int do_init_module(struct module *mod)
 {
 	int ret = 0;
 	struct mod_initfree *freeinit;
+	u64 start;
 
 	freeinit = kmalloc(sizeof(*freeinit), GFP_KERNEL);
 	if (!freeinit) {
@@ -2485,10 +2516,12 @@ static noinline int do_init_module(struct module *mod)
 	}
 	freeinit->module_init = mod->init_layout.base;
 
+	start = ktime_get_ns();
 	do_mod_ctors(mod);
 	/* Start the module */
 	if (mod->init != NULL)
 		ret = do_one_initcall(mod->init);
+	mod->load_times.init = ktime_get_ns() - start;
 	if (ret < 0) {
 		goto fail_free_freeinit;
 	}
@@ -2580,6 +2613,234 @@ static noinline int do_init_module(struct module *mod)
 	return ret;
 }
 
+struct mod_async_init {
+	struct work_struct work;
+	struct list_head list;
+	struct module *mod;
+	/* The init this one waits for in request_module(), if any */
+	struct mod_async_init *waiting_for;
+	struct completion done;
+	refcount_t refcnt;
+	u64 seq;
+};
+
+static void put_async_init(struct mod_async_init *ai)
+{
+	if (refcount_dec_and_test(&ai->refcnt))
+		kfree(ai);
+}
+
+static void run_async_init(struct mod_async_init *ai)
+{
+	struct module_async_wait *w;
+	struct module *mod = ai->mod;
+	char name[MODULE_NAME_LEN];
+	int ret;
+
+	/* @mod is gone if its init fails */
+	strscpy(name, mod->name, sizeof(name));
+	ret = do_init_module(mod);
+	if (ret)
+		pr_err("%s: asynchronous init failed: %d\n", name, ret);
+
+	spin_lock(&async_init_lock);
+	list_del(&ai->list);
+	/* Let the request_module() callers waiting for it know */
+	list_for_each_entry(w, &async_init_waiters, list) {
+		if (ret && !w->ret && ai->seq > w->since && ai->seq <= w->until)
+			w->ret = ret;
+	}
+	spin_unlock(&async_init_lock);
+
+	complete_all(&ai->done);
+	put_async_init(ai);
+}
+
+static void do_async_init_module(struct work_struct *work)
+{
+	run_async_init(container_of(work, struct mod_async_init, work));
+}
+
+/*
+ * Run the init of @mod on module_init_wq.  Modules depending on @mod wait
+ * in resolve_symbol_wait() until it is live, so only independent inits run
+ * concurrently.  Falls back to a synchronous init if the work can't be set
+ * up.
+ */
+static int queue_init_module(struct module *mod)
+{
+	struct mod_async_init *ai;
+
+	if (!module_init_wq)
+		return do_init_module(mod);
+
+	ai = kzalloc(sizeof(*ai), GFP_KERNEL);
+	if (!ai)
+		return do_init_module(mod);
+
+	INIT_WORK(&ai->work, do_async_init_module);
+	init_completion(&ai->done);
+	refcount_set(&ai->refcnt, 1);
+	ai->mod = mod;
+
+	spin_lock(&async_init_lock);
+	ai->seq = ++async_init_seq;
+	list_add_tail(&ai->list, &async_init_list);
+	spin_unlock(&async_init_lock);
+
+	queue_work(module_init_wq, &ai->work);
+	return 0;
+}
+
+/**
+ * module_async_wait_begin - start tracking asynchronous module inits
+ * @w: wait state, passed to module_async_wait_end() later
+ *
+ * Called before loading modules, to later wait for the asynchronous inits
+ * started from then on with module_async_wait_end().
+ */
+void module_async_wait_begin(struct module_async_wait *w)
+{
+	w->until = U64_MAX;
+	w->ret = 0;
+
+	spin_lock(&async_init_lock);
+	w->since = async_init_seq;
+	list_add(&w->list, &async_init_waiters);
+	spin_unlock(&async_init_lock);
+}
+
+/* Does waiting for @ai from @self close a cycle of waiting inits? */
+static bool async_init_cycle(struct mod_async_init *self,
+			     struct mod_async_init *ai)
+{
+	for (; ai; ai = ai->waiting_for) {
+		if (ai == self)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Get the first init after @seq that @w covers and @self can wait for
+ * without deadlocking, and note that @self waits for it.
+ */
+static struct mod_async_init *
+next_async_init(struct module_async_wait *w, struct mod_async_init *self,
+		u64 seq)
+{
+	struct mod_async_init *ai;
+
+	spin_lock(&async_init_lock);
+	list_for_each_entry(ai, &async_init_list, list) {
+		if (ai->seq <= max(seq, w->since))
+			continue;
+		if (ai->seq > w->until) {
+			ai = NULL;
+			break;
+		}
+		if (self && async_init_cycle(self, ai))
+			continue;
+
+		refcount_inc(&ai->refcnt);
+		if (self)
+			self->waiting_for = ai;
+		goto out;
+	}
+	ai = NULL;
+out:
+	spin_unlock(&async_init_lock);
+	return ai;
+}
+
+/**
+ * module_async_wait_end - wait for asynchronous module inits
+ * @w: wait state set up by module_async_wait_begin()
+ * @wait: whether to wait at all, or only stop tracking
+ *
+ * Used by request_module() so that its callers find the requested module
+ * initialized even if modprobe loaded it with MODULE_INIT_ASYNC.  Only the
+ * inits started after module_async_wait_begin() are waited for, not
+ * unrelated ones of other loaders.
+ *
+ * When called from an asynchronous init itself, inits that wait for the
+ * caller are skipped, as are inits waiting for those, since they would end
+ * up waiting for each other.  Inits not started yet are run right away
+ * instead, they could otherwise be stuck behind the caller for a free
+ * worker.
+ *
+ * Returns the error of the first waited for init that failed, or 0.
+ */
+int module_async_wait_end(struct module_async_wait *w, bool wait)
+{
+	struct work_struct *work = current_work();
+	struct mod_async_init *self = NULL;
+	long timeout = 30 * HZ;
+	struct mod_async_init *ai;
+	u64 seq = 0;
+	int ret;
+
+	if (work && work->func == do_async_init_module)
+		self = container_of(work, struct mod_async_init, work);
+
+	spin_lock(&async_init_lock);
+	w->until = wait ? async_init_seq : w->since;
+	spin_unlock(&async_init_lock);
+
+	while ((ai = next_async_init(w, self, seq))) {
+		seq = ai->seq;
+
+		if (self && cancel_work(&ai->work)) {
+			/*
+			 * Whoever waits for @ai now waits for what @self
+			 * waits for next.
+			 */
+			spin_lock(&async_init_lock);
+			self->waiting_for = NULL;
+			ai->waiting_for = self;
+			spin_unlock(&async_init_lock);
+
+			run_async_init(ai);
+
+			spin_lock(&async_init_lock);
+			ai->waiting_for = NULL;
+			spin_unlock(&async_init_lock);
+		} else {
+			timeout = wait_for_completion_timeout(&ai->done,
+							      timeout);
+			if (self) {
+				spin_lock(&async_init_lock);
+				self->waiting_for = NULL;
+				spin_unlock(&async_init_lock);
+			}
+		}
+		put_async_init(ai);
+
+		if (!timeout) {
+			pr_warn("gave up waiting for asynchronous module inits\n");
+			break;
+		}
+	}
+
+	spin_lock(&async_init_lock);
+	list_del(&w->list);
+	ret = w->ret;
+	spin_unlock(&async_init_lock);
+
+	return ret;
+}
+
+static int __init module_init_wq_init(void)
+{
+	unsigned int max_active = init_workers ?: num_possible_cpus();
+
+	module_init_wq = alloc_workqueue("module_init", WQ_UNBOUND,
+					 min_t(unsigned int, max_active,
+					       WQ_UNBOUND_MAX_ACTIVE));
+	return module_init_wq ? 0 : -ENOMEM;
+}
+core_initcall(module_init_wq_init);
+
 static int may_init_module(void)
 {
 	if (!capable(CAP_SYS_MODULE) || modules_disabled)
@@ -2713,6 +2974,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	struct module *mod;
 	long err = 0;
 	char *after_dashes;
+	u64 start = ktime_get_ns();
 
 	/*
 	 * Do the signature check (if any) first. All that
@@ -2775,6 +3037,9 @@ static int load_module(struct load_info *info, const char __user *uargs,
 
 	audit_log_kern_module(mod->name);
 
+	mod->load_times.read = info->read_ns;
+	mod->load_times.decompress = info->decompress_ns;
+
 	/* Reserve our place in the list. */
 	err = add_unformed_module(mod);
 	if (err)
@@ -2884,9 +3149,13 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	/* Get rid of temporary copy. */
 	free_copy(info, flags);
 
+	mod->load_times.link = ktime_get_ns() - start;
+
 	/* Done! */
 	trace_module_load(mod);
 
+	if (flags & MODULE_INIT_ASYNC)
+		return queue_init_module(mod);
 	return do_init_module(mod);
 
  sysfs_cleanup:
@@ -2939,6 +3208,7 @@ SYSCALL_DEFINE3(init_module, void __user *, umod,
 {
 	int err;
 	struct load_info info = { };
+	u64 start;
 
 	err = may_init_module();
 	if (err)
@@ -2947,9 +3217,11 @@ SYSCALL_DEFINE3(init_module, void __user *, umod,
 	pr_debug("init_module: umod=%p, len=%lu, uargs=%p\n",
 	       umod, len, uargs);
 
+	start = ktime_get_ns();
 	err = copy_module_from_user(umod, len, &info);
 	if (err)
 		return err;
+	info.read_ns = ktime_get_ns() - start;
 
 	return load_module(&info, uargs, 0);
 }
@@ -2958,6 +3230,7 @@ SYSCALL_DEFINE3(finit_module, int, fd, const char __user *, uargs, int, flags)
 {
 	struct load_info info = { };
 	void *buf = NULL;
+	u64 start;
 	int len;
 	int err;
 
@@ -2969,19 +3242,24 @@ SYSCALL_DEFINE3(finit_module, int, fd, const char __user *, uargs, int, flags)
 
 	if (flags & ~(MODULE_INIT_IGNORE_MODVERSIONS
 		      |MODULE_INIT_IGNORE_VERMAGIC
-		      |MODULE_INIT_COMPRESSED_FILE))
+		      |MODULE_INIT_COMPRESSED_FILE
+		      |MODULE_INIT_ASYNC))
 		return -EINVAL;
 
+	start = ktime_get_ns();
 	len = kernel_read_file_from_fd(fd, 0, &buf, INT_MAX, NULL,
 				       READING_MODULE);
 	if (len < 0)
 		return len;
+	info.read_ns = ktime_get_ns() - start;
 
 	if (flags & MODULE_INIT_COMPRESSED_FILE) {
+		start = ktime_get_ns();
 		err = module_decompress(&info, buf, len);
 		vfree(buf); /* compressed data is no longer needed */
 		if (err)
 			return err;
+		info.decompress_ns = ktime_get_ns() - start;
 	} else {
 		info.hdr = buf;
 		info.len = len;
@@ -23,12 +23,14 @@
 #include <linux/pm.h>
 #include <linux/nmi.h>
 #include <linux/console.h>
+#include <linux/crypto.h>
 #include <linux/cpu.h>
 #include <linux/freezer.h>
 #include <linux/gfp.h>
 #include <linux/syscore_ops.h>
 #include <linux/ctype.h>
 #include <linux/ktime.h>
+#include <linux/moduleparam.h>
 #include <linux/security.h>
 #include <linux/secretmem.h>
 #include <trace/events/power.h>
@@ -69,6 +71,59 @@ static const struct platform_hibernation_ops *hibernation_ops;
 
 static atomic_t hibernate_atomic = ATOMIC_INIT(1);
 
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "hibernate."
+
+char hib_comp_algo[CRYPTO_MAX_ALG_NAME] = CONFIG_HIBERNATION_DEF_COMP;
+
+static bool hib_comp_algo_enabled(const char *algo)
+{
+	if (!strcmp(algo, COMPRESSION_ALGO_LZO))
+		return IS_BUILTIN(CONFIG_CRYPTO_LZO);
+	if (!strcmp(algo, COMPRESSION_ALGO_LZ4))
+		return IS_BUILTIN(CONFIG_CRYPTO_LZ4);
+	if (!strcmp(algo, COMPRESSION_ALGO_ZSTD))
+		return IS_BUILTIN(CONFIG_CRYPTO_ZSTD);
+	return false;
+}
+
+static int hibernate_compressor_param_set(const char *compressor,
+					  const struct kernel_param *kp)
+{
+	char algo[CRYPTO_MAX_ALG_NAME];
+	unsigned int sleep_flags;
+
+	strscpy(algo, compressor, sizeof(algo));
+	strim(algo);
+
+	/* Only compressors built in can be used to resume */
+	if (!hib_comp_algo_enabled(algo))
+		return -EINVAL;
+
+	sleep_flags = lock_system_sleep();
+	strscpy(hib_comp_algo, algo, sizeof(hib_comp_algo));
+	unlock_system_sleep(sleep_flags);
+
+	return 0;
+}
+
+static const struct kernel_param_ops hibernate_compressor_param_ops = {
+	.set	= hibernate_compressor_param_set,
+	.get	= param_get_string,
+};
+
+static struct kparam_string hibernate_compressor_param_string = {
+	.maxlen	= sizeof(hib_comp_algo),
+	.string	= hib_comp_algo,
+};
+
+module_param_cb(compressor, &hibernate_compressor_param_ops,
+		&hibernate_compressor_param_string, 0644);
+MODULE_PARM_DESC(compressor,
+		 "Compression algorithm to be used with hibernation");
+
 bool hibernate_acquire(void)
 {
 	return atomic_add_unless(&hibernate_atomic, -1, 0);
@@ -718,6 +773,7 @@ int hibernate(void)
 {
 	bool snapshot_test = false;
 	unsigned int sleep_flags;
+	int comp_flags = 0;
 	int error;
 
 	if (!hibernation_available()) {
@@ -726,6 +782,17 @@ int hibernate(void)
 	}
 
 	sleep_flags = lock_system_sleep();
+
+	/* Don't write an image the resuming kernel cannot decompress */
+	if (!nocompress) {
+		comp_flags = hib_comp_algo_to_flags(hib_comp_algo);
+		if (comp_flags < 0 || !hib_comp_algo_enabled(hib_comp_algo)) {
+			pr_err("%s compression is not available\n", hib_comp_algo);
+			error = -EOPNOTSUPP;
+			goto Unlock;
+		}
+	}
+
 	/* The snapshot device should not be opened while we're running */
 	if (!hibernate_acquire()) {
 		error = -EBUSY;
@@ -762,7 +829,7 @@ int hibernate(void)
 		if (nocompress)
 			flags |= SF_NOCOMPRESS_MODE;
 		else
-		        flags |= SF_CRC32_MODE;
+			flags |= SF_CRC32_MODE | comp_flags;
 
 		pm_pr_dbg("Writing hibernation image.\n");
 		error = swsusp_write(flags);
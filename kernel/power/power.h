@@ -171,6 +171,44 @@ extern int swsusp_swap_in_use(void);
 #define SF_NOCOMPRESS_MODE	2
 #define SF_CRC32_MODE	        4
 #define SF_HW_SIG		8
+/* LZO is used if neither of these is set */
+#define SF_COMPRESSION_ALG_LZ4	16
+#define SF_COMPRESSION_ALG_ZSTD	32
+#define SF_COMPRESSION_ALG_MASK	(SF_COMPRESSION_ALG_LZ4 | SF_COMPRESSION_ALG_ZSTD)
+
+#define COMPRESSION_ALGO_LZO	"lzo"
+#define COMPRESSION_ALGO_LZ4	"lz4"
+#define COMPRESSION_ALGO_ZSTD	"zstd"
+
+/* Compressor used for writing the image, see hibernate.compressor= */
+extern char hib_comp_algo[];
+
+/* Image header flags for compressor @algo, -EINVAL if unknown */
+static inline int hib_comp_algo_to_flags(const char *algo)
+{
+	if (!strcmp(algo, COMPRESSION_ALGO_LZO))
+		return 0;
+	if (!strcmp(algo, COMPRESSION_ALGO_LZ4))
+		return SF_COMPRESSION_ALG_LZ4;
+	if (!strcmp(algo, COMPRESSION_ALGO_ZSTD))
+		return SF_COMPRESSION_ALG_ZSTD;
+	return -EINVAL;
+}
+
+/* Compressor an image with header @flags was written with */
+static inline const char *hib_comp_algo_from_flags(unsigned int flags)
+{
+	switch (flags & SF_COMPRESSION_ALG_MASK) {
+	case 0:
+		return COMPRESSION_ALGO_LZO;
+	case SF_COMPRESSION_ALG_LZ4:
+		return COMPRESSION_ALGO_LZ4;
+	case SF_COMPRESSION_ALG_ZSTD:
+		return COMPRESSION_ALGO_ZSTD;
+	default:
+		return NULL;
+	}
+}
 
 /* kernel/power/hibernate.c */
 extern int swsusp_check(void);
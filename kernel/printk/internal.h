@@ -18,6 +18,7 @@ int devkmsg_sysctl_set_loglvl(struct ctl_table *table, int write,
 enum printk_info_flags {
 	LOG_NEWLINE	= 2,	/* text ended with a newline */
 	LOG_CONT	= 8,	/* text is a fragment of a continuation line */
+	LOG_BINARY	= 16,	/* text is a format pointer and binary args */
 };
 
 __printf(4, 0)
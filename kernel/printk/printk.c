@@ -47,6 +47,8 @@
 #include <linux/sched/clock.h>
 #include <linux/sched/debug.h>
 #include <linux/sched/task_stack.h>
+#include <linux/compat.h>
+#include <linux/kmsg_mmap.h>
 
 #include <linux/uaccess.h>
 #include <asm/sections.h>
@@ -406,7 +408,14 @@ static struct latched_seq clear_seq = {
 #define LOG_ALIGN __alignof__(unsigned long)
 #define __LOG_BUF_LEN (1 << CONFIG_LOG_BUF_SHIFT)
 #define LOG_BUF_LEN_MAX (u32)(1 << 31)
+#ifdef CONFIG_PRINTK_RINGBUFFER_MMAP
+/* The static ringbuffer may be mapped to user space, give it its own pages */
+static char __log_buf[__LOG_BUF_LEN] __page_aligned_bss;
+#define PRB_STATIC_ATTR	__page_aligned_data
+#else
 static char __log_buf[__LOG_BUF_LEN] __aligned(LOG_ALIGN);
+#define PRB_STATIC_ATTR
+#endif
 static char *log_buf = __log_buf;
 static u32 log_buf_len = __LOG_BUF_LEN;
 
@@ -420,8 +429,8 @@ static u32 log_buf_len = __LOG_BUF_LEN;
 #if CONFIG_LOG_BUF_SHIFT <= PRB_AVGBITS
 #error CONFIG_LOG_BUF_SHIFT value too small.
 #endif
-_DEFINE_PRINTKRB(printk_rb_static, CONFIG_LOG_BUF_SHIFT - PRB_AVGBITS,
-		 PRB_AVGBITS, &__log_buf[0]);
+__DEFINE_PRINTKRB(printk_rb_static, CONFIG_LOG_BUF_SHIFT - PRB_AVGBITS,
+		  PRB_AVGBITS, &__log_buf[0], PRB_STATIC_ATTR);
 
 static struct printk_ringbuffer printk_rb_dynamic;
 
@@ -761,6 +770,7 @@ static ssize_t devkmsg_read(struct file *file, char __user *buf,
 		goto out;
 	}
 
+	printk_format_binary(r);
 	len = info_print_ext_header(user->buf, sizeof(user->buf), r->info);
 	len += msg_print_ext_body(user->buf + len, sizeof(user->buf) - len,
 				  &r->text_buf[0], r->info->text_len,
@@ -894,12 +904,129 @@ static int devkmsg_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+#ifdef CONFIG_PRINTK_RINGBUFFER_MMAP
+/* The first page of the mapping, describing the layout of the rest. */
+static struct kmsg_mmap_header *kmsg_mmap_header;
+
+static unsigned long kmsg_mmap_region_size(size_t size)
+{
+	return PAGE_ALIGN(size);
+}
+
+/* The static ringbuffer is part of the kernel image. */
+static phys_addr_t kmsg_mmap_pa(void *addr)
+{
+	if (__is_kernel((unsigned long)addr))
+		return __pa_symbol(addr);
+	return virt_to_phys(addr);
+}
+
+static void __init kmsg_mmap_init(void)
+{
+	struct prb_desc_ring *desc_ring = &prb->desc_ring;
+	struct prb_data_ring *text_data_ring = &prb->text_data_ring;
+	unsigned int descs_count = _DESCS_COUNT(desc_ring->count_bits);
+	struct kmsg_mmap_header *hdr;
+
+	BUILD_BUG_ON(sizeof(struct kmsg_mmap_header) > PAGE_SIZE);
+	BUILD_BUG_ON(sizeof(struct kmsg_mmap_desc) != sizeof(struct prb_desc));
+	BUILD_BUG_ON(offsetof(struct kmsg_mmap_desc, text_begin) !=
+		     offsetof(struct prb_desc, text_blk_lpos.begin));
+	BUILD_BUG_ON(sizeof(struct kmsg_mmap_info) != sizeof(struct printk_info));
+	BUILD_BUG_ON(offsetof(struct kmsg_mmap_info, caller_id) !=
+		     offsetof(struct printk_info, caller_id));
+	BUILD_BUG_ON(offsetof(struct kmsg_mmap_info, subsystem) !=
+		     offsetof(struct printk_info, dev_info.subsystem));
+	BUILD_BUG_ON(offsetof(struct kmsg_mmap_info, device) !=
+		     offsetof(struct printk_info, dev_info.device));
+	BUILD_BUG_ON(KMSG_MMAP_DESC_FINALIZED != desc_finalized);
+	BUILD_BUG_ON(KMSG_MMAP_DESC_FLAGS_SHIFT != DESC_FLAGS_SHIFT);
+
+	hdr = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!hdr)
+		return;
+
+	hdr->magic = KMSG_MMAP_MAGIC;
+	hdr->version = KMSG_MMAP_VERSION;
+	hdr->desc_count_bits = desc_ring->count_bits;
+	hdr->text_size_bits = text_data_ring->size_bits;
+	hdr->desc_size = sizeof(struct prb_desc);
+	hdr->info_size = sizeof(struct printk_info);
+	hdr->descs_offset = PAGE_SIZE;
+	hdr->infos_offset = hdr->descs_offset +
+		kmsg_mmap_region_size(descs_count * sizeof(struct prb_desc));
+	hdr->text_offset = hdr->infos_offset +
+		kmsg_mmap_region_size(descs_count * sizeof(struct printk_info));
+	hdr->map_size = hdr->text_offset +
+		kmsg_mmap_region_size(_DATA_SIZE(text_data_ring->size_bits));
+
+	kmsg_mmap_header = hdr;
+}
+
+static int kmsg_mmap_region(struct vm_area_struct *vma, unsigned long offset,
+			    void *addr, size_t size)
+{
+	unsigned long len;
+
+	if (offset >= vma->vm_end - vma->vm_start)
+		return 0;
+
+	len = min(kmsg_mmap_region_size(size),
+		  vma->vm_end - vma->vm_start - offset);
+	return remap_pfn_range(vma, vma->vm_start + offset,
+			       kmsg_mmap_pa(addr) >> PAGE_SHIFT, len,
+			       vma->vm_page_prot);
+}
+
+static int devkmsg_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct prb_desc_ring *desc_ring = &prb->desc_ring;
+	struct prb_data_ring *text_data_ring = &prb->text_data_ring;
+	unsigned int descs_count = _DESCS_COUNT(desc_ring->count_bits);
+	struct kmsg_mmap_header *hdr = kmsg_mmap_header;
+	int err;
+
+	if (!hdr)
+		return -ENODEV;
+
+	if (in_compat_syscall())
+		return -EINVAL;
+
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start > hdr->map_size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	err = kmsg_mmap_region(vma, 0, hdr, PAGE_SIZE);
+	if (!err)
+		err = kmsg_mmap_region(vma, hdr->descs_offset, desc_ring->descs,
+				       descs_count * sizeof(struct prb_desc));
+	if (!err)
+		err = kmsg_mmap_region(vma, hdr->infos_offset, desc_ring->infos,
+				       descs_count * sizeof(struct printk_info));
+	if (!err)
+		err = kmsg_mmap_region(vma, hdr->text_offset, text_data_ring->data,
+				       _DATA_SIZE(text_data_ring->size_bits));
+	return err;
+}
+#else /* CONFIG_PRINTK_RINGBUFFER_MMAP */
+static inline void kmsg_mmap_init(void)
+{
+}
+
+#define devkmsg_mmap NULL
+#endif /* CONFIG_PRINTK_RINGBUFFER_MMAP */
+
 const struct file_operations kmsg_fops = {
 	.open = devkmsg_open,
 	.read = devkmsg_read,
 	.write_iter = devkmsg_write,
 	.llseek = devkmsg_llseek,
 	.poll = devkmsg_poll,
+	.mmap = devkmsg_mmap,
 	.release = devkmsg_release,
 };
 
@@ -969,6 +1096,11 @@ void log_buf_vmcoreinfo_setup(void)
 
 	VMCOREINFO_STRUCT_SIZE(latched_seq);
 	VMCOREINFO_OFFSET(latched_seq, val);
+
+#ifdef CONFIG_PRINTK_BINARY_RECORDS
+	/* Records with this flag have to be decoded, see tools/printk. */
+	VMCOREINFO_NUMBER(LOG_BINARY);
+#endif
 }
 #endif
 
@@ -1070,6 +1202,18 @@ static unsigned int __init add_to_rb(struct printk_ringbuffer *rb,
 
 static char setup_text_buf[LOG_LINE_MAX] __initdata;
 
+/*
+ * Parts of the dynamic ringbuffer may be mapped to userspace. Never share
+ * their pages with other allocations in that case.
+ */
+#ifdef CONFIG_PRINTK_RINGBUFFER_MMAP
+#define LOG_BUF_ALLOC_ALIGN	PAGE_SIZE
+#define log_buf_alloc_size(size)	PAGE_ALIGN(size)
+#else
+#define LOG_BUF_ALLOC_ALIGN	LOG_ALIGN
+#define log_buf_alloc_size(size)	(size)
+#endif
+
 void __init setup_log_buf(int early)
 {
 	struct printk_info *new_infos;
@@ -1108,7 +1252,8 @@ void __init setup_log_buf(int early)
 		return;
 	}
 
-	new_log_buf = memblock_alloc(new_log_buf_len, LOG_ALIGN);
+	new_log_buf = memblock_alloc(log_buf_alloc_size(new_log_buf_len),
+				     LOG_BUF_ALLOC_ALIGN);
 	if (unlikely(!new_log_buf)) {
 		pr_err("log_buf_len: %lu text bytes not available\n",
 		       new_log_buf_len);
@@ -1116,7 +1261,8 @@ void __init setup_log_buf(int early)
 	}
 
 	new_descs_size = new_descs_count * sizeof(struct prb_desc);
-	new_descs = memblock_alloc(new_descs_size, LOG_ALIGN);
+	new_descs = memblock_alloc(log_buf_alloc_size(new_descs_size),
+				   LOG_BUF_ALLOC_ALIGN);
 	if (unlikely(!new_descs)) {
 		pr_err("log_buf_len: %zu desc bytes not available\n",
 		       new_descs_size);
@@ -1124,7 +1270,8 @@ void __init setup_log_buf(int early)
 	}
 
 	new_infos_size = new_descs_count * sizeof(struct printk_info);
-	new_infos = memblock_alloc(new_infos_size, LOG_ALIGN);
+	new_infos = memblock_alloc(log_buf_alloc_size(new_infos_size),
+				   LOG_BUF_ALLOC_ALIGN);
 	if (unlikely(!new_infos)) {
 		pr_err("log_buf_len: %zu info bytes not available\n",
 		       new_infos_size);
@@ -1181,9 +1328,9 @@ void __init setup_log_buf(int early)
 	return;
 
 err_free_descs:
-	memblock_free(new_descs, new_descs_size);
+	memblock_free(new_descs, log_buf_alloc_size(new_descs_size));
 err_free_log_buf:
-	memblock_free(new_log_buf, new_log_buf_len);
+	memblock_free(new_log_buf, log_buf_alloc_size(new_log_buf_len));
 }
 
 static bool __read_mostly ignore_loglevel;
@@ -1264,6 +1411,225 @@ static inline void boot_delay_msec(int level)
 static bool printk_time = IS_ENABLED(CONFIG_PRINTK_TIME);
 module_param_named(time, printk_time, bool, S_IRUGO | S_IWUSR);
 
+#ifdef CONFIG_PRINTK_BINARY_RECORDS
+/*
+ * Binary records carry a pointer to the format string, followed by the
+ * arguments as packed by vbin_printf(). They are formatted with bstr_printf()
+ * by the readers, right before the records are printed.
+ */
+static bool printk_binary_records;
+module_param_named(binary_records, printk_binary_records, bool, S_IRUGO | S_IWUSR);
+
+#define PRINTK_BINARY_WORDS	((LOG_LINE_MAX - sizeof(const char *)) / sizeof(u32))
+
+struct printk_binary_buf {
+	bool	busy;
+	u32	words[PRINTK_BINARY_WORDS];
+};
+
+/* Scratch buffers for packing and unpacking, one per CPU and NMI context. */
+static DEFINE_PER_CPU(struct printk_binary_buf [2], printk_binary_bufs);
+
+/* Must be called with interrupts disabled. */
+static struct printk_binary_buf *printk_binary_get_buf(void)
+{
+	struct printk_binary_buf *buf;
+
+	if (!printk_percpu_data_ready())
+		return NULL;
+
+	buf = this_cpu_ptr(&printk_binary_bufs[in_nmi() ? 1 : 0]);
+	if (buf->busy)
+		return NULL;
+	buf->busy = true;
+	return buf;
+}
+
+static void printk_binary_put_buf(struct printk_binary_buf *buf)
+{
+	buf->busy = false;
+}
+
+/*
+ * Store a message as a binary record if possible. Only complete messages of
+ * the kernel image are stored this way: format strings of modules may go
+ * away before the record is read, and continuation lines must be appended
+ * as text.
+ *
+ * Return: The size of the stored record, or a negative error code if the
+ * message must be stored formatted. @args is left untouched in that case.
+ */
+__printf(5, 0)
+static int printk_store_binary(int level, const struct dev_printk_info *dev_info,
+			       u64 ts_nsec, u32 caller_id, const char *fmt,
+			       va_list args)
+{
+	enum printk_info_flags flags = 0;
+	struct printk_binary_buf *buf;
+	struct prb_reserved_entry e;
+	struct printk_record r;
+	size_t fmt_len;
+	u16 prefix_len;
+	va_list args2;
+	int words;
+	int ret;
+
+	if (!printk_binary_records || trace_console_enabled())
+		return -EINVAL;
+
+	if (!is_kernel_rodata((unsigned long)fmt))
+		return -EINVAL;
+
+	fmt_len = strlen(fmt);
+	if (!fmt_len || fmt[fmt_len - 1] != '\n')
+		return -EINVAL;
+
+	prefix_len = printk_parse_prefix(fmt, &level, &flags);
+	if (flags & LOG_CONT)
+		return -EINVAL;
+	fmt += prefix_len;
+
+	/* The level might still be hidden in the arguments. */
+	if (level == LOGLEVEL_DEFAULT && fmt[0] == '%')
+		return -EINVAL;
+	if (level == LOGLEVEL_DEFAULT)
+		level = default_message_loglevel;
+
+	buf = printk_binary_get_buf();
+	if (!buf)
+		return -EBUSY;
+
+	va_copy(args2, args);
+	words = vbin_printf(buf->words, PRINTK_BINARY_WORDS, fmt, args2);
+	va_end(args2);
+
+	/* A trailing string is only packed if it fits with some room left. */
+	if (words >= PRINTK_BINARY_WORDS) {
+		ret = -E2BIG;
+		goto out;
+	}
+
+	prb_rec_init_wr(&r, sizeof(fmt) + words * sizeof(u32));
+	if (!prb_reserve(&e, prb, &r)) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	memcpy(&r.text_buf[0], &fmt, sizeof(fmt));
+	memcpy(&r.text_buf[sizeof(fmt)], buf->words, words * sizeof(u32));
+	r.info->text_len = sizeof(fmt) + words * sizeof(u32);
+	r.info->facility = 0;
+	r.info->level = level & 7;
+	r.info->flags = LOG_NEWLINE | LOG_BINARY;
+	r.info->ts_nsec = ts_nsec;
+	r.info->caller_id = caller_id;
+	if (dev_info)
+		memcpy(&r.info->dev_info, dev_info, sizeof(r.info->dev_info));
+
+	prb_final_commit(&e);
+
+	ret = r.info->text_len;
+out:
+	printk_binary_put_buf(buf);
+	return ret;
+}
+
+/*
+ * Format a binary record in place. If the record was truncated when it was
+ * read, or if no scratch buffer is available, the bare format string is used
+ * as the text.
+ */
+static void printk_format_binary(struct printk_record *r)
+{
+	struct printk_info *info = r->info;
+	struct printk_binary_buf *buf;
+	size_t bin_len = info->text_len;
+	unsigned long flags;
+	const char *fmt;
+	size_t len;
+
+	if (!(info->flags & LOG_BINARY))
+		return;
+	info->flags &= ~LOG_BINARY;
+
+	if (!r->text_buf_size || bin_len < sizeof(fmt) ||
+	    r->text_buf_size < sizeof(fmt)) {
+		info->text_len = 0;
+		return;
+	}
+	memcpy(&fmt, &r->text_buf[0], sizeof(fmt));
+	bin_len -= sizeof(fmt);
+
+	printk_safe_enter_irqsave(flags);
+	buf = printk_binary_get_buf();
+	if (buf && sizeof(fmt) + bin_len <= r->text_buf_size) {
+		memcpy(buf->words, &r->text_buf[sizeof(fmt)], bin_len);
+		len = bstr_printf(r->text_buf, r->text_buf_size, fmt, buf->words);
+	} else {
+		strscpy(r->text_buf, fmt, r->text_buf_size);
+		len = strlen(r->text_buf);
+	}
+	if (buf)
+		printk_binary_put_buf(buf);
+	printk_safe_exit_irqrestore(flags);
+
+	len = min(len, r->text_buf_size - 1);
+
+	/* Strip the trailing newline, as vprintk_store() does. */
+	if (len && r->text_buf[len - 1] == '\n')
+		len--;
+	info->text_len = len;
+}
+
+/*
+ * The text length and the line count of a binary record are only known once
+ * it is formatted. Format the record into @scratch to fix them up in @info
+ * and @line_count. Without a scratch buffer, they are left as they are, i.e.
+ * about the binary payload.
+ */
+static void printk_size_binary(struct printk_info *info,
+			       unsigned int *line_count,
+			       char *scratch, size_t scratch_size)
+{
+	struct printk_info tmp;
+	struct printk_record r;
+	unsigned int i;
+
+	if (!(info->flags & LOG_BINARY) || !scratch || !scratch_size)
+		return;
+
+	prb_rec_init_rd(&r, &tmp, scratch, scratch_size);
+	if (!prb_read_valid(prb, info->seq, &r) || tmp.seq != info->seq)
+		return;
+	printk_format_binary(&r);
+
+	*line_count = 1;
+	for (i = 0; i < tmp.text_len; i++) {
+		if (scratch[i] == '\n')
+			(*line_count)++;
+	}
+	info->text_len = tmp.text_len;
+	info->flags = tmp.flags;
+}
+#else /* CONFIG_PRINTK_BINARY_RECORDS */
+static inline int printk_store_binary(int level, const struct dev_printk_info *dev_info,
+				      u64 ts_nsec, u32 caller_id, const char *fmt,
+				      va_list args)
+{
+	return -EINVAL;
+}
+
+static inline void printk_format_binary(struct printk_record *r)
+{
+}
+
+static inline void printk_size_binary(struct printk_info *info,
+				      unsigned int *line_count,
+				      char *scratch, size_t scratch_size)
+{
+}
+#endif /* CONFIG_PRINTK_BINARY_RECORDS */
+
 static size_t print_syslog(unsigned int level, char *buf)
 {
 	return sprintf(buf, "<%u>", level);
@@ -1341,6 +1707,9 @@ static size_t record_print_text(struct printk_record *r, bool syslog,
 	size_t len = 0;
 	char *next;
 
+	printk_format_binary(r);
+	text_len = r->info->text_len;
+
 	/*
 	 * If the message was truncated because the buffer was not large
 	 * enough, treat the available text as if it were the full text.
@@ -1452,9 +1821,13 @@ static size_t get_record_print_text_size(struct printk_info *info,
  *
  * @max_seq is simply an upper bound and does not need to exist. If the caller
  * does not require an upper bound, -1 can be used for @max_seq.
+ *
+ * Binary records are formatted into @scratch to learn the size of their text.
+ * @scratch must be large enough to hold any record that is printed.
  */
 static u64 find_first_fitting_seq(u64 start_seq, u64 max_seq, size_t size,
-				  bool syslog, bool time)
+				  bool syslog, bool time, char *scratch,
+				  size_t scratch_size)
 {
 	struct printk_info info;
 	unsigned int line_count;
@@ -1465,6 +1838,7 @@ static u64 find_first_fitting_seq(u64 start_seq, u64 max_seq, size_t size,
 	prb_for_each_info(start_seq, prb, seq, &info, &line_count) {
 		if (info.seq >= max_seq)
 			break;
+		printk_size_binary(&info, &line_count, scratch, scratch_size);
 		len += get_record_print_text_size(&info, line_count, syslog, time);
 	}
 
@@ -1484,6 +1858,7 @@ static u64 find_first_fitting_seq(u64 start_seq, u64 max_seq, size_t size,
 	prb_for_each_info(start_seq, prb, seq, &info, &line_count) {
 		if (len <= size || info.seq >= max_seq)
 			break;
+		printk_size_binary(&info, &line_count, scratch, scratch_size);
 		len -= get_record_print_text_size(&info, line_count, syslog, time);
 	}
 
@@ -1614,7 +1989,7 @@ static int syslog_print_all(char __user *buf, int size, bool clear)
 	 * into the user-provided buffer for this dump.
 	 */
 	seq = find_first_fitting_seq(latched_seq_read_nolock(&clear_seq), -1,
-				     size, true, time);
+				     size, true, time, text, CONSOLE_LOG_MAX);
 
 	prb_rec_init_rd(&r, &info, text, CONSOLE_LOG_MAX);
 
@@ -2144,6 +2519,14 @@ int vprintk_store(int facility, int level,
 
 	caller_id = printk_caller_id();
 
+	if (facility == 0) {
+		ret = printk_store_binary(level, dev_info, ts_nsec, caller_id,
+					  fmt, args);
+		if (ret >= 0)
+			goto out;
+		ret = 0;
+	}
+
 	/*
 	 * The sprintf needs to come first since the syslog prefix might be
 	 * passed in as a parameter. An extra byte must be reserved so that
@@ -2714,6 +3097,7 @@ static bool console_emit_next_record(struct console *con, char *text, char *ext_
 
 	if (ext_text) {
 		write_text = ext_text;
+		printk_format_binary(&r);
 		len = info_print_ext_header(ext_text, CONSOLE_EXT_LOG_MAX, r.info);
 		len += msg_print_ext_body(ext_text + len, CONSOLE_EXT_LOG_MAX - len,
 					  &r.text_buf[0], r.info->text_len, &r.info->dev_info);
@@ -3328,6 +3712,8 @@ static int __init printk_late_init(void)
 	struct console *con;
 	int ret;
 
+	kmsg_mmap_init();
+
 	for_each_console(con) {
 		if (!(con->flags & CON_BOOT))
 			continue;
@@ -3788,10 +4174,11 @@ bool kmsg_dump_get_buffer(struct kmsg_dump_iter *iter, bool syslog,
 	 * Find first record that fits, including all following records,
 	 * into the user-provided buffer for this dump. Pass in size-1
 	 * because this function (by way of record_print_text()) will
-	 * not write more than size-1 bytes of text into @buf.
+	 * not write more than size-1 bytes of text into @buf. Nothing
+	 * is written to @buf yet, so binary records are sized in it.
 	 */
 	seq = find_first_fitting_seq(iter->cur_seq, iter->next_seq,
-				     size - 1, syslog, time);
+				     size - 1, syslog, time, buf, size);
 
 	/*
 	 * Next kmsg_dump_get_buffer() invocation will dump block of
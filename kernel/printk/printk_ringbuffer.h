@@ -229,9 +229,12 @@ enum desc_state {
  *
  * Note: The specified external buffer must be of the size:
  *       2 ^ (descbits + avgtextbits)
+ *
+ * __DEFINE_PRINTKRB() additionally applies @attr to the descriptor and
+ * info arrays.
  */
-#define _DEFINE_PRINTKRB(name, descbits, avgtextbits, text_buf)			\
-static struct prb_desc _##name##_descs[_DESCS_COUNT(descbits)] = {				\
+#define __DEFINE_PRINTKRB(name, descbits, avgtextbits, text_buf, attr)		\
+static struct prb_desc _##name##_descs[_DESCS_COUNT(descbits)] attr = {			\
 	/* the initial head and tail */								\
 	[_DESCS_COUNT(descbits) - 1] = {							\
 		/* reusable */									\
@@ -240,7 +243,7 @@ static struct prb_desc _##name##_descs[_DESCS_COUNT(descbits)] = {				\
 		.text_blk_lpos	= FAILED_BLK_LPOS,						\
 	},											\
 };												\
-static struct printk_info _##name##_infos[_DESCS_COUNT(descbits)] = {				\
+static struct printk_info _##name##_infos[_DESCS_COUNT(descbits)] attr = {			\
 	/* this will be the first record reserved by a writer */				\
 	[0] = {											\
 		/* will be incremented to 0 on the first reservation */				\
@@ -270,6 +273,9 @@ static struct printk_ringbuffer name = {							\
 	.fail			= ATOMIC_LONG_INIT(0),						\
 }
 
+#define _DEFINE_PRINTKRB(name, descbits, avgtextbits, text_buf)			\
+	__DEFINE_PRINTKRB(name, descbits, avgtextbits, text_buf, )
+
 /**
  * DEFINE_PRINTKRB() - Define a ringbuffer.
  *
@@ -38,6 +38,7 @@
 #include <linux/sched/deadline.h>
 #include <linux/sched/nohz.h>
 #include <linux/sched/debug.h>
+#include <linux/sched/isolation.h>
 #include <linux/timer.h>
 #include <linux/freezer.h>
 #include <linux/compat.h>
@@ -123,6 +124,27 @@ static const int hrtimer_clock_to_base_table[MAX_CLOCKS] = {
 	[CLOCK_TAI]		= HRTIMER_BASE_TAI,
 };
 
+/*
+ * Slack aware coalescing of timer expiries. When enabled, an expiry run also
+ * picks up timers queued behind the first not yet expired one as long as
+ * their slack window already opened, and timers which are free to migrate
+ * are preferably queued on a CPU which is going to wake up within their
+ * slack window anyway.
+ */
+static bool hrtimer_coalesce_enabled __read_mostly;
+
+static int __init setup_hrtimer_coalesce(char *str)
+{
+	return (kstrtobool(str, &hrtimer_coalesce_enabled) == 0);
+}
+
+__setup("hrtimer_coalesce=", setup_hrtimer_coalesce);
+
+/* Number of queued timers looked at beyond the first not expired one */
+#define HRTIMER_COALESCE_SCAN		8
+/* Number of CPUs looked at for a remote expiry within the slack window */
+#define HRTIMER_COALESCE_SCAN_CPUS	16
+
 /*
  * Functions and macros which are different for UP/SMP systems are kept in a
  * single place
@@ -198,6 +220,71 @@ hrtimer_check_target(struct hrtimer *timer, struct hrtimer_clock_base *new_base)
 	return expires < new_base->cpu_base->expires_next;
 }
 
+#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
+static inline bool hrtimer_expiry_in_slack(struct hrtimer_cpu_base *cpu_base,
+					   ktime_t soft, ktime_t hard)
+{
+	ktime_t expires_next = READ_ONCE(cpu_base->expires_next);
+
+	return READ_ONCE(cpu_base->hres_active) &&
+	       expires_next >= soft && expires_next <= hard;
+}
+
+/*
+ * Find a CPU whose next expiry falls into the slack window of @timer, so
+ * that queueing the timer there does not add a wakeup. The local CPU is
+ * preferred, then the housekeeping CPUs of the local node. The expiry
+ * values are read without holding the remote locks, hrtimer_check_target()
+ * validates the choice once the lock is taken.
+ */
+static struct hrtimer_cpu_base *
+hrtimer_coalesce_target(struct hrtimer *timer, int basenum, int pinned)
+{
+	struct hrtimer_cpu_base *this_cpu_base = this_cpu_ptr(&hrtimer_bases);
+	struct hrtimer_clock_base *base = &this_cpu_base->clock_base[basenum];
+	const struct cpumask *hk_mask;
+	ktime_t soft, hard;
+	int cpu, scanned = 0;
+
+	if (!hrtimer_coalesce_enabled || pinned ||
+	    !static_branch_likely(&timers_migration_enabled))
+		return NULL;
+
+	soft = ktime_sub(hrtimer_get_softexpires(timer), base->offset);
+	hard = ktime_sub(hrtimer_get_expires(timer), base->offset);
+	if (soft == hard)
+		return NULL;
+
+	if (hrtimer_expiry_in_slack(this_cpu_base, soft, hard))
+		return this_cpu_base;
+
+	hk_mask = housekeeping_cpumask(HK_TYPE_TIMER);
+	for_each_cpu_and(cpu, cpumask_of_node(numa_node_id()), hk_mask) {
+		struct hrtimer_cpu_base *cpu_base = &per_cpu(hrtimer_bases, cpu);
+
+		if (cpu_base == this_cpu_base || !cpu_online(cpu))
+			continue;
+
+		if (hrtimer_expiry_in_slack(cpu_base, soft, hard)) {
+			/* Only a wakeup if it expires before the local one */
+			if (hard < this_cpu_base->expires_next)
+				this_cpu_base->nr_wakeups_avoided++;
+			return cpu_base;
+		}
+
+		if (++scanned == HRTIMER_COALESCE_SCAN_CPUS)
+			break;
+	}
+	return NULL;
+}
+#else
+static inline struct hrtimer_cpu_base *
+hrtimer_coalesce_target(struct hrtimer *timer, int basenum, int pinned)
+{
+	return NULL;
+}
+#endif
+
 static inline
 struct hrtimer_cpu_base *get_target_base(struct hrtimer_cpu_base *base,
 					 int pinned)
@@ -230,7 +317,9 @@ switch_hrtimer_base(struct hrtimer *timer, struct hrtimer_clock_base *base,
 	int basenum = base->index;
 
 	this_cpu_base = this_cpu_ptr(&hrtimer_bases);
-	new_cpu_base = get_target_base(this_cpu_base, pinned);
+	new_cpu_base = hrtimer_coalesce_target(timer, basenum, pinned);
+	if (!new_cpu_base)
+		new_cpu_base = get_target_base(this_cpu_base, pinned);
 again:
 	new_base = &new_cpu_base->clock_base[basenum];
 
@@ -1714,6 +1803,34 @@ static void __run_hrtimer(struct hrtimer_cpu_base *cpu_base,
 	base->running = NULL;
 }
 
+/*
+ * Find a timer behind @node whose slack window already opened at @basenow.
+ *
+ * The queue is sorted by the hard expiry, so such timers are not reached
+ * by the in order walk in __hrtimer_run_queues(). Expiring them now rather
+ * than with the timer in front of them saves a wakeup whenever that timer
+ * gets canceled or restarted later before it expires, which is the common
+ * case for timeouts.
+ */
+static struct hrtimer *hrtimer_coalesce_next(struct timerqueue_node *node,
+					     ktime_t basenow)
+{
+	int i;
+
+	for (i = 0; i < HRTIMER_COALESCE_SCAN; i++) {
+		struct hrtimer *timer;
+
+		node = timerqueue_iterate_next(node);
+		if (!node)
+			break;
+
+		timer = container_of(node, struct hrtimer, node);
+		if (basenow >= hrtimer_get_softexpires_tv64(timer))
+			return timer;
+	}
+	return NULL;
+}
+
 static void __hrtimer_run_queues(struct hrtimer_cpu_base *cpu_base, ktime_t now,
 				 unsigned long flags, unsigned int active_mask)
 {
@@ -1743,8 +1860,14 @@ static void __hrtimer_run_queues(struct hrtimer_cpu_base *cpu_base, ktime_t now,
 			 * are right-of a not yet expired timer, because that
 			 * timer will have to trigger a wakeup anyway.
 			 */
-			if (basenow < hrtimer_get_softexpires_tv64(timer))
-				break;
+			if (basenow < hrtimer_get_softexpires_tv64(timer)) {
+				if (!hrtimer_coalesce_enabled)
+					break;
+				timer = hrtimer_coalesce_next(node, basenow);
+				if (!timer)
+					break;
+				cpu_base->nr_coalesced++;
+			}
 
 			__run_hrtimer(cpu_base, base, timer, &basenow, flags);
 			if (active_mask == HRTIMER_ACTIVE_SOFT)
@@ -188,7 +188,12 @@ EXPORT_SYMBOL(jiffies_64);
  */
 #define WHEEL_SIZE	(LVL_SIZE * LVL_DEPTH)
 
-#ifdef CONFIG_NO_HZ_COMMON
+#ifdef CONFIG_NO_HZ_FULL
+# define NR_BASES	3
+# define BASE_STD	0
+# define BASE_DEF	1
+# define BASE_REMOTE	2
+#elif defined(CONFIG_NO_HZ_COMMON)
 # define NR_BASES	2
 # define BASE_STD	0
 # define BASE_DEF	1
@@ -297,6 +302,45 @@ static inline bool is_timers_nohz_active(void)
 static inline bool is_timers_nohz_active(void) { return false; }
 #endif /* NO_HZ_COMMON */
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Remote expiry of timers queued on nohz_full CPUs.
+ *
+ * When enabled on the command line, timers which are not pinned and get
+ * queued on a nohz_full CPU end up in the BASE_REMOTE base of that CPU
+ * instead of the standard or deferrable one. Those bases are never expired
+ * by the CPU they belong to and are not taken into account for its next
+ * event, so the isolated CPU neither has its tick restarted nor gets a timer
+ * softirq for them. The timekeeping CPU, which keeps its tick running as
+ * long as nohz_full CPUs exist, expires them instead.
+ *
+ * The selection of the base only depends on the timer flags and on boot
+ * time state, so lock_timer_base() keeps finding the base of a timer.
+ */
+static bool timer_remote_expiry __read_mostly;
+static unsigned long timer_remote_expiry_busy;
+
+static int __init setup_timer_remote_expiry(char *str)
+{
+	return (kstrtobool(str, &timer_remote_expiry) == 0);
+}
+__setup("timer_remote_expiry=", setup_timer_remote_expiry);
+
+static inline bool is_timer_remote(u32 tflags, unsigned int cpu)
+{
+	return timer_remote_expiry && !(tflags & TIMER_PINNED) &&
+	       tick_nohz_full_cpu(cpu);
+}
+
+static inline bool is_timer_base_remote(struct timer_base *base)
+{
+	return base == per_cpu_ptr(&timer_bases[BASE_REMOTE], base->cpu);
+}
+#else
+static inline bool is_timer_remote(u32 tflags, unsigned int cpu) { return false; }
+static inline bool is_timer_base_remote(struct timer_base *base) { return false; }
+#endif /* NO_HZ_FULL */
+
 static unsigned long round_jiffies_common(unsigned long j, int cpu,
 		bool force_up)
 {
@@ -577,6 +621,10 @@ trigger_dyntick_cpu(struct timer_base *base, struct timer_list *timer)
 	if (!is_timers_nohz_active())
 		return;
 
+	/* Expired by the timekeeping CPU, which does not stop its tick */
+	if (is_timer_base_remote(base))
+		return;
+
 	/*
 	 * TODO: This wants some optimizing similar to the code below, but we
 	 * will do that when we switch from push to pull for deferrable timers.
@@ -913,6 +961,10 @@ static inline struct timer_base *get_timer_cpu_base(u32 tflags, u32 cpu)
 	 */
 	if (IS_ENABLED(CONFIG_NO_HZ_COMMON) && (tflags & TIMER_DEFERRABLE))
 		base = per_cpu_ptr(&timer_bases[BASE_DEF], cpu);
+#ifdef CONFIG_NO_HZ_FULL
+	if (is_timer_remote(tflags, cpu))
+		base = per_cpu_ptr(&timer_bases[BASE_REMOTE], cpu);
+#endif
 	return base;
 }
 
@@ -926,6 +978,10 @@ static inline struct timer_base *get_timer_this_cpu_base(u32 tflags)
 	 */
 	if (IS_ENABLED(CONFIG_NO_HZ_COMMON) && (tflags & TIMER_DEFERRABLE))
 		base = this_cpu_ptr(&timer_bases[BASE_DEF]);
+#ifdef CONFIG_NO_HZ_FULL
+	if (is_timer_remote(tflags, smp_processor_id()))
+		base = this_cpu_ptr(&timer_bases[BASE_REMOTE]);
+#endif
 	return base;
 }
 
@@ -1796,6 +1852,55 @@ static inline void __run_timers(struct timer_base *base)
 	timer_base_unlock_expiry(base);
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+static inline bool is_timer_remote_expirer(void)
+{
+	return timer_remote_expiry && tick_nohz_full_enabled() &&
+	       READ_ONCE(tick_do_timer_cpu) == smp_processor_id();
+}
+
+static bool timer_remote_pending(void)
+{
+	int cpu;
+
+	if (!is_timer_remote_expirer())
+		return false;
+
+	for_each_cpu(cpu, tick_nohz_full_mask) {
+		struct timer_base *base = per_cpu_ptr(&timer_bases[BASE_REMOTE], cpu);
+
+		if (time_after_eq(jiffies, READ_ONCE(base->next_expiry)))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Expire the remote bases of all nohz_full CPUs, offline ones included as
+ * their remote timers are not migrated on unplug. The timekeeping duty can
+ * move between CPUs, the busy bit keeps a base from being expired by two
+ * CPUs at once.
+ */
+static void run_remote_timers(void)
+{
+	int cpu;
+
+	if (!is_timer_remote_expirer())
+		return;
+
+	if (test_and_set_bit_lock(0, &timer_remote_expiry_busy))
+		return;
+
+	for_each_cpu(cpu, tick_nohz_full_mask)
+		__run_timers(per_cpu_ptr(&timer_bases[BASE_REMOTE], cpu));
+
+	clear_bit_unlock(0, &timer_remote_expiry_busy);
+}
+#else
+static inline bool timer_remote_pending(void) { return false; }
+static inline void run_remote_timers(void) { }
+#endif
+
 /*
  * This function runs timers and the timer-tq in bottom half context.
  */
@@ -1806,6 +1911,7 @@ static __latent_entropy void run_timer_softirq(struct softirq_action *h)
 	__run_timers(base);
 	if (IS_ENABLED(CONFIG_NO_HZ_COMMON))
 		__run_timers(this_cpu_ptr(&timer_bases[BASE_DEF]));
+	run_remote_timers();
 }
 
 /*
@@ -1822,7 +1928,8 @@ static void run_local_timers(void)
 			return;
 		/* CPU is awake, so check the deferrable base. */
 		base++;
-		if (time_before(jiffies, base->next_expiry))
+		if (time_before(jiffies, base->next_expiry) &&
+		    !timer_remote_pending())
 			return;
 	}
 	raise_softirq(TIMER_SOFTIRQ);
@@ -2005,6 +2112,9 @@ int timers_prepare_cpu(unsigned int cpu)
 
 	for (b = 0; b < NR_BASES; b++) {
 		base = per_cpu_ptr(&timer_bases[b], cpu);
+		/* Remote timers stay queued while the CPU is offline */
+		if (is_timer_base_remote(base))
+			continue;
 		base->clk = jiffies;
 		base->next_expiry = base->clk + NEXT_TIMER_MAX_DELTA;
 		base->next_expiry_recalc = false;
@@ -2024,6 +2134,9 @@ int timers_dead_cpu(unsigned int cpu)
 
 	for (b = 0; b < NR_BASES; b++) {
 		old_base = per_cpu_ptr(&timer_bases[b], cpu);
+		/* Remote timers are expired by the timekeeping CPU anyway */
+		if (is_timer_base_remote(old_base))
+			continue;
 		new_base = get_cpu_ptr(&timer_bases[b]);
 		/*
 		 * The caller is globally serialized and nobody else
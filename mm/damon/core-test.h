@@ -289,6 +289,36 @@ static void damon_test_set_regions(struct kunit *test)
 	damon_destroy_target(t);
 }
 
+static void damon_test_feed_loop_next_input(struct kunit *test)
+{
+	unsigned long last_input = 900000, too_small_score = 5000,
+		      too_big_score = 15000, way_too_big_score = 40000;
+
+	/* Not achieved the goal yet.  Increase the input. */
+	KUNIT_EXPECT_GT(test,
+			damon_feed_loop_next_input(last_input, too_small_score),
+			last_input);
+
+	/* Exceeded the goal.  Decrease the input. */
+	KUNIT_EXPECT_LT(test,
+			damon_feed_loop_next_input(last_input, too_big_score),
+			last_input);
+
+	/* Exceeded the goal too much.  Back off to the minimum input. */
+	KUNIT_EXPECT_EQ(test,
+			damon_feed_loop_next_input(last_input,
+				way_too_big_score),
+			10000);
+
+	/* Nothing achieved at all.  Input could only be doubled. */
+	KUNIT_EXPECT_EQ(test, damon_feed_loop_next_input(last_input, 0),
+			last_input * 2);
+
+	/* Exactly achieved the goal.  Keep the input. */
+	KUNIT_EXPECT_EQ(test, damon_feed_loop_next_input(last_input, 10000),
+			last_input);
+}
+
 static struct kunit_case damon_test_cases[] = {
 	KUNIT_CASE(damon_test_target),
 	KUNIT_CASE(damon_test_regions),
@@ -299,6 +329,7 @@ static struct kunit_case damon_test_cases[] = {
 	KUNIT_CASE(damon_test_split_regions_of),
 	KUNIT_CASE(damon_test_ops_registration),
 	KUNIT_CASE(damon_test_set_regions),
+	KUNIT_CASE(damon_test_feed_loop_next_input),
 	{},
 };
 
@@ -11,6 +11,7 @@
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/mm.h>
+#include <linux/psi.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 
@@ -263,12 +264,38 @@ int damon_set_regions(struct damon_target *t, struct damon_addr_range *ranges,
 	return 0;
 }
 
+#ifdef CONFIG_PSI
+static u64 damos_get_some_mem_psi_total(void)
+{
+	if (static_branch_likely(&psi_disabled))
+		return 0;
+	return div_u64(psi_system.total[PSI_AVGS][PSI_MEM_SOME],
+			NSEC_PER_USEC);
+}
+#else	/* CONFIG_PSI */
+static inline u64 damos_get_some_mem_psi_total(void)
+{
+	return 0;
+}
+#endif	/* CONFIG_PSI */
+
 /* initialize private fields of damos_quota and return the pointer */
 static struct damos_quota *damos_quota_init_priv(struct damos_quota *quota)
 {
+	int metric;
+
+	for (metric = 0; metric < NR_DAMOS_QUOTA_GOAL_METRICS; metric++) {
+		struct damos_quota_goal *goal = &quota->goals[metric];
+
+		goal->current_value = 0;
+		goal->last_psi_total = 0;
+		if (metric == DAMOS_QUOTA_SOME_MEM_PSI_US)
+			goal->last_psi_total = damos_get_some_mem_psi_total();
+	}
 	quota->total_charged_sz = 0;
 	quota->total_charged_ns = 0;
 	quota->esz = 0;
+	quota->esz_bp = 0;
 	quota->charged_sz = 0;
 	quota->charged_from = 0;
 	quota->charge_target_from = NULL;
@@ -780,26 +807,117 @@ static void damon_do_apply_schemes(struct damon_ctx *c,
 	}
 }
 
-/* Shouldn't be called if quota->ms and quota->sz are zero */
+static bool damos_quota_has_goal(struct damos_quota *quota)
+{
+	int metric;
+
+	for (metric = 0; metric < NR_DAMOS_QUOTA_GOAL_METRICS; metric++) {
+		if (quota->goals[metric].target_value)
+			return true;
+	}
+	return false;
+}
+
+static void damos_set_quota_goal_current_value(struct damos_quota_goal *goal,
+		enum damos_quota_goal_metric metric)
+{
+	struct sysinfo i;
+	u64 now_psi_total;
+
+	switch (metric) {
+	case DAMOS_QUOTA_SOME_MEM_PSI_US:
+		now_psi_total = damos_get_some_mem_psi_total();
+		goal->current_value = now_psi_total - goal->last_psi_total;
+		goal->last_psi_total = now_psi_total;
+		break;
+	case DAMOS_QUOTA_FREE_MEM_BP:
+		si_meminfo(&i);
+		goal->current_value = mult_frac(i.freeram, 10000, i.totalram);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Returns the score of the quota goals, which is the highest ratio of the
+ * current value to the target value among the goals, in basis points.
+ */
+static unsigned long damos_quota_score(struct damos_quota *quota)
+{
+	unsigned long highest_score = 0;
+	int metric;
+
+	for (metric = 0; metric < NR_DAMOS_QUOTA_GOAL_METRICS; metric++) {
+		struct damos_quota_goal *goal = &quota->goals[metric];
+
+		if (!goal->target_value)
+			continue;
+		damos_set_quota_goal_current_value(goal, metric);
+		highest_score = max(highest_score, mult_frac(
+					goal->current_value, 10000,
+					goal->target_value));
+	}
+	return highest_score;
+}
+
+/*
+ * Returns the next input of the quota auto-tuning feedback loop, for the last
+ * input and the score of the last input in basis points.
+ *
+ * The score is expected to converge to 10000.  While it is lower than that,
+ * the input is increased in proportion to the distance from the goal.  Once
+ * it is higher, the input is decreased in the same way, down to a minimum
+ * that still allows the loop to increase it again.
+ */
+static unsigned long damon_feed_loop_next_input(unsigned long last_input,
+		unsigned long score)
+{
+	const unsigned long goal = 10000;
+	/* Set minimum input as 10000 to avoid compensation be zero */
+	const unsigned long min_input = 10000;
+	unsigned long score_goal_diff, compensation;
+
+	score_goal_diff = max(goal, score) - min(goal, score);
+	/* Never compensate more than the last input, to avoid overflows */
+	compensation = mult_frac(last_input, min(score_goal_diff, goal), goal);
+
+	if (goal > score)
+		return last_input + min(compensation, ULONG_MAX - last_input);
+	if (last_input > compensation)
+		return max(last_input - compensation, min_input);
+	return min_input;
+}
+
+/* Shouldn't be called if quota->ms, quota->sz and quota->goals are unset */
 static void damos_set_effective_quota(struct damos_quota *quota)
 {
 	unsigned long throughput;
-	unsigned long esz;
+	unsigned long esz = ULONG_MAX;
 
-	if (!quota->ms) {
-		quota->esz = quota->sz;
-		return;
+	if (quota->ms) {
+		if (quota->total_charged_ns)
+			throughput = quota->total_charged_sz * 1000000 /
+				quota->total_charged_ns;
+		else
+			throughput = PAGE_SIZE * 1024;
+		esz = throughput * quota->ms;
 	}
 
-	if (quota->total_charged_ns)
-		throughput = quota->total_charged_sz * 1000000 /
-			quota->total_charged_ns;
-	else
-		throughput = PAGE_SIZE * 1024;
-	esz = throughput * quota->ms;
-
 	if (quota->sz && quota->sz < esz)
 		esz = quota->sz;
+
+	if (damos_quota_has_goal(quota)) {
+		unsigned long max_esz_bp = ULONG_MAX;
+
+		/* Don't let the loop wind up beyond the time and size quotas */
+		if (esz < ULONG_MAX / 10000)
+			max_esz_bp = esz * 10000;
+		quota->esz_bp = min(damon_feed_loop_next_input(
+					max(quota->esz_bp, 10000UL),
+					damos_quota_score(quota)), max_esz_bp);
+		esz = quota->esz_bp / 10000;
+	}
 	quota->esz = esz;
 }
 
@@ -817,7 +935,7 @@ static void kdamond_apply_schemes(struct damon_ctx *c)
 		if (!s->wmarks.activated)
 			continue;
 
-		if (!quota->ms && !quota->sz)
+		if (!quota->ms && !quota->sz && !damos_quota_has_goal(quota))
 			continue;
 
 		/* New charge window starts */
@@ -77,6 +77,20 @@ static struct damos_quota damon_lru_sort_quota = {
 };
 DEFINE_DAMON_MODULES_DAMOS_TIME_QUOTA(damon_lru_sort_quota);
 
+/*
+ * Goals for the automatic tuning of DAMON_LRU_SORT's quota.
+ *
+ * ``quota_mem_pressure_us`` is the desired total time in microseconds that
+ * some tasks of the system stall on memory, per quota reset interval.
+ * ``quota_free_mem_bp`` is the desired free memory rate of the system in
+ * basis points.  Setting either of those to non-zero makes DAMON_LRU_SORT
+ * adjust the effective quotas of its hot and cold pages sorting every quota
+ * reset interval, so that the measured metrics converge to the goals.
+ * ``quota_ms`` is still respected as the upper limit.  Zero for both by
+ * default, meaning the auto-tuning is disabled.
+ */
+DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS(damon_lru_sort_quota);
+
 static struct damos_watermarks damon_lru_sort_wmarks = {
 	.metric = DAMOS_WMARK_FREE_MEM_RATE,
 	.interval = 5000000,	/* 5 seconds */
@@ -132,6 +146,30 @@ DEFINE_DAMON_MODULES_DAMOS_STATS_PARAMS(damon_lru_sort_cold_stat,
 		lru_sort_tried_cold_regions, lru_sorted_cold_regions,
 		cold_quota_exceeds);
 
+/*
+ * Current effective size quotas of DAMON_LRU_SORT in bytes.
+ *
+ * The quotas that DAMON_LRU_SORT actually applied for the last quota reset
+ * interval for hot and cold pages sorting, after the time quota conversion
+ * and the goals-based tuning.
+ */
+static unsigned long hot_effective_quota_sz __read_mostly;
+module_param(hot_effective_quota_sz, ulong, 0400);
+
+static unsigned long cold_effective_quota_sz __read_mostly;
+module_param(cold_effective_quota_sz, ulong, 0400);
+
+/*
+ * Achieved values of the quota goals metrics, which are the
+ * ``achieved_mem_pressure_us`` and ``achieved_free_mem_bp`` parameters, as
+ * measured for the hot pages sorting.  Only the metrics of the goals that are
+ * set are measured.
+ */
+static struct damos_quota_goal
+damon_lru_sort_goals_status[NR_DAMOS_QUOTA_GOAL_METRICS];
+DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS_STATUS_PARAMS(
+		damon_lru_sort_goals_status);
+
 static struct damos_access_pattern damon_lru_sort_stub_pattern = {
 	/* Find regions having PAGE_SIZE or larger size */
 	.min_sz_region = PAGE_SIZE,
@@ -296,12 +334,17 @@ static int damon_lru_sort_after_aggregation(struct damon_ctx *c)
 {
 	struct damos *s;
 
-	/* update the stats parameter */
+	/* update the stats and the quota status parameters */
 	damon_for_each_scheme(s, c) {
-		if (s->action == DAMOS_LRU_PRIO)
+		if (s->action == DAMOS_LRU_PRIO) {
 			damon_lru_sort_hot_stat = s->stat;
-		else if (s->action == DAMOS_LRU_DEPRIO)
+			hot_effective_quota_sz = s->quota.esz;
+			memcpy(damon_lru_sort_goals_status, s->quota.goals,
+					sizeof(damon_lru_sort_goals_status));
+		} else if (s->action == DAMOS_LRU_DEPRIO) {
 			damon_lru_sort_cold_stat = s->stat;
+			cold_effective_quota_sz = s->quota.esz;
+		}
 	}
 
 	return damon_lru_sort_handle_commit_inputs();
@@ -26,6 +26,22 @@
 	DEFINE_DAMON_MODULES_DAMOS_TIME_QUOTA(quota)			\
 	module_param_named(quota_sz, quota.sz, ulong, 0600);
 
+#define DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS(quota)			\
+	module_param_named(quota_mem_pressure_us,			\
+			quota.goals[DAMOS_QUOTA_SOME_MEM_PSI_US].target_value,	\
+			ulong, 0600);					\
+	module_param_named(quota_free_mem_bp,				\
+			quota.goals[DAMOS_QUOTA_FREE_MEM_BP].target_value,	\
+			ulong, 0600);
+
+#define DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS_STATUS_PARAMS(goals)	\
+	module_param_named(achieved_mem_pressure_us,			\
+			goals[DAMOS_QUOTA_SOME_MEM_PSI_US].current_value,	\
+			ulong, 0400);					\
+	module_param_named(achieved_free_mem_bp,			\
+			goals[DAMOS_QUOTA_FREE_MEM_BP].current_value,	\
+			ulong, 0400);
+
 #define DEFINE_DAMON_MODULES_WMARKS_PARAMS(wmarks)			\
 	module_param_named(wmarks_interval, wmarks.interval, ulong,	\
 			0600);						\
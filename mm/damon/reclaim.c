@@ -64,6 +64,23 @@ static struct damos_quota damon_reclaim_quota = {
 };
 DEFINE_DAMON_MODULES_DAMOS_QUOTAS(damon_reclaim_quota);
 
+/*
+ * Goals for the automatic tuning of DAMON_RECLAIM's quota.
+ *
+ * ``quota_mem_pressure_us`` is the desired total time in microseconds that
+ * some tasks of the system stall on memory, per quota reset interval.
+ * ``quota_free_mem_bp`` is the desired free memory rate of the system in
+ * basis points.  Setting either of those to non-zero makes DAMON_RECLAIM
+ * adjust its effective quota every quota reset interval, so that the measured
+ * metrics converge to the goals.  The quota is increased while all set goals
+ * are not met, and decreased once any of them is exceeded.  Hence, setting the
+ * memory pressure goal makes DAMON_RECLAIM back off as soon as its reclamation
+ * starts causing stalls.  ``quota_ms`` and ``quota_sz`` are still respected as
+ * the upper limits.  Zero for both by default, meaning the auto-tuning is
+ * disabled.
+ */
+DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS(damon_reclaim_quota);
+
 static struct damos_watermarks damon_reclaim_wmarks = {
 	.metric = DAMOS_WMARK_FREE_MEM_RATE,
 	.interval = 5000000,	/* 5 seconds */
@@ -113,6 +130,25 @@ static struct damos_stat damon_reclaim_stat;
 DEFINE_DAMON_MODULES_DAMOS_STATS_PARAMS(damon_reclaim_stat,
 		reclaim_tried_regions, reclaimed_regions, quota_exceeds);
 
+/*
+ * Current effective size quota of DAMON_RECLAIM in bytes.
+ *
+ * The quota that DAMON_RECLAIM actually applied for the last quota reset
+ * interval, after the time quota conversion and the goals-based tuning.
+ */
+static unsigned long effective_quota_sz __read_mostly;
+module_param(effective_quota_sz, ulong, 0400);
+
+/*
+ * Achieved values of the quota goals metrics, which are the
+ * ``achieved_mem_pressure_us`` and ``achieved_free_mem_bp`` parameters.  Only
+ * the metrics of the goals that are set are measured.
+ */
+static struct damos_quota_goal
+damon_reclaim_goals_status[NR_DAMOS_QUOTA_GOAL_METRICS];
+DEFINE_DAMON_MODULES_DAMOS_QUOTA_GOALS_STATUS_PARAMS(
+		damon_reclaim_goals_status);
+
 static struct damon_ctx *ctx;
 static struct damon_target *target;
 
@@ -242,9 +278,13 @@ static int damon_reclaim_after_aggregation(struct damon_ctx *c)
 {
 	struct damos *s;
 
-	/* update the stats parameter */
-	damon_for_each_scheme(s, c)
+	/* update the stats and the quota status parameters */
+	damon_for_each_scheme(s, c) {
 		damon_reclaim_stat = s->stat;
+		effective_quota_sz = s->quota.esz;
+		memcpy(damon_reclaim_goals_status, s->quota.goals,
+				sizeof(damon_reclaim_goals_status));
+	}
 
 	return damon_reclaim_handle_commit_inputs();
 }
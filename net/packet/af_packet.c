@@ -64,6 +64,7 @@
 #include <linux/kmod.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/log2.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -555,16 +556,71 @@ static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
 	prb_del_retire_blk_timer(pkc);
 }
 
-static void prb_setup_retire_blk_timer(struct packet_sock *po)
+static void prb_setup_retire_blk_timer(struct tpacket_kbdq_core *pkc)
 {
-	struct tpacket_kbdq_core *pkc;
-
-	pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
 	timer_setup(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
 		    0);
 	pkc->retire_blk_timer.expires = jiffies;
 }
 
+/* Serializes the filling of a block queue with its retire timer */
+static spinlock_t *prb_queue_lock(struct tpacket_kbdq_core *pkc)
+{
+	if (pkc->percpu)
+		return &pkc->lock;
+	return &pkc->po->sk.sk_receive_queue.lock;
+}
+
+/* The block queue of the current CPU. On the receive path BH is disabled,
+ * other callers only need an estimate.
+ */
+static struct tpacket_kbdq_core *prb_rx_core(const struct packet_sock *po)
+{
+	if (po->rx_ring.prb_bdqc_pcpu)
+		return raw_cpu_ptr(po->rx_ring.prb_bdqc_pcpu);
+	return GET_PBDQC_FROM_RB(&po->rx_ring);
+}
+
+/* Caller holds the rx_queue.lock */
+static void prb_fold_percpu_stats(struct tpacket_kbdq_core __percpu *pcpu,
+				  struct tpacket_stats_v3 *st)
+{
+	struct tpacket_kbdq_core *pkc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pkc = per_cpu_ptr(pcpu, cpu);
+		spin_lock(&pkc->lock);
+		st->tp_packets += pkc->stats.tp_packets;
+		st->tp_freeze_q_cnt += pkc->stats.tp_freeze_q_cnt;
+		memset(&pkc->stats, 0, sizeof(pkc->stats));
+		spin_unlock(&pkc->lock);
+	}
+}
+
+static void prb_shutdown_percpu(struct packet_sock *po,
+				struct tpacket_kbdq_core __percpu *pcpu)
+{
+	struct tpacket_kbdq_core *pkc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pkc = per_cpu_ptr(pcpu, cpu);
+
+		spin_lock_bh(&pkc->lock);
+		pkc->delete_blk_timer = 1;
+		spin_unlock_bh(&pkc->lock);
+
+		prb_del_retire_blk_timer(pkc);
+	}
+
+	spin_lock_bh(&po->sk.sk_receive_queue.lock);
+	prb_fold_percpu_stats(pcpu, &po->stats.stats3);
+	spin_unlock_bh(&po->sk.sk_receive_queue.lock);
+
+	free_percpu(pcpu);
+}
+
 static int prb_calc_retire_blk_tmo(struct packet_sock *po,
 				int blk_size_in_bytes)
 {
@@ -619,6 +675,7 @@ static void init_prb_bdqc(struct packet_sock *po,
 	memset(p1, 0x0, sizeof(*p1));
 
 	p1->knxt_seq_num = 1;
+	p1->po = po;
 	p1->pkbdq = pg_vec;
 	pbd = (struct tpacket_block_desc *)pg_vec[0].buffer;
 	p1->pkblk_start	= pg_vec[0].buffer;
@@ -639,8 +696,43 @@ static void init_prb_bdqc(struct packet_sock *po,
 
 	p1->max_frame_len = p1->kblk_size - BLK_PLUS_PRIV(p1->blk_sizeof_priv);
 	prb_init_ft_ops(p1, req_u);
-	prb_setup_retire_blk_timer(po);
-	prb_open_block(p1, pbd);
+	prb_setup_retire_blk_timer(p1);
+	/* With per-CPU queues, this one only keeps the ring parameters. */
+	if (!(p1->feature_req_word & TP_FT_REQ_PERCPU))
+		prb_open_block(p1, pbd);
+}
+
+/* Splits the blocks set up by init_prb_bdqc() into one queue per CPU */
+static struct tpacket_kbdq_core __percpu *
+init_prb_bdqc_percpu(struct packet_ring_buffer *rb, struct pgv *pg_vec)
+{
+	struct tpacket_kbdq_core *p1 = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_kbdq_core __percpu *pcpu;
+	struct tpacket_kbdq_core *pkc;
+	unsigned int blocks_per_cpu;
+	int cpu;
+
+	pcpu = alloc_percpu(struct tpacket_kbdq_core);
+	if (!pcpu)
+		return NULL;
+
+	blocks_per_cpu = p1->knum_blocks / nr_cpu_ids;
+	atomic64_set(&rb->prb_seq_num, 0);
+
+	for_each_possible_cpu(cpu) {
+		pkc = per_cpu_ptr(pcpu, cpu);
+
+		memcpy(pkc, p1, sizeof(*pkc));
+		pkc->percpu = 1;
+		pkc->pkbdq = &pg_vec[cpu * blocks_per_cpu];
+		pkc->knum_blocks = blocks_per_cpu;
+		spin_lock_init(&pkc->lock);
+		rwlock_init(&pkc->blk_fill_in_prog_lock);
+		prb_setup_retire_blk_timer(pkc);
+		prb_open_block(pkc, GET_PBLOCK_DESC(pkc, 0));
+	}
+
+	return pcpu;
 }
 
 /*  Do NOT update the last_blk_num first.
@@ -678,13 +770,13 @@ static void _prb_refresh_rx_retire_blk_timer(struct tpacket_kbdq_core *pkc)
  */
 static void prb_retire_rx_blk_timer_expired(struct timer_list *t)
 {
-	struct packet_sock *po =
-		from_timer(po, t, rx_ring.prb_bdqc.retire_blk_timer);
-	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	struct tpacket_kbdq_core *pkc = from_timer(pkc, t, retire_blk_timer);
+	struct packet_sock *po = pkc->po;
+	spinlock_t *lock = prb_queue_lock(pkc);
 	unsigned int frozen;
 	struct tpacket_block_desc *pbd;
 
-	spin_lock(&po->sk.sk_receive_queue.lock);
+	spin_lock(lock);
 
 	frozen = prb_queue_frozen(pkc);
 	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
@@ -746,7 +838,7 @@ static void prb_retire_rx_blk_timer_expired(struct timer_list *t)
 	_prb_refresh_rx_retire_blk_timer(pkc);
 
 out:
-	spin_unlock(&po->sk.sk_receive_queue.lock);
+	spin_unlock(lock);
 }
 
 static void prb_flush_block(struct tpacket_kbdq_core *pkc1,
@@ -858,7 +950,11 @@ static void prb_open_block(struct tpacket_kbdq_core *pkc1,
 	 * flexibility of making the priv area sticky
 	 */
 
-	BLOCK_SNUM(pbd1) = pkc1->knxt_seq_num++;
+	if (pkc1->percpu)
+		BLOCK_SNUM(pbd1) =
+			atomic64_inc_return(&pkc1->po->rx_ring.prb_seq_num);
+	else
+		BLOCK_SNUM(pbd1) = pkc1->knxt_seq_num++;
 	BLOCK_NUM_PKTS(pbd1) = 0;
 	BLOCK_LEN(pbd1) = BLK_PLUS_PRIV(pkc1->blk_sizeof_priv);
 
@@ -910,7 +1006,10 @@ static void prb_freeze_queue(struct tpacket_kbdq_core *pkc,
 				  struct packet_sock *po)
 {
 	pkc->reset_pending_on_curr_blk = 1;
-	po->stats.stats3.tp_freeze_q_cnt++;
+	if (pkc->percpu)
+		pkc->stats.tp_freeze_q_cnt++;
+	else
+		po->stats.stats3.tp_freeze_q_cnt++;
 }
 
 #define TOTAL_PKT_LEN_INCL_ALIGN(length) (ALIGN((length), V3_ALIGNMENT))
@@ -982,11 +1081,9 @@ static int prb_queue_frozen(struct tpacket_kbdq_core *pkc)
 	return pkc->reset_pending_on_curr_blk;
 }
 
-static void prb_clear_blk_fill_status(struct packet_ring_buffer *rb)
+static void prb_clear_blk_fill_status(struct tpacket_kbdq_core *pkc)
 	__releases(&pkc->blk_fill_in_prog_lock)
 {
-	struct tpacket_kbdq_core *pkc  = GET_PBDQC_FROM_RB(rb);
-
 	read_unlock(&pkc->blk_fill_in_prog_lock);
 }
 
@@ -1046,17 +1143,16 @@ static void prb_fill_curr_block(char *curr,
 	prb_run_all_ft_ops(pkc, ppd);
 }
 
-/* Assumes caller has the sk->rx_queue.lock */
+/* Assumes caller has the prb_queue_lock() */
 static void *__packet_lookup_frame_in_block(struct packet_sock *po,
+					    struct tpacket_kbdq_core *pkc,
 					    struct sk_buff *skb,
 					    unsigned int len
 					    )
 {
-	struct tpacket_kbdq_core *pkc;
 	struct tpacket_block_desc *pbd;
 	char *curr, *end;
 
-	pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
 	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
 
 	/* Queue is frozen when user space is lagging behind */
@@ -1109,8 +1205,9 @@ static void *__packet_lookup_frame_in_block(struct packet_sock *po,
 }
 
 static void *packet_current_rx_frame(struct packet_sock *po,
-					    struct sk_buff *skb,
-					    int status, unsigned int len)
+				     struct tpacket_kbdq_core *pkc,
+				     struct sk_buff *skb,
+				     int status, unsigned int len)
 {
 	char *curr = NULL;
 	switch (po->tp_version) {
@@ -1120,7 +1217,7 @@ static void *packet_current_rx_frame(struct packet_sock *po,
 					po->rx_ring.head, status);
 		return curr;
 	case TPACKET_V3:
-		return __packet_lookup_frame_in_block(po, skb, len);
+		return __packet_lookup_frame_in_block(po, pkc, skb, len);
 	default:
 		WARN(1, "TPACKET version not supported\n");
 		BUG();
@@ -1128,12 +1225,10 @@ static void *packet_current_rx_frame(struct packet_sock *po,
 	}
 }
 
-static void *prb_lookup_block(const struct packet_sock *po,
-			      const struct packet_ring_buffer *rb,
+static void *prb_lookup_block(const struct tpacket_kbdq_core *pkc,
 			      unsigned int idx,
 			      int status)
 {
-	struct tpacket_kbdq_core *pkc  = GET_PBDQC_FROM_RB(rb);
 	struct tpacket_block_desc *pbd = GET_PBLOCK_DESC(pkc, idx);
 
 	if (status != BLOCK_STATUS(pbd))
@@ -1141,13 +1236,13 @@ static void *prb_lookup_block(const struct packet_sock *po,
 	return pbd;
 }
 
-static int prb_previous_blk_num(struct packet_ring_buffer *rb)
+static int prb_previous_blk_num(const struct tpacket_kbdq_core *pkc)
 {
 	unsigned int prev;
-	if (rb->prb_bdqc.kactive_blk_num)
-		prev = rb->prb_bdqc.kactive_blk_num-1;
+	if (pkc->kactive_blk_num)
+		prev = pkc->kactive_blk_num-1;
 	else
-		prev = rb->prb_bdqc.knum_blocks-1;
+		prev = pkc->knum_blocks-1;
 	return prev;
 }
 
@@ -1156,8 +1251,32 @@ static void *__prb_previous_block(struct packet_sock *po,
 					 struct packet_ring_buffer *rb,
 					 int status)
 {
-	unsigned int previous = prb_previous_blk_num(rb);
-	return prb_lookup_block(po, rb, previous, status);
+	struct tpacket_kbdq_core *pkc;
+	void *pbd = NULL;
+	int cpu;
+
+	if (!rb->prb_bdqc_pcpu) {
+		pkc = GET_PBDQC_FROM_RB(rb);
+		return prb_lookup_block(pkc, prb_previous_blk_num(pkc), status);
+	}
+
+	/* Per-CPU queues only match if all of them do. The other CPUs move
+	 * their queues under their own locks, not the rx_queue.lock, so the
+	 * answer is only an estimate that may be stale by the time it is
+	 * used. That is fine for poll, which is woken up again on the next
+	 * block that gets closed.
+	 */
+	for_each_possible_cpu(cpu) {
+		unsigned int blk;
+
+		pkc = per_cpu_ptr(rb->prb_bdqc_pcpu, cpu);
+		blk = READ_ONCE(pkc->kactive_blk_num);
+		blk = blk ? blk - 1 : pkc->knum_blocks - 1;
+		pbd = GET_PBLOCK_DESC(pkc, blk);
+		if (READ_ONCE(BLOCK_STATUS(pbd)) != status)
+			return NULL;
+	}
+	return pbd;
 }
 
 static void *packet_previous_rx_frame(struct packet_sock *po,
@@ -1259,15 +1378,16 @@ static bool __tpacket_has_room(const struct packet_sock *po, int pow_off)
 
 static bool __tpacket_v3_has_room(const struct packet_sock *po, int pow_off)
 {
+	struct tpacket_kbdq_core *pkc = prb_rx_core(po);
 	int idx, len;
 
-	len = READ_ONCE(po->rx_ring.prb_bdqc.knum_blocks);
-	idx = READ_ONCE(po->rx_ring.prb_bdqc.kactive_blk_num);
+	len = READ_ONCE(pkc->knum_blocks);
+	idx = READ_ONCE(pkc->kactive_blk_num);
 	if (pow_off)
 		idx += len >> pow_off;
 	if (idx >= len)
 		idx -= len;
-	return prb_lookup_block(po, &po->rx_ring, idx, TP_STATUS_KERNEL);
+	return prb_lookup_block(pkc, idx, TP_STATUS_KERNEL);
 }
 
 static int __packet_rcv_has_room(const struct packet_sock *po,
@@ -1838,6 +1958,192 @@ static struct packet_fanout *fanout_release(struct sock *sk)
 	return f;
 }
 
+static void fanout_merge_publish(struct packet_fanout_merge *mr, u32 prod)
+{
+	smp_store_release(&mr->hdr->tp_producer, prod);
+	mr->prod = prod;
+}
+
+static void fanout_merge_timer_expired(struct timer_list *t)
+{
+	struct packet_fanout_merge *mr = from_timer(mr, t, timer);
+	bool wake;
+
+	spin_lock(&mr->lock);
+	/* Packets still come in, they publish the entries whose window
+	 * expired. Check again a window later.
+	 */
+	if (mr->newest != mr->timer_newest) {
+		mr->timer_newest = mr->newest;
+		mod_timer(&mr->timer,
+			  jiffies + nsecs_to_jiffies(mr->window) + 1);
+		spin_unlock(&mr->lock);
+		return;
+	}
+
+	/* Traffic went quiet, nothing older is coming any more. */
+	wake = mr->prod != mr->tail;
+	fanout_merge_publish(mr, mr->tail);
+	spin_unlock(&mr->lock);
+
+	if (wake)
+		mr->sk->sk_data_ready(mr->sk);
+}
+
+static void fanout_merge_append(struct packet_fanout_merge *mr, u64 ts,
+				u64 ino, u64 offset)
+{
+	struct tpacket_merge_entry *e;
+	bool wake = false;
+	u32 i, prod;
+
+	spin_lock(&mr->lock);
+	if (mr->tail - smp_load_acquire(&mr->hdr->tp_consumer) > mr->mask) {
+		WRITE_ONCE(mr->hdr->tp_drops, mr->hdr->tp_drops + 1);
+		goto out;
+	}
+
+	/* Sort in among the entries user space doesn't see yet */
+	for (i = mr->tail; i != mr->prod; i--) {
+		e = &mr->entries[(i - 1) & mr->mask];
+		if (e->tp_ts <= ts)
+			break;
+		mr->entries[i & mr->mask] = *e;
+	}
+	e = &mr->entries[i & mr->mask];
+	e->tp_ts = ts;
+	e->tp_ino = ino;
+	e->tp_offset = offset;
+	mr->tail++;
+
+	if (ts > mr->newest)
+		mr->newest = ts;
+
+	/* Entries older than the newest one by the window are final, and so
+	 * are the oldest ones past the pending limit.
+	 */
+	for (prod = mr->prod; prod != mr->tail; prod++) {
+		if (mr->tail - prod <= PACKET_FANOUT_MERGE_PENDING &&
+		    mr->entries[prod & mr->mask].tp_ts + mr->window > mr->newest)
+			break;
+	}
+	if (prod != mr->prod) {
+		fanout_merge_publish(mr, prod);
+		wake = true;
+	}
+
+	if (mr->prod != mr->tail && !timer_pending(&mr->timer)) {
+		mr->timer_newest = mr->newest;
+		mod_timer(&mr->timer,
+			  jiffies + nsecs_to_jiffies(mr->window) + 1);
+	}
+out:
+	spin_unlock(&mr->lock);
+
+	if (wake)
+		mr->sk->sk_data_ready(mr->sk);
+}
+
+static int fanout_merge_add(struct sock *sk,
+			    const struct tpacket_merge_req *req)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout_merge *mr;
+	int err;
+
+	if (!is_power_of_2(req->tp_entry_nr) ||
+	    req->tp_entry_nr > PACKET_FANOUT_MERGE_MAX)
+		return -EINVAL;
+
+	mr = kzalloc(sizeof(*mr), GFP_KERNEL);
+	if (!mr)
+		return -ENOMEM;
+
+	mr->size = PAGE_ALIGN(sizeof(*mr->hdr) +
+			      (size_t)req->tp_entry_nr * sizeof(*mr->entries));
+	mr->hdr = vmalloc_user(mr->size);
+	if (!mr->hdr) {
+		kfree(mr);
+		return -ENOMEM;
+	}
+
+	mr->hdr->tp_entry_nr = req->tp_entry_nr;
+	mr->entries = (struct tpacket_merge_entry *)(mr->hdr + 1);
+	mr->mask = req->tp_entry_nr - 1;
+	mr->window = req->tp_window_ns;
+	mr->sk = sk;
+	spin_lock_init(&mr->lock);
+	timer_setup(&mr->timer, fanout_merge_timer_expired, 0);
+
+	mutex_lock(&po->pg_vec_lock);
+	mutex_lock(&fanout_mutex);
+	err = -EINVAL;
+	if (!po->fanout)
+		goto out;
+	err = -EBUSY;
+	if (rcu_access_pointer(po->fanout->merge) ||
+	    atomic_read(&po->mapped))
+		goto out;
+
+	po->merge = mr;
+	rcu_assign_pointer(po->fanout->merge, mr);
+	err = 0;
+out:
+	mutex_unlock(&fanout_mutex);
+	mutex_unlock(&po->pg_vec_lock);
+
+	if (err) {
+		vfree(mr->hdr);
+		kfree(mr);
+	}
+	return err;
+}
+
+/* The caller frees the returned merge ring with fanout_merge_free(), after
+ * synchronize_net().
+ */
+static struct packet_fanout_merge *fanout_merge_detach(struct packet_sock *po)
+{
+	struct packet_fanout_merge *mr;
+
+	mutex_lock(&fanout_mutex);
+	mr = po->merge;
+	if (mr) {
+		RCU_INIT_POINTER(po->fanout->merge, NULL);
+		po->merge = NULL;
+	}
+	mutex_unlock(&fanout_mutex);
+
+	return mr;
+}
+
+static void fanout_merge_free(struct packet_fanout_merge *mr)
+{
+	if (!mr)
+		return;
+
+	del_timer_sync(&mr->timer);
+	vfree(mr->hdr);
+	kfree(mr);
+}
+
+/* Offset of a frame in the mmap()ed rx ring, for the merge ring */
+static u64 packet_rx_frame_offset(const struct packet_sock *po,
+				  const struct tpacket_kbdq_core *pkc,
+				  unsigned int slot_id, void *frame)
+{
+	const struct packet_ring_buffer *rb = &po->rx_ring;
+	u64 blk_size = (u64)rb->pg_vec_pages << PAGE_SHIFT;
+	unsigned int blk;
+
+	if (po->tp_version <= TPACKET_V2)
+		return (slot_id / rb->frames_per_block) * blk_size +
+		       (slot_id % rb->frames_per_block) * rb->frame_size;
+
+	blk = (pkc->pkbdq - rb->pg_vec) + pkc->kactive_blk_num;
+	return blk * blk_size + ((char *)frame - pkc->pkblk_start);
+}
+
 static bool packet_extra_vlan_len_allowed(const struct net_device *dev,
 					  struct sk_buff *skb)
 {
@@ -2251,6 +2557,11 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	__u32 ts_status;
 	bool is_drop_n_account = false;
 	unsigned int slot_id = 0;
+	struct tpacket_kbdq_core *pkc = NULL;
+	struct packet_fanout_merge *mr = NULL;
+	struct packet_fanout *f;
+	spinlock_t *rx_lock;
+	u64 merge_off = 0;
 	bool do_vnet = false;
 
 	/* struct tpacket{2,3}_hdr is aligned to a multiple of TPACKET_ALIGNMENT.
@@ -2353,8 +2664,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 			do_vnet = false;
 		}
 	}
-	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_rx_frame(po, skb,
+	rx_lock = &sk->sk_receive_queue.lock;
+	if (po->tp_version == TPACKET_V3) {
+		pkc = prb_rx_core(po);
+		rx_lock = prb_queue_lock(pkc);
+	}
+	spin_lock(rx_lock);
+	h.raw = packet_current_rx_frame(po, pkc, skb,
 					TP_STATUS_KERNEL, (macoff+snaplen));
 	if (!h.raw)
 		goto drop_n_account;
@@ -2366,12 +2682,20 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		__set_bit(slot_id, po->rx_ring.rx_owner_map);
 	}
 
+	f = READ_ONCE(po->fanout);
+	if (f) {
+		mr = rcu_dereference(f->merge);
+		if (mr)
+			merge_off = packet_rx_frame_offset(po, pkc, slot_id,
+							   h.raw);
+	}
+
 	if (do_vnet &&
 	    virtio_net_hdr_from_skb(skb, h.raw + macoff -
 				    sizeof(struct virtio_net_hdr),
 				    vio_le(), true, 0)) {
 		if (po->tp_version == TPACKET_V3)
-			prb_clear_blk_fill_status(&po->rx_ring);
+			prb_clear_blk_fill_status(pkc);
 		goto drop_n_account;
 	}
 
@@ -2387,13 +2711,16 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 			status |= TP_STATUS_LOSING;
 	}
 
-	po->stats.stats1.tp_packets++;
+	if (pkc && pkc->percpu)
+		pkc->stats.tp_packets++;
+	else
+		po->stats.stats1.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
 		skb_clear_delivery_time(copy_skb);
 		__skb_queue_tail(&sk->sk_receive_queue, copy_skb);
 	}
-	spin_unlock(&sk->sk_receive_queue.lock);
+	spin_unlock(rx_lock);
 
 	skb_copy_bits(skb, 0, h.raw + macoff, snaplen);
 
@@ -2486,9 +2813,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		spin_unlock(&sk->sk_receive_queue.lock);
 		sk->sk_data_ready(sk);
 	} else if (po->tp_version == TPACKET_V3) {
-		prb_clear_blk_fill_status(&po->rx_ring);
+		prb_clear_blk_fill_status(pkc);
 	}
 
+	if (mr)
+		fanout_merge_append(mr, timespec64_to_ns(&ts), po->ino,
+				    merge_off);
+
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
 		skb->data = skb_head;
@@ -2502,7 +2833,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	return 0;
 
 drop_n_account:
-	spin_unlock(&sk->sk_receive_queue.lock);
+	spin_unlock(rx_lock);
 	atomic_inc(&po->tp_drops);
 	is_drop_n_account = true;
 
@@ -3111,6 +3442,7 @@ static int packet_sendmsg(struct socket *sock, struct msghdr *msg, size_t len)
 static int packet_release(struct socket *sock)
 {
 	struct sock *sk = sock->sk;
+	struct packet_fanout_merge *mr;
 	struct packet_sock *po;
 	struct packet_fanout *f;
 	struct net *net;
@@ -3152,10 +3484,12 @@ static int packet_release(struct socket *sock)
 	}
 	release_sock(sk);
 
+	mr = fanout_merge_detach(po);
 	f = fanout_release(sk);
 
 	synchronize_net();
 
+	fanout_merge_free(mr);
 	kfree(po->rollover);
 	if (f) {
 		fanout_release_data(f);
@@ -3353,6 +3687,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 	sk->sk_family = PF_PACKET;
 	po->num = proto;
 	po->xmit = dev_queue_xmit;
+	po->ino = sock_i_ino(sk);
 
 	err = packet_alloc_pending(po);
 	if (err)
@@ -3967,6 +4302,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, sockptr_t optval,
 
 		return fanout_set_data(po, optval, optlen);
 	}
+	case PACKET_FANOUT_MERGE:
+	{
+		struct tpacket_merge_req req;
+
+		if (optlen != sizeof(req))
+			return -EINVAL;
+		if (copy_from_sockptr(&req, optval, sizeof(req)))
+			return -EFAULT;
+
+		return fanout_merge_add(sk, &req);
+	}
 	case PACKET_IGNORE_OUTGOING:
 	{
 		int val;
@@ -4040,6 +4386,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		memcpy(&st, &po->stats, sizeof(st));
 		memset(&po->stats, 0, sizeof(po->stats));
+		if (po->rx_ring.prb_bdqc_pcpu)
+			prb_fold_percpu_stats(po->rx_ring.prb_bdqc_pcpu,
+					      &st.stats3);
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 		drops = atomic_xchg(&po->tp_drops, 0);
 
@@ -4248,6 +4597,10 @@ static __poll_t packet_poll(struct file *file, struct socket *sock,
 			TP_STATUS_KERNEL))
 			mask |= EPOLLIN | EPOLLRDNORM;
 	}
+	if (po->merge &&
+	    READ_ONCE(po->merge->hdr->tp_producer) !=
+	    READ_ONCE(po->merge->hdr->tp_consumer))
+		mask |= EPOLLIN | EPOLLRDNORM;
 	packet_rcv_try_clear_pressure(po);
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
 	spin_lock_bh(&sk->sk_write_queue.lock);
@@ -4363,6 +4716,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	struct pgv *pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	unsigned long *rx_owner_map = NULL;
+	struct tpacket_kbdq_core __percpu *prb_pcpu = NULL;
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
@@ -4425,6 +4779,10 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		if (po->tp_version >= TPACKET_V3 && !tx_ring &&
+		    (req_u->req3.tp_feature_req_word & TP_FT_REQ_PERCPU) &&
+		    req->tp_block_nr % nr_cpu_ids)
+			goto out;
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -4436,6 +4794,13 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			/* Block transmit is not supported yet */
 			if (!tx_ring) {
 				init_prb_bdqc(po, rb, pg_vec, req_u);
+				if (req_u->req3.tp_feature_req_word &
+				    TP_FT_REQ_PERCPU) {
+					prb_pcpu = init_prb_bdqc_percpu(rb,
+									pg_vec);
+					if (!prb_pcpu)
+						goto out_free_pg_vec;
+				}
 			} else {
 				struct tpacket_req3 *req3 = &req_u->req3;
 
@@ -4485,6 +4850,8 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		swap(rb->pg_vec, pg_vec);
 		if (po->tp_version <= TPACKET_V2)
 			swap(rb->rx_owner_map, rx_owner_map);
+		else
+			swap(rb->prb_bdqc_pcpu, prb_pcpu);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
@@ -4514,6 +4881,8 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, rb_queue);
 	}
+	if (prb_pcpu)
+		prb_shutdown_percpu(po, prb_pcpu);
 
 out_free_pg_vec:
 	if (pg_vec) {
@@ -4531,7 +4900,7 @@ static int packet_mmap(struct file *file, struct socket *sock,
 	struct packet_sock *po = pkt_sk(sk);
 	unsigned long size, expected_size;
 	struct packet_ring_buffer *rb;
-	unsigned long start;
+	unsigned long start, off;
 	int err = -EINVAL;
 	int i;
 
@@ -4548,6 +4917,8 @@ static int packet_mmap(struct file *file, struct socket *sock,
 						* PAGE_SIZE;
 		}
 	}
+	if (po->merge)
+		expected_size += po->merge->size;
 
 	if (expected_size == 0)
 		goto out;
@@ -4577,6 +4948,19 @@ static int packet_mmap(struct file *file, struct socket *sock,
 		}
 	}
 
+	/* The merge ring goes after the rings */
+	if (po->merge) {
+		void *kaddr = po->merge->hdr;
+
+		for (off = 0; off < po->merge->size; off += PAGE_SIZE) {
+			err = vm_insert_page(vma, start,
+					     vmalloc_to_page(kaddr + off));
+			if (unlikely(err))
+				goto out;
+			start += PAGE_SIZE;
+		}
+	}
+
 	atomic_inc(&po->mapped);
 	vma->vm_ops = &packet_mmap_ops;
 	err = 0;
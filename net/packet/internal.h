@@ -20,6 +20,7 @@ struct tpacket_kbdq_core {
 	unsigned int	hdrlen;
 	unsigned char	reset_pending_on_curr_blk;
 	unsigned char   delete_blk_timer;
+	unsigned char	percpu;
 	unsigned short	kactive_blk_num;
 	unsigned short	blk_sizeof_priv;
 
@@ -41,6 +42,14 @@ struct tpacket_kbdq_core {
 
 	rwlock_t	blk_fill_in_prog_lock;
 
+	struct packet_sock *po;
+
+	/* A per-CPU queue is filled under its own lock and counts its own
+	 * packets, instead of using the ones of the socket.
+	 */
+	spinlock_t	lock;
+	struct tpacket_stats_v3 stats;
+
 	/* Default is set to 8ms */
 #define DEFAULT_PRB_RETIRE_TOV	(8)
 
@@ -70,6 +79,10 @@ struct packet_ring_buffer {
 
 	unsigned int __percpu	*pending_refcnt;
 
+	/* TPACKET_V3 per-CPU block queues and their common block sequence */
+	struct tpacket_kbdq_core __percpu *prb_bdqc_pcpu;
+	atomic64_t		prb_seq_num;
+
 	union {
 		unsigned long			*rx_owner_map;
 		struct tpacket_kbdq_core	prb_bdqc;
@@ -78,6 +91,29 @@ struct packet_ring_buffer {
 
 extern struct mutex fanout_mutex;
 #define PACKET_FANOUT_MAX	(1 << 16)
+#define PACKET_FANOUT_MERGE_MAX	(1 << 24)
+#define PACKET_FANOUT_MERGE_PENDING	512
+
+/* Timestamp ordered index of the packets of a fanout group, owned by the
+ * socket that set it up. Entries from prod to tail are still sorted in, at
+ * most PACKET_FANOUT_MERGE_PENDING of them, which bounds the work done under
+ * the lock for each packet. timer_newest is the newest timestamp when the
+ * timer last ran or was armed.
+ */
+struct packet_fanout_merge {
+	spinlock_t		lock;
+	struct tpacket_merge_hdr *hdr;
+	struct tpacket_merge_entry *entries;
+	u32			mask;
+	u32			prod;
+	u32			tail;
+	u64			window;
+	u64			newest;
+	u64			timer_newest;
+	size_t			size;
+	struct sock		*sk;
+	struct timer_list	timer;
+};
 
 struct packet_fanout {
 	possible_net_t		net;
@@ -93,6 +129,7 @@ struct packet_fanout {
 	struct list_head	list;
 	spinlock_t		lock;
 	refcount_t		sk_ref;
+	struct packet_fanout_merge __rcu *merge;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 	struct sock	__rcu	*arr[];
 };
@@ -126,6 +163,8 @@ struct packet_sock {
 	int			ifindex;	/* bound device		*/
 	__be16			num;
 	struct packet_rollover	*rollover;
+	struct packet_fanout_merge *merge;
+	unsigned long		ino;	/* of the socket, for merge rings */
 	struct packet_mclist	*mclist;
 	atomic_t		mapped;
 	enum tpacket_versions	tp_version;
@@ -31,6 +31,16 @@
 #include "xsk.h"
 
 #define TX_BATCH_SIZE 32
+/* Longest descriptor chain a packet is split into or built from in copy
+ * mode, so that it fits an skb with a frag per descriptor after the first.
+ */
+#define XSK_MAX_DESCS (MAX_SKB_FRAGS + 1)
+
+/* Umem addresses of the descriptors a multi-buffer skb was built from */
+struct xsk_tx_addrs {
+	u32 nr;
+	u64 addrs[];
+};
 
 static DEFINE_PER_CPU(struct list_head, xskmap_flush_list);
 
@@ -39,7 +49,10 @@ void xsk_set_rx_need_wakeup(struct xsk_buff_pool *pool)
 	if (pool->cached_need_wakeup & XDP_WAKEUP_RX)
 		return;
 
-	pool->fq->ring->flags |= XDP_RING_NEED_WAKEUP;
+	if (unlikely(pool->share))
+		xp_shared_set_rx_need_wakeup(pool, true);
+	else
+		pool->fq->ring->flags |= XDP_RING_NEED_WAKEUP;
 	pool->cached_need_wakeup |= XDP_WAKEUP_RX;
 }
 EXPORT_SYMBOL(xsk_set_rx_need_wakeup);
@@ -66,7 +79,10 @@ void xsk_clear_rx_need_wakeup(struct xsk_buff_pool *pool)
 	if (!(pool->cached_need_wakeup & XDP_WAKEUP_RX))
 		return;
 
-	pool->fq->ring->flags &= ~XDP_RING_NEED_WAKEUP;
+	if (unlikely(pool->share))
+		xp_shared_set_rx_need_wakeup(pool, false);
+	else
+		pool->fq->ring->flags &= ~XDP_RING_NEED_WAKEUP;
 	pool->cached_need_wakeup &= ~XDP_WAKEUP_RX;
 }
 EXPORT_SYMBOL(xsk_clear_rx_need_wakeup);
@@ -134,14 +150,15 @@ int xsk_reg_pool_at_qid(struct net_device *dev, struct xsk_buff_pool *pool,
 	return 0;
 }
 
-static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
+static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
+			u32 flags)
 {
 	struct xdp_buff_xsk *xskb = container_of(xdp, struct xdp_buff_xsk, xdp);
 	u64 addr;
 	int err;
 
 	addr = xp_get_handle(xskb);
-	err = xskq_prod_reserve_desc(xs->rx, addr, len);
+	err = xskq_prod_reserve_desc(xs->rx, addr, len, flags);
 	if (err) {
 		xs->rx_queue_full++;
 		return err;
@@ -151,6 +168,77 @@ static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
 	return 0;
 }
 
+static int xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
+{
+	struct xdp_buff_xsk *xskb = container_of(xdp, struct xdp_buff_xsk, xdp);
+	struct xdp_buff_xsk *pos, *tmp;
+	struct list_head *xskb_list;
+	u32 nr_descs;
+
+	if (likely(!xdp_buff_has_frags(xdp)))
+		return __xsk_rcv_zc(xs, xdp, len, 0);
+
+	if (!xs->sg) {
+		xs->rx_dropped++;
+		return -ENOSPC;
+	}
+
+	/* The packet goes to the ring whole or not at all. */
+	nr_descs = xdp_get_shared_info_from_buff(xdp)->nr_frags + 1;
+	if (xskq_prod_nb_free(xs->rx, nr_descs) < nr_descs) {
+		xs->rx_queue_full++;
+		return -ENOBUFS;
+	}
+
+	__xsk_rcv_zc(xs, xdp, len, XDP_PKT_CONTD);
+
+	xskb_list = &xskb->pool->xskb_list;
+	list_for_each_entry_safe(pos, tmp, xskb_list, xskb_list_node) {
+		list_del_init(&pos->xskb_list_node);
+		len = pos->xdp.data_end - pos->xdp.data;
+		__xsk_rcv_zc(xs, &pos->xdp, len,
+			     list_empty(xskb_list) ? 0 : XDP_PKT_CONTD);
+	}
+	xdp_buff_clear_frags_flag(xdp);
+	return 0;
+}
+
+/* Copies @len bytes at offset @off of the frame in @from, which may span its
+ * linear part and frags, to @to.
+ */
+static void xsk_copy_xdp_range(void *to, struct xdp_buff *from, u32 off,
+			       u32 len)
+{
+	u32 linear = from->data_end - from->data;
+	struct skb_shared_info *sinfo;
+	u32 size, copy, i;
+
+	if (off < linear) {
+		copy = min(len, linear - off);
+		memcpy(to, from->data + off, copy);
+		to += copy;
+		len -= copy;
+		off = 0;
+	} else {
+		off -= linear;
+	}
+
+	sinfo = xdp_get_shared_info_from_buff(from);
+	for (i = 0; len && i < sinfo->nr_frags; i++) {
+		size = skb_frag_size(&sinfo->frags[i]);
+		if (off >= size) {
+			off -= size;
+			continue;
+		}
+
+		copy = min(len, size - off);
+		memcpy(to, skb_frag_address(&sinfo->frags[i]) + off, copy);
+		to += copy;
+		len -= copy;
+		off = 0;
+	}
+}
+
 static void xsk_copy_xdp(struct xdp_buff *to, struct xdp_buff *from, u32 len)
 {
 	void *from_buf, *to_buf;
@@ -166,7 +254,55 @@ static void xsk_copy_xdp(struct xdp_buff *to, struct xdp_buff *from, u32 len)
 		to_buf = to->data - metalen;
 	}
 
-	memcpy(to_buf, from_buf, len + metalen);
+	if (likely(!xdp_buff_has_frags(from))) {
+		memcpy(to_buf, from_buf, len + metalen);
+		return;
+	}
+
+	memcpy(to_buf, from_buf, metalen);
+	xsk_copy_xdp_range(to->data, from, 0, len);
+}
+
+/* Splits a frame larger than a umem buffer over a descriptor chain. */
+static int __xsk_rcv_mb(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
+{
+	u32 frame_size = xsk_pool_get_rx_frame_size(xs->pool);
+	struct xdp_buff *bufs[XSK_MAX_DESCS];
+	u32 nr_descs, off, copy, i;
+
+	nr_descs = DIV_ROUND_UP(len, frame_size);
+	if (!xs->sg || nr_descs > XSK_MAX_DESCS) {
+		xs->rx_dropped++;
+		return -ENOSPC;
+	}
+
+	/* The packet goes to the ring whole or not at all. */
+	if (xskq_prod_nb_free(xs->rx, nr_descs) < nr_descs) {
+		xs->rx_queue_full++;
+		return -ENOBUFS;
+	}
+
+	for (i = 0; i < nr_descs; i++) {
+		bufs[i] = xsk_buff_alloc(xs->pool);
+		if (!bufs[i]) {
+			while (i--)
+				xsk_buff_free(bufs[i]);
+			xs->rx_dropped++;
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0, off = 0; i < nr_descs; i++, off += copy) {
+		copy = min(len - off, frame_size);
+		if (!i)
+			xsk_copy_xdp(bufs[i], xdp, copy);
+		else
+			xsk_copy_xdp_range(bufs[i]->data, xdp, off, copy);
+
+		__xsk_rcv_zc(xs, bufs[i], copy,
+			     i == nr_descs - 1 ? 0 : XDP_PKT_CONTD);
+	}
+	return 0;
 }
 
 static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp)
@@ -175,11 +311,9 @@ static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp)
 	int err;
 	u32 len;
 
-	len = xdp->data_end - xdp->data;
-	if (len > xsk_pool_get_rx_frame_size(xs->pool)) {
-		xs->rx_dropped++;
-		return -ENOSPC;
-	}
+	len = xdp_get_buff_len(xdp);
+	if (len > xsk_pool_get_rx_frame_size(xs->pool))
+		return __xsk_rcv_mb(xs, xdp, len);
 
 	xsk_xdp = xsk_buff_alloc(xs->pool);
 	if (!xsk_xdp) {
@@ -188,7 +322,7 @@ static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp)
 	}
 
 	xsk_copy_xdp(xsk_xdp, xdp, len);
-	err = __xsk_rcv_zc(xs, xsk_xdp, len);
+	err = __xsk_rcv_zc(xs, xsk_xdp, len, 0);
 	if (err) {
 		xsk_buff_free(xsk_xdp);
 		return err;
@@ -229,7 +363,9 @@ static int xsk_rcv_check(struct xdp_sock *xs, struct xdp_buff *xdp)
 static void xsk_flush(struct xdp_sock *xs)
 {
 	xskq_prod_submit(xs->rx);
-	__xskq_cons_release(xs->pool->fq);
+	/* A shared fill ring is released when the pool refills from it. */
+	if (likely(!xs->pool->share))
+		__xskq_cons_release(xs->pool->fq);
 	sock_def_readable(&xs->sk);
 }
 
@@ -258,7 +394,7 @@ static int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp)
 
 	if (xdp->rxq->mem.type == MEM_TYPE_XSK_BUFF_POOL) {
 		len = xdp->data_end - xdp->data;
-		return __xsk_rcv_zc(xs, xdp, len);
+		return xsk_rcv_zc(xs, xdp, len);
 	}
 
 	err = __xsk_rcv(xs, xdp);
@@ -295,6 +431,11 @@ void __xsk_map_flush(void)
 
 void xsk_tx_completed(struct xsk_buff_pool *pool, u32 nb_entries)
 {
+	if (unlikely(pool->share)) {
+		xp_shared_tx_completed(pool, nb_entries);
+		return;
+	}
+
 	xskq_prod_submit_n(pool->cq, nb_entries);
 }
 EXPORT_SYMBOL(xsk_tx_completed);
@@ -313,13 +454,28 @@ void xsk_tx_release(struct xsk_buff_pool *pool)
 }
 EXPORT_SYMBOL(xsk_tx_release);
 
+static bool xsk_tx_peek_sock_desc(struct xdp_sock *xs, struct xdp_desc *desc,
+				  struct xsk_buff_pool *pool)
+{
+	while (xskq_cons_peek_desc(xs->tx, desc, pool)) {
+		/* Only sockets bound with XDP_USE_SG may chain descriptors */
+		if (likely(xs->sg || !xp_mb_desc(desc)))
+			return true;
+
+		xs->tx->invalid_descs++;
+		xskq_cons_release(xs->tx);
+	}
+
+	return false;
+}
+
 bool xsk_tx_peek_desc(struct xsk_buff_pool *pool, struct xdp_desc *desc)
 {
 	struct xdp_sock *xs;
 
 	rcu_read_lock();
 	list_for_each_entry_rcu(xs, &pool->xsk_tx_list, tx_list) {
-		if (!xskq_cons_peek_desc(xs->tx, desc, pool)) {
+		if (!xsk_tx_peek_sock_desc(xs, desc, pool)) {
 			xs->tx->queue_empty_descs++;
 			continue;
 		}
@@ -329,8 +485,13 @@ bool xsk_tx_peek_desc(struct xsk_buff_pool *pool, struct xdp_desc *desc)
 		 * if there is space in it. This avoids having to implement
 		 * any buffering in the Tx path.
 		 */
-		if (xskq_prod_reserve_addr(pool->cq, desc->addr))
+		if (unlikely(pool->share)) {
+			if (!xp_shared_cq_reserve(pool, 1))
+				goto out;
+			xp_shared_tx_queue(pool, desc, 1);
+		} else if (xskq_prod_reserve_addr(pool->cq, desc->addr)) {
 			goto out;
+		}
 
 		xskq_cons_release(xs->tx);
 		rcu_read_unlock();
@@ -358,6 +519,7 @@ static u32 xsk_tx_peek_release_fallback(struct xsk_buff_pool *pool, u32 max_entr
 u32 xsk_tx_peek_release_desc_batch(struct xsk_buff_pool *pool, u32 nb_pkts)
 {
 	struct xdp_sock *xs;
+	u32 max_segs, max_pkts;
 
 	rcu_read_lock();
 	if (!list_is_singular(&pool->xsk_tx_list)) {
@@ -380,18 +542,31 @@ u32 xsk_tx_peek_release_desc_batch(struct xsk_buff_pool *pool, u32 nb_pkts)
 	 * packets. This avoids having to implement any buffering in
 	 * the Tx path.
 	 */
-	nb_pkts = xskq_prod_nb_free(pool->cq, nb_pkts);
+	if (unlikely(pool->share)) {
+		max_pkts = xp_shared_cq_reserve(pool, nb_pkts);
+		nb_pkts = max_pkts;
+	} else {
+		nb_pkts = xskq_prod_nb_free(pool->cq, nb_pkts);
+	}
 	if (!nb_pkts)
 		goto out;
 
-	nb_pkts = xskq_cons_read_desc_batch(xs->tx, pool, nb_pkts);
+	max_segs = xs->sg ? pool->netdev->xdp_zc_max_segs : 1;
+	nb_pkts = xskq_cons_read_desc_batch(xs->tx, pool, nb_pkts, max_segs);
+	if (unlikely(pool->share)) {
+		/* Slots of a shared ring are reserved up front. */
+		if (nb_pkts < max_pkts)
+			xp_shared_cq_cancel(pool, max_pkts - nb_pkts);
+		xp_shared_tx_queue(pool, pool->tx_descs, nb_pkts);
+	}
 	if (!nb_pkts) {
 		xs->tx->queue_empty_descs++;
 		goto out;
 	}
 
 	__xskq_cons_release(xs->tx);
-	xskq_prod_write_addr_batch(pool->cq, pool->tx_descs, nb_pkts);
+	if (likely(!pool->share))
+		xskq_prod_write_addr_batch(pool->cq, pool->tx_descs, nb_pkts);
 	xs->sk.sk_write_space(&xs->sk);
 
 out:
@@ -407,28 +582,51 @@ static int xsk_wakeup(struct xdp_sock *xs, u8 flags)
 	return dev->netdev_ops->ndo_xsk_wakeup(dev, xs->queue_id, flags);
 }
 
+/* The driver frees the skbs of a batch one at a time, in its Tx clean-up,
+ * so their completions cannot be submitted together without holding them
+ * back. They are not written to the ring at reserve time either: an skb
+ * built on IFF_TX_SKB_NO_LINEAR devices references the umem pages, which
+ * must not be handed back to user-space before the skb is freed.
+ */
 static void xsk_destruct_skb(struct sk_buff *skb)
 {
 	u64 addr = (u64)(long)skb_shinfo(skb)->destructor_arg;
 	struct xdp_sock *xs = xdp_sk(skb->sk);
 	unsigned long flags;
 
-	spin_lock_irqsave(&xs->pool->cq_lock, flags);
+	spin_lock_irqsave(xp_cq_lock(xs->pool), flags);
 	xskq_prod_submit_addr(xs->pool->cq, addr);
-	spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
+	spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+
+	sock_wfree(skb);
+}
+
+static void xsk_destruct_skb_mb(struct sk_buff *skb)
+{
+	struct xsk_tx_addrs *txa = skb_shinfo(skb)->destructor_arg;
+	struct xdp_sock *xs = xdp_sk(skb->sk);
+	unsigned long flags;
+	u32 i;
 
+	spin_lock_irqsave(xp_cq_lock(xs->pool), flags);
+	for (i = 0; i < txa->nr; i++)
+		xskq_prod_submit_addr(xs->pool->cq, txa->addrs[i]);
+	spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+
+	kfree(txa);
 	sock_wfree(skb);
 }
 
 static struct sk_buff *xsk_build_skb_zerocopy(struct xdp_sock *xs,
-					      struct xdp_desc *desc)
+					      struct xdp_desc *descs,
+					      u32 nr_descs)
 {
 	struct xsk_buff_pool *pool = xs->pool;
-	u32 hr, len, ts, offset, copy, copied;
+	u32 hr, len, ts, offset, copy, copied, d;
 	struct sk_buff *skb;
 	struct page *page;
 	void *buffer;
-	int err, i;
+	int err, i = 0;
 	u64 addr;
 
 	hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(xs->dev->needed_headroom));
@@ -439,85 +637,211 @@ static struct sk_buff *xsk_build_skb_zerocopy(struct xdp_sock *xs,
 
 	skb_reserve(skb, hr);
 
-	addr = desc->addr;
-	len = desc->len;
-	ts = pool->unaligned ? len : pool->chunk_size;
+	for (d = 0; d < nr_descs; d++) {
+		addr = descs[d].addr;
+		len = descs[d].len;
+		ts = pool->unaligned ? len : pool->chunk_size;
 
-	buffer = xsk_buff_raw_get_data(pool, addr);
-	offset = offset_in_page(buffer);
-	addr = buffer - pool->addrs;
+		buffer = xsk_buff_raw_get_data(pool, addr);
+		offset = offset_in_page(buffer);
+		addr = buffer - pool->addrs;
 
-	for (copied = 0, i = 0; copied < len; i++) {
-		page = pool->umem->pgs[addr >> PAGE_SHIFT];
-		get_page(page);
+		if (i + DIV_ROUND_UP(offset + len, PAGE_SIZE) > MAX_SKB_FRAGS) {
+			kfree_skb(skb);
+			return ERR_PTR(-EOVERFLOW);
+		}
 
-		copy = min_t(u32, PAGE_SIZE - offset, len - copied);
-		skb_fill_page_desc(skb, i, page, offset, copy);
+		for (copied = 0; copied < len; i++) {
+			page = pool->umem->pgs[addr >> PAGE_SHIFT];
+			get_page(page);
 
-		copied += copy;
-		addr += copy;
-		offset = 0;
-	}
+			copy = min_t(u32, PAGE_SIZE - offset, len - copied);
+			skb_fill_page_desc(skb, i, page, offset, copy);
 
-	skb->len += len;
-	skb->data_len += len;
-	skb->truesize += ts;
+			copied += copy;
+			addr += copy;
+			offset = 0;
+		}
 
-	refcount_add(ts, &xs->sk.sk_wmem_alloc);
+		skb->len += len;
+		skb->data_len += len;
+		skb->truesize += ts;
+
+		refcount_add(ts, &xs->sk.sk_wmem_alloc);
+	}
 
 	return skb;
 }
 
 static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
-				     struct xdp_desc *desc)
+				     struct xdp_desc *descs, u32 nr_descs)
 {
 	struct net_device *dev = xs->dev;
+	struct xsk_tx_addrs *txa = NULL;
 	struct sk_buff *skb;
+	u32 i;
+
+	if (nr_descs > 1) {
+		txa = kmalloc(struct_size(txa, addrs, nr_descs), GFP_KERNEL);
+		if (unlikely(!txa))
+			return ERR_PTR(-ENOMEM);
+	}
 
 	if (dev->priv_flags & IFF_TX_SKB_NO_LINEAR) {
-		skb = xsk_build_skb_zerocopy(xs, desc);
-		if (IS_ERR(skb))
+		skb = xsk_build_skb_zerocopy(xs, descs, nr_descs);
+		if (IS_ERR(skb)) {
+			kfree(txa);
 			return skb;
+		}
 	} else {
-		u32 hr, tr, len;
+		u32 hr, tr, len, data_len, off;
 		void *buffer;
 		int err;
 
 		hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(dev->needed_headroom));
 		tr = dev->needed_tailroom;
-		len = desc->len;
+		len = descs[0].len;
+
+		/* The descriptors after the first one go to page frags. */
+		for (i = 1, data_len = 0; i < nr_descs; i++)
+			data_len += descs[i].len;
 
-		skb = sock_alloc_send_skb(&xs->sk, hr + len + tr, 1, &err);
-		if (unlikely(!skb))
+		skb = sock_alloc_send_pskb(&xs->sk, hr + len + tr, data_len, 1,
+					   &err, 0);
+		if (unlikely(!skb)) {
+			kfree(txa);
 			return ERR_PTR(err);
+		}
 
 		skb_reserve(skb, hr);
 		skb_put(skb, len);
-
-		buffer = xsk_buff_raw_get_data(xs->pool, desc->addr);
-		err = skb_store_bits(skb, 0, buffer, len);
-		if (unlikely(err)) {
-			kfree_skb(skb);
-			return ERR_PTR(err);
+		skb->data_len = data_len;
+		skb->len += data_len;
+
+		for (i = 0, off = 0; i < nr_descs; off += descs[i++].len) {
+			buffer = xsk_buff_raw_get_data(xs->pool, descs[i].addr);
+			err = skb_store_bits(skb, off, buffer, descs[i].len);
+			if (unlikely(err)) {
+				kfree_skb(skb);
+				kfree(txa);
+				return ERR_PTR(err);
+			}
 		}
 	}
 
 	skb->dev = dev;
 	skb->priority = xs->sk.sk_priority;
 	skb->mark = xs->sk.sk_mark;
-	skb_shinfo(skb)->destructor_arg = (void *)(long)desc->addr;
-	skb->destructor = xsk_destruct_skb;
+	if (likely(!txa)) {
+		skb_shinfo(skb)->destructor_arg = (void *)(long)descs[0].addr;
+		skb->destructor = xsk_destruct_skb;
+	} else {
+		txa->nr = nr_descs;
+		for (i = 0; i < nr_descs; i++)
+			txa->addrs[i] = descs[i].addr;
+		skb_shinfo(skb)->destructor_arg = txa;
+		skb->destructor = xsk_destruct_skb_mb;
+	}
 
 	return skb;
 }
 
+/* Frees an skb that was not sent, without completing its descriptors. */
+static void xsk_consume_unsent_skb(struct sk_buff *skb, u32 nr_descs)
+{
+	if (nr_descs > 1)
+		kfree(skb_shinfo(skb)->destructor_arg);
+	skb->destructor = sock_wfree;
+	/* Free skb without triggering the perf drop trace */
+	consume_skb(skb);
+}
+
+/* Sends a batch of skbs on the socket's queue under one Tx lock, telling the
+ * driver more are coming so it can defer its doorbell to the last one. Does
+ * what __dev_direct_xmit() does for each skb. Returns the number of leading
+ * skbs that were consumed, sent or dropped. The others are still the
+ * caller's.
+ */
+static u32 xsk_direct_xmit_batch(struct xdp_sock *xs, struct sk_buff **skbs,
+				 u32 nr_skbs, int *err)
+{
+	struct net_device *dev = xs->dev;
+	struct netdev_queue *txq;
+	struct sk_buff *skb;
+	bool again = false, more;
+	u32 i, nr_valid;
+	int ret;
+
+	if (unlikely(!netif_running(dev) || !netif_carrier_ok(dev))) {
+		for (i = 0; i < nr_skbs; i++) {
+			dev_core_stats_tx_dropped_inc(dev);
+			kfree_skb(skbs[i]);
+		}
+		*err = -EBUSY;
+		return nr_skbs;
+	}
+
+	for (nr_valid = 0; nr_valid < nr_skbs; nr_valid++) {
+		skb = validate_xmit_skb_list(skbs[nr_valid], dev, &again);
+		if (unlikely(skb != skbs[nr_valid])) {
+			dev_core_stats_tx_dropped_inc(dev);
+			kfree_skb_list(skb);
+			*err = -EBUSY;
+			break;
+		}
+		skb_set_queue_mapping(skb, xs->queue_id);
+	}
+
+	txq = netdev_get_tx_queue(dev, xs->queue_id);
+
+	local_bh_disable();
+	dev_xmit_recursion_inc();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	for (i = 0; i < nr_valid; i++) {
+		if (netif_xmit_frozen_or_drv_stopped(txq))
+			break;
+
+		more = i + 1 < nr_valid;
+		ret = netdev_start_xmit(skbs[i], dev, txq, more);
+		/* The skb before this one left the doorbell to it. Offer it
+		 * again as the last one, so the driver flushes what it has
+		 * queued rather than wait for an skb that will not come.
+		 * Drivers that stop their queue ring it on their own, which
+		 * covers the frozen queue check above.
+		 */
+		if (unlikely(ret == NETDEV_TX_BUSY) && i && more)
+			ret = netdev_start_xmit(skbs[i], dev, txq, false);
+		if (!dev_xmit_complete(ret))
+			break;
+		/* Ignore NET_XMIT_CN as packet might have been sent */
+		if (ret == NET_XMIT_DROP)
+			*err = -EBUSY;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	dev_xmit_recursion_dec();
+	local_bh_enable();
+
+	if (likely(nr_valid == nr_skbs))
+		return i;
+
+	/* The skb after the valid ones was dropped, completing its
+	 * descriptors, so the descriptors before it can't be handed back to
+	 * the ring either.
+	 */
+	for (; i < nr_valid; i++) {
+		dev_core_stats_tx_dropped_inc(dev);
+		kfree_skb(skbs[i]);
+	}
+	return nr_valid + 1;
+}
+
 static int xsk_generic_xmit(struct sock *sk)
 {
 	struct xdp_sock *xs = xdp_sk(sk);
-	u32 max_batch = TX_BATCH_SIZE;
-	bool sent_frame = false;
-	struct xdp_desc desc;
-	struct sk_buff *skb;
+	u32 nr_descs[TX_BATCH_SIZE], pkt_cons[TX_BATCH_SIZE];
+	struct xdp_desc descs[XSK_MAX_DESCS];
+	struct sk_buff *skbs[TX_BATCH_SIZE];
+	u32 nr_skbs = 0, sent, n, i;
 	unsigned long flags;
 	int err = 0;
 
@@ -532,10 +856,16 @@ static int xsk_generic_xmit(struct sock *sk)
 	if (xs->queue_id >= xs->dev->real_num_tx_queues)
 		goto out;
 
-	while (xskq_cons_peek_desc(xs->tx, &desc, xs->pool)) {
-		if (max_batch-- == 0) {
-			err = -EAGAIN;
-			goto out;
+	/* Build a batch of skbs before handing them to the driver. A packet
+	 * is only consumed once all its descriptors are in the ring, and the
+	 * ring only sees them consumed once the batch is sent.
+	 */
+	while (nr_skbs < TX_BATCH_SIZE) {
+		n = xskq_cons_peek_pkt(xs->tx, descs,
+				       xs->sg ? XSK_MAX_DESCS : 1, xs->pool);
+		if (!n) {
+			xs->tx->queue_empty_descs++;
+			break;
 		}
 
 		/* This is the backpressure mechanism for the Tx path.
@@ -543,53 +873,59 @@ static int xsk_generic_xmit(struct sock *sk)
 		 * if there is space in it. This avoids having to implement
 		 * any buffering in the Tx path.
 		 */
-		spin_lock_irqsave(&xs->pool->cq_lock, flags);
-		if (xskq_prod_reserve(xs->pool->cq)) {
-			spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-			goto out;
+		spin_lock_irqsave(xp_cq_lock(xs->pool), flags);
+		if (xskq_prod_reserve_n(xs->pool->cq, n)) {
+			spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+			break;
 		}
-		spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-
-		skb = xsk_build_skb(xs, &desc);
-		if (IS_ERR(skb)) {
-			err = PTR_ERR(skb);
-			spin_lock_irqsave(&xs->pool->cq_lock, flags);
-			xskq_prod_cancel(xs->pool->cq);
-			spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-			goto out;
+		spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+
+		skbs[nr_skbs] = xsk_build_skb(xs, descs, n);
+		if (IS_ERR(skbs[nr_skbs])) {
+			err = PTR_ERR(skbs[nr_skbs]);
+			spin_lock_irqsave(xp_cq_lock(xs->pool), flags);
+			xskq_prod_cancel_n(xs->pool->cq, n);
+			spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+			if (err == -EOVERFLOW) {
+				/* Too many frags for an skb, drop the packet */
+				xs->tx->invalid_descs += n;
+				xskq_cons_release_n(xs->tx, n);
+				err = 0;
+				continue;
+			}
+			break;
 		}
 
-		err = __dev_direct_xmit(skb, xs->queue_id);
-		if  (err == NETDEV_TX_BUSY) {
-			/* Tell user-space to retry the send */
-			skb->destructor = sock_wfree;
-			spin_lock_irqsave(&xs->pool->cq_lock, flags);
-			xskq_prod_cancel(xs->pool->cq);
-			spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-			/* Free skb without triggering the perf drop trace */
-			consume_skb(skb);
-			err = -EAGAIN;
-			goto out;
-		}
+		nr_descs[nr_skbs] = n;
+		pkt_cons[nr_skbs++] = xs->tx->cached_cons;
+		xskq_cons_release_n(xs->tx, n);
+	}
 
-		xskq_cons_release(xs->tx);
-		/* Ignore NET_XMIT_CN as packet might have been sent */
-		if (err == NET_XMIT_DROP) {
-			/* SKB completed but not sent */
-			err = -EBUSY;
-			goto out;
-		}
+	if (!nr_skbs)
+		goto release;
 
-		sent_frame = true;
+	sent = xsk_direct_xmit_batch(xs, skbs, nr_skbs, &err);
+	if (unlikely(sent < nr_skbs)) {
+		/* Tell user-space to retry the send of the rest */
+		for (i = sent, n = 0; i < nr_skbs; i++) {
+			n += nr_descs[i];
+			xsk_consume_unsent_skb(skbs[i], nr_descs[i]);
+		}
+		spin_lock_irqsave(xp_cq_lock(xs->pool), flags);
+		xskq_prod_cancel_n(xs->pool->cq, n);
+		spin_unlock_irqrestore(xp_cq_lock(xs->pool), flags);
+		xs->tx->cached_cons = pkt_cons[sent];
+		err = -EAGAIN;
+	} else if (!err && nr_skbs == TX_BATCH_SIZE &&
+		   xskq_cons_nb_entries(xs->tx, 1)) {
+		err = -EAGAIN;
 	}
 
-	xs->tx->queue_empty_descs++;
-
+release:
+	__xskq_cons_release(xs->tx);
+	if (nr_skbs && xsk_tx_writeable(xs))
+		sk->sk_write_space(sk);
 out:
-	if (sent_frame)
-		if (xsk_tx_writeable(xs))
-			sk->sk_write_space(sk);
-
 	mutex_unlock(&xs->mutex);
 	return err;
 }
@@ -889,7 +1225,7 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	flags = sxdp->sxdp_flags;
 	if (flags & ~(XDP_SHARED_UMEM | XDP_COPY | XDP_ZEROCOPY |
-		      XDP_USE_NEED_WAKEUP))
+		      XDP_USE_NEED_WAKEUP | XDP_USE_SG | XDP_SHARE_RINGS))
 		return -EINVAL;
 
 	rtnl_lock();
@@ -917,7 +1253,8 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 		struct socket *sock;
 
 		if ((flags & XDP_COPY) || (flags & XDP_ZEROCOPY) ||
-		    (flags & XDP_USE_NEED_WAKEUP)) {
+		    (flags & XDP_USE_NEED_WAKEUP) ||
+		    (flags & XDP_SHARE_RINGS)) {
 			/* Cannot specify flags for shared sockets. */
 			err = -EINVAL;
 			goto out_unlock;
@@ -942,6 +1279,13 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 			goto out_unlock;
 		}
 
+		if ((flags & XDP_USE_SG) && umem_xs->zc &&
+		    dev->xdp_zc_max_segs <= 1) {
+			err = -EOPNOTSUPP;
+			sockfd_put(sock);
+			goto out_unlock;
+		}
+
 		if (umem_xs->queue_id != qid || umem_xs->dev != dev) {
 			/* Share the umem with another socket on another qid
 			 * and/or device.
@@ -954,6 +1298,20 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 				goto out_unlock;
 			}
 
+			/* Without rings of its own, use the ones the umem
+			 * owner shares, if it does.
+			 */
+			if (!xs->fq_tmp && !xs->cq_tmp) {
+				err = xp_attach_shared_rings(xs->pool,
+							     umem_xs->pool);
+				if (err) {
+					xp_destroy(xs->pool);
+					xs->pool = NULL;
+					sockfd_put(sock);
+					goto out_unlock;
+				}
+			}
+
 			err = xp_assign_dev_shared(xs->pool, umem_xs, dev,
 						   qid);
 			if (err) {
@@ -1002,6 +1360,15 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 			goto out_unlock;
 		}
 
+		if (flags & XDP_SHARE_RINGS) {
+			err = xp_share_rings(xs->pool);
+			if (err) {
+				xp_destroy(xs->pool);
+				xs->pool = NULL;
+				goto out_unlock;
+			}
+		}
+
 		err = xp_assign_dev(xs->pool, dev, qid, flags);
 		if (err) {
 			xp_destroy(xs->pool);
@@ -1016,6 +1383,7 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	xs->dev = dev;
 	xs->zc = xs->umem->zc;
+	xs->sg = !!(flags & XDP_USE_SG);
 	xs->queue_id = qid;
 	xp_add_xsk(xs->pool, xs);
 
@@ -8,6 +8,9 @@
 #include "xdp_umem.h"
 #include "xsk.h"
 
+/* Buffers a pool takes from a shared fill ring at least, per lock round */
+#define XSK_SHARED_FQ_BATCH 64
+
 void xp_add_xsk(struct xsk_buff_pool *pool, struct xdp_sock *xs)
 {
 	unsigned long flags;
@@ -32,11 +35,236 @@ void xp_del_xsk(struct xsk_buff_pool *pool, struct xdp_sock *xs)
 	spin_unlock_irqrestore(&pool->xsk_tx_list_lock, flags);
 }
 
+static int xp_link_rings(struct xsk_buff_pool *pool,
+			 struct xsk_shared_rings *rings)
+{
+	struct xsk_rings_link *link;
+
+	link = kzalloc(sizeof(*link), GFP_KERNEL);
+	if (!link)
+		return -ENOMEM;
+
+	link->tx_pending = kvcalloc(rings->cq->nentries,
+				    sizeof(*link->tx_pending), GFP_KERNEL);
+	if (!link->tx_pending) {
+		kfree(link);
+		return -ENOMEM;
+	}
+
+	link->tx_pending_mask = rings->cq->nentries - 1;
+	link->rings = rings;
+
+	pool->share = link;
+	pool->fq = rings->fq;
+	pool->cq = rings->cq;
+	return 0;
+}
+
+static void xp_unlink_rings(struct xsk_buff_pool *pool)
+{
+	struct xsk_rings_link *link = pool->share;
+
+	pool->share = NULL;
+	pool->fq = NULL;
+	pool->cq = NULL;
+	kvfree(link->tx_pending);
+	kfree(link);
+}
+
+/* Lets the fill and completion rings of the pool serve the pools of other
+ * queues, see xp_attach_shared_rings().
+ */
+int xp_share_rings(struct xsk_buff_pool *pool)
+{
+	struct xsk_shared_rings *rings;
+	int err;
+
+	rings = kzalloc(sizeof(*rings), GFP_KERNEL);
+	if (!rings)
+		return -ENOMEM;
+
+	rings->spare = kvcalloc(pool->heads_cnt, sizeof(*rings->spare),
+				GFP_KERNEL);
+	if (!rings->spare) {
+		kfree(rings);
+		return -ENOMEM;
+	}
+
+	refcount_set(&rings->users, 1);
+	spin_lock_init(&rings->fq_lock);
+	spin_lock_init(&rings->cq_lock);
+	rings->fq = pool->fq;
+	rings->cq = pool->cq;
+	rings->spare_size = pool->heads_cnt;
+
+	err = xp_link_rings(pool, rings);
+	if (err) {
+		kvfree(rings->spare);
+		kfree(rings);
+		return err;
+	}
+
+	pool->share->owner = true;
+	return 0;
+}
+
+int xp_attach_shared_rings(struct xsk_buff_pool *pool,
+			   struct xsk_buff_pool *owner)
+{
+	struct xsk_shared_rings *rings;
+	int err;
+
+	if (!owner->share)
+		return -EINVAL;
+
+	rings = owner->share->rings;
+	refcount_inc(&rings->users);
+	err = xp_link_rings(pool, rings);
+	if (err)
+		refcount_dec(&rings->users);
+	return err;
+}
+
+static void xp_put_shared_rings(struct xsk_shared_rings *rings,
+				bool destroy_queues)
+{
+	if (!refcount_dec_and_test(&rings->users))
+		return;
+
+	if (destroy_queues) {
+		xskq_destroy(rings->fq);
+		xskq_destroy(rings->cq);
+	}
+	kvfree(rings->spare);
+	kfree(rings);
+}
+
+/* Passes the buffers cached in the free list of the pool on to the pools
+ * of the other queues, which take them before new ones from the fill ring.
+ */
+static void xp_shared_give_back(struct xsk_buff_pool *pool)
+{
+	struct xsk_shared_rings *rings = pool->share->rings;
+	struct xdp_buff_xsk *xskb;
+
+	spin_lock_bh(&rings->fq_lock);
+	list_for_each_entry(xskb, &pool->free_list, free_list_node) {
+		/* Only if user space filled in the same buffer twice */
+		if (unlikely(rings->spare_cnt == rings->spare_size)) {
+			rings->fq->invalid_descs++;
+			continue;
+		}
+		rings->spare[rings->spare_cnt++] = xskb->orig_addr;
+	}
+	spin_unlock_bh(&rings->fq_lock);
+}
+
+/* Hands what the pool still holds back: zero-copy Tx buffers the driver
+ * won't complete any more, which have their completion ring slots
+ * reserved, go to user space, the buffers cached in the free list to the
+ * remaining queues.
+ */
+static void xp_unshare_rings(struct xsk_buff_pool *pool)
+{
+	struct xsk_rings_link *link = pool->share;
+	struct xsk_shared_rings *rings = link->rings;
+
+	xp_shared_tx_completed(pool, link->tx_pending_prod -
+				     link->tx_pending_cons);
+
+	if (pool->cached_need_wakeup & XDP_WAKEUP_RX)
+		xp_shared_set_rx_need_wakeup(pool, false);
+
+	/* The last user has nobody left to pass the buffers on to */
+	if (refcount_read(&rings->users) > 1)
+		xp_shared_give_back(pool);
+
+	xp_put_shared_rings(rings, true);
+	xp_unlink_rings(pool);
+}
+
+void xp_shared_set_rx_need_wakeup(struct xsk_buff_pool *pool, bool set)
+{
+	struct xsk_shared_rings *rings = pool->share->rings;
+
+	/* The flag stays up while any of the queues needs a wakeup. */
+	spin_lock_bh(&rings->fq_lock);
+	if (set) {
+		if (!rings->rx_need_wakeup++)
+			rings->fq->ring->flags |= XDP_RING_NEED_WAKEUP;
+	} else if (!--rings->rx_need_wakeup) {
+		rings->fq->ring->flags &= ~XDP_RING_NEED_WAKEUP;
+	}
+	spin_unlock_bh(&rings->fq_lock);
+}
+
+u32 xp_shared_cq_reserve(struct xsk_buff_pool *pool, u32 nb_entries)
+{
+	struct xsk_shared_rings *rings = pool->share->rings;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rings->cq_lock, flags);
+	nb_entries = xskq_prod_nb_free(rings->cq, nb_entries);
+	xskq_prod_reserve_n(rings->cq, nb_entries);
+	spin_unlock_irqrestore(&rings->cq_lock, flags);
+
+	return nb_entries;
+}
+
+void xp_shared_cq_cancel(struct xsk_buff_pool *pool, u32 nb_entries)
+{
+	struct xsk_shared_rings *rings = pool->share->rings;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rings->cq_lock, flags);
+	xskq_prod_cancel_n(rings->cq, nb_entries);
+	spin_unlock_irqrestore(&rings->cq_lock, flags);
+}
+
+/* Queues the addresses of descriptors handed to a zero-copy driver, which
+ * completes them in order. Their completion ring slots are reserved.
+ */
+void xp_shared_tx_queue(struct xsk_buff_pool *pool, struct xdp_desc *descs,
+			u32 nb_entries)
+{
+	struct xsk_rings_link *link = pool->share;
+	u32 i;
+
+	for (i = 0; i < nb_entries; i++)
+		link->tx_pending[link->tx_pending_prod++ &
+				 link->tx_pending_mask] = descs[i].addr;
+}
+
+void xp_shared_tx_completed(struct xsk_buff_pool *pool, u32 nb_entries)
+{
+	struct xsk_rings_link *link = pool->share;
+	struct xsk_shared_rings *rings = link->rings;
+	unsigned long flags;
+	u64 addr;
+
+	spin_lock_irqsave(&rings->cq_lock, flags);
+	while (nb_entries--) {
+		addr = link->tx_pending[link->tx_pending_cons++ &
+					link->tx_pending_mask];
+		xskq_prod_submit_addr(rings->cq, addr);
+	}
+	spin_unlock_irqrestore(&rings->cq_lock, flags);
+}
+
 void xp_destroy(struct xsk_buff_pool *pool)
 {
 	if (!pool)
 		return;
 
+	if (pool->share) {
+		/* Bind failed. An owner's rings are still with its socket,
+		 * which frees them. A pool attached to another socket's rings
+		 * is their last user if that socket went away meanwhile.
+		 */
+		xp_put_shared_rings(pool->share->rings, !pool->share->owner);
+		xp_unlink_rings(pool);
+	}
+
 	kvfree(pool->tx_descs);
 	kvfree(pool->heads);
 	kvfree(pool);
@@ -86,6 +314,7 @@ struct xsk_buff_pool *xp_create_and_assign_umem(struct xdp_sock *xs,
 	pool->umem = umem;
 	pool->addrs = umem->addrs;
 	INIT_LIST_HEAD(&pool->free_list);
+	INIT_LIST_HEAD(&pool->xskb_list);
 	INIT_LIST_HEAD(&pool->xsk_tx_list);
 	spin_lock_init(&pool->xsk_tx_list_lock);
 	spin_lock_init(&pool->cq_lock);
@@ -99,6 +328,7 @@ struct xsk_buff_pool *xp_create_and_assign_umem(struct xdp_sock *xs,
 		xskb->pool = pool;
 		xskb->xdp.frame_sz = umem->chunk_size - umem->headroom;
 		INIT_LIST_HEAD(&xskb->free_list_node);
+		INIT_LIST_HEAD(&xskb->xskb_list_node);
 		if (pool->unaligned)
 			pool->free_heads[i] = xskb;
 		else
@@ -184,6 +414,11 @@ int xp_assign_dev(struct xsk_buff_pool *pool,
 		goto err_unreg_pool;
 	}
 
+	if ((flags & XDP_USE_SG) && netdev->xdp_zc_max_segs <= 1) {
+		err = -EOPNOTSUPP;
+		goto err_unreg_pool;
+	}
+
 	bpf.command = XDP_SETUP_XSK_POOL;
 	bpf.xsk.pool = pool;
 	bpf.xsk.queue_id = queue_id;
@@ -249,6 +484,9 @@ static void xp_release_deferred(struct work_struct *work)
 	xp_clear_dev(pool);
 	rtnl_unlock();
 
+	if (pool->share)
+		xp_unshare_rings(pool);
+
 	if (pool->fq) {
 		xskq_destroy(pool->fq);
 		pool->fq = NULL;
@@ -472,6 +710,66 @@ static bool xp_check_aligned(struct xsk_buff_pool *pool, u64 *addr)
 	return *addr < pool->addrs_cnt;
 }
 
+static bool xp_shared_add_free(struct xsk_buff_pool *pool, u64 addr)
+{
+	struct xdp_buff_xsk *xskb;
+	bool ok;
+
+	ok = pool->unaligned ? xp_check_unaligned(pool, &addr) :
+		xp_check_aligned(pool, &addr);
+	if (unlikely(!ok)) {
+		pool->fq->invalid_descs++;
+		return false;
+	}
+
+	if (pool->unaligned) {
+		xskb = pool->free_heads[--pool->free_heads_cnt];
+		xp_init_xskb_addr(xskb, pool, addr);
+		if (pool->dma_pages_cnt)
+			xp_init_xskb_dma(xskb, pool, pool->dma_pages, addr);
+	} else {
+		xskb = &pool->heads[xp_aligned_extract_idx(pool, addr)];
+	}
+
+	list_add_tail(&xskb->free_list_node, &pool->free_list);
+	return true;
+}
+
+/* Moves at least a batch of buffers from the shared fill ring to the free
+ * list of the pool, which then serves its queue without the lock. Buffers
+ * left behind by pools that went away are used up first.
+ */
+static u32 xp_shared_refill(struct xsk_buff_pool *pool, u32 count)
+{
+	struct xsk_shared_rings *rings = pool->share->rings;
+	u32 i, nb_spare, nb_entries = 0;
+	u64 addr;
+
+	count = max_t(u32, count, XSK_SHARED_FQ_BATCH);
+
+	spin_lock_bh(&rings->fq_lock);
+	count = min(count, pool->free_heads_cnt);
+
+	nb_spare = min(count, rings->spare_cnt);
+	for (i = 0; i < nb_spare; i++) {
+		addr = rings->spare[--rings->spare_cnt];
+		nb_entries += xp_shared_add_free(pool, addr);
+	}
+
+	count = xskq_cons_nb_entries(pool->fq, count - nb_spare);
+	for (i = 0; i < count; i++) {
+		__xskq_cons_read_addr_unchecked(pool->fq, pool->fq->cached_cons + i,
+						&addr);
+		nb_entries += xp_shared_add_free(pool, addr);
+	}
+	xskq_cons_release_n(pool->fq, count);
+	__xskq_cons_release(pool->fq);
+	spin_unlock_bh(&rings->fq_lock);
+
+	pool->free_list_cnt += nb_entries;
+	return nb_entries;
+}
+
 static struct xdp_buff_xsk *__xp_alloc(struct xsk_buff_pool *pool)
 {
 	struct xdp_buff_xsk *xskb;
@@ -514,6 +812,12 @@ struct xdp_buff *xp_alloc(struct xsk_buff_pool *pool)
 {
 	struct xdp_buff_xsk *xskb;
 
+	if (unlikely(pool->share) && !pool->free_list_cnt &&
+	    !xp_shared_refill(pool, 1)) {
+		pool->fq->queue_empty_descs++;
+		return NULL;
+	}
+
 	if (!pool->free_list_cnt) {
 		xskb = __xp_alloc(pool);
 		if (!xskb)
@@ -614,6 +918,15 @@ u32 xp_alloc_batch(struct xsk_buff_pool *pool, struct xdp_buff **xdp, u32 max)
 		return !!buff;
 	}
 
+	if (unlikely(pool->share)) {
+		if (pool->free_list_cnt < max)
+			xp_shared_refill(pool, max - pool->free_list_cnt);
+		nb_entries1 = xp_alloc_reused(pool, xdp, max);
+		if (!nb_entries1)
+			pool->fq->queue_empty_descs++;
+		return nb_entries1;
+	}
+
 	if (unlikely(pool->free_list_cnt)) {
 		nb_entries1 = xp_alloc_reused(pool, xdp, max);
 		if (nb_entries1 == max)
@@ -635,11 +948,15 @@ bool xp_can_alloc(struct xsk_buff_pool *pool, u32 count)
 {
 	if (pool->free_list_cnt >= count)
 		return true;
+	if (unlikely(pool->share)) {
+		xp_shared_refill(pool, count - pool->free_list_cnt);
+		return pool->free_list_cnt >= count;
+	}
 	return xskq_cons_has_entries(pool->fq, count - pool->free_list_cnt);
 }
 EXPORT_SYMBOL(xp_can_alloc);
 
-void xp_free(struct xdp_buff_xsk *xskb)
+static void __xp_free(struct xdp_buff_xsk *xskb)
 {
 	if (!list_empty(&xskb->free_list_node))
 		return;
@@ -647,8 +964,36 @@ void xp_free(struct xdp_buff_xsk *xskb)
 	xskb->pool->free_list_cnt++;
 	list_add(&xskb->free_list_node, &xskb->pool->free_list);
 }
+
+void xp_free(struct xdp_buff_xsk *xskb)
+{
+	struct xdp_buff_xsk *pos, *tmp;
+
+	if (unlikely(xdp_buff_has_frags(&xskb->xdp))) {
+		list_for_each_entry_safe(pos, tmp, &xskb->pool->xskb_list,
+					 xskb_list_node) {
+			list_del_init(&pos->xskb_list_node);
+			__xp_free(pos);
+		}
+		xdp_buff_clear_frags_flag(&xskb->xdp);
+	}
+
+	__xp_free(xskb);
+}
 EXPORT_SYMBOL(xp_free);
 
+/* Zero-copy drivers receiving a packet over several buffers chain all but
+ * the first one here, in order, as they add them to the frags of the first.
+ * The chain is handed to the socket or freed along with the first buffer.
+ */
+void xp_add_frag(struct xdp_buff *frag)
+{
+	struct xdp_buff_xsk *xskb = container_of(frag, struct xdp_buff_xsk, xdp);
+
+	list_add_tail(&xskb->xskb_list_node, &xskb->pool->xskb_list);
+}
+EXPORT_SYMBOL(xp_add_frag);
+
 void *xp_raw_get_data(struct xsk_buff_pool *pool, u64 addr)
 {
 	addr = pool->unaligned ? xp_unaligned_add_offset_to_addr(addr) : addr;
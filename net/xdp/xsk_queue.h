@@ -8,6 +8,8 @@
 
 #include <linux/types.h>
 #include <linux/if_xdp.h>
+#include <linux/refcount.h>
+#include <linux/spinlock.h>
 #include <net/xdp_sock.h>
 #include <net/xsk_buff_pool.h>
 
@@ -47,6 +49,43 @@ struct xsk_queue {
 	u64 queue_empty_descs;
 };
 
+/* Fill and completion rings serving the pools of several queues, set up by
+ * binding with XDP_SHARE_RINGS. Each pool takes buffers from the fill ring
+ * in batches into its free list, and writes Tx completions in the order its
+ * own driver queue completes them, so that the queues only meet on the
+ * locks once per batch.
+ */
+struct xsk_shared_rings {
+	refcount_t users;
+	spinlock_t fq_lock;
+	spinlock_t cq_lock;
+	struct xsk_queue *fq;
+	struct xsk_queue *cq;
+	/* Fill ring buffers left cached by pools that went away */
+	u64 *spare;
+	u32 spare_cnt;
+	u32 spare_size;
+	u32 rx_need_wakeup;
+};
+
+/* A pool's link to shared rings */
+struct xsk_rings_link {
+	struct xsk_shared_rings *rings;
+	/* The rings are those of this pool's socket */
+	bool owner;
+	/* Zero-copy Tx addresses, until the driver completes them */
+	u64 *tx_pending;
+	u32 tx_pending_mask;
+	u32 tx_pending_prod;
+	u32 tx_pending_cons;
+};
+
+static inline spinlock_t *xp_cq_lock(struct xsk_buff_pool *pool)
+{
+	return unlikely(pool->share) ? &pool->share->rings->cq_lock :
+				       &pool->cq_lock;
+}
+
 /* The structure of the shared state of the rings are a simple
  * circular buffer, as outlined in
  * Documentation/core-api/circular-buffers.rst. For the Rx and
@@ -129,6 +168,17 @@ static inline bool xskq_cons_read_addr_unchecked(struct xsk_queue *q, u64 *addr)
 	return false;
 }
 
+static inline bool xp_unused_options_set(u32 options)
+{
+	return options & ~XDP_PKT_CONTD;
+}
+
+/* The packet continues in the next descriptor. */
+static inline bool xp_mb_desc(struct xdp_desc *desc)
+{
+	return desc->options & XDP_PKT_CONTD;
+}
+
 static inline bool xp_aligned_validate_desc(struct xsk_buff_pool *pool,
 					    struct xdp_desc *desc)
 {
@@ -144,7 +194,10 @@ static inline bool xp_aligned_validate_desc(struct xsk_buff_pool *pool,
 	if (chunk >= pool->addrs_cnt)
 		return false;
 
-	if (desc->options)
+	if (xp_unused_options_set(desc->options))
+		return false;
+	/* Only the last descriptor of a packet may be empty. */
+	if (xp_mb_desc(desc) && !desc->len)
 		return false;
 	return true;
 }
@@ -164,7 +217,10 @@ static inline bool xp_unaligned_validate_desc(struct xsk_buff_pool *pool,
 	    xp_desc_crosses_non_contig_pg(pool, addr, desc->len))
 		return false;
 
-	if (desc->options)
+	if (xp_unused_options_set(desc->options))
+		return false;
+	/* Only the last descriptor of a packet may be empty. */
+	if (xp_mb_desc(desc) && !desc->len)
 		return false;
 	return true;
 }
@@ -210,30 +266,54 @@ static inline void xskq_cons_release_n(struct xsk_queue *q, u32 cnt)
 	q->cached_cons += cnt;
 }
 
+/* Reads up to @max descriptors, made of whole packets of at most @max_segs
+ * descriptors each. A packet with an invalid descriptor, or spanning more
+ * than @max_segs of them, is skipped as a whole. The descriptors of a
+ * packet that is not complete in the ring yet, or does not fit in @max,
+ * are left there for the next call.
+ */
 static inline u32 xskq_cons_read_desc_batch(struct xsk_queue *q, struct xsk_buff_pool *pool,
-					    u32 max)
+					    u32 max, u32 max_segs)
 {
-	u32 cached_cons = q->cached_cons, nb_entries = 0;
+	u32 cached_cons = q->cached_cons, nb_entries = 0, nr_frags = 0;
+	u32 pkt_cons = cached_cons, total_descs = 0;
 	struct xdp_desc *descs = pool->tx_descs;
+	bool skip = false;
 
 	while (cached_cons != q->cached_prod && nb_entries < max) {
 		struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
 		u32 idx = cached_cons & q->ring_mask;
+		bool mb;
 
 		descs[nb_entries] = ring->desc[idx];
-		if (unlikely(!xskq_cons_is_valid_desc(q, &descs[nb_entries], pool))) {
-			/* Skip the entry */
-			cached_cons++;
-			continue;
+		mb = xp_mb_desc(&descs[nb_entries]);
+		cached_cons++;
+
+		if (unlikely(skip)) {
+			q->invalid_descs++;
+		} else if (likely(nr_frags < max_segs &&
+				  xskq_cons_is_valid_desc(q, &descs[nb_entries], pool))) {
+			nb_entries++;
+			nr_frags++;
+		} else {
+			/* Drop the packet, with the entries read so far */
+			q->invalid_descs += nr_frags + (nr_frags == max_segs);
+			nb_entries -= nr_frags;
+			nr_frags = 0;
+			skip = true;
 		}
 
-		nb_entries++;
-		cached_cons++;
+		if (!mb) {
+			total_descs = nb_entries;
+			pkt_cons = cached_cons;
+			nr_frags = 0;
+			skip = false;
+		}
 	}
 
-	/* Release valid plus any invalid entries */
-	xskq_cons_release_n(q, cached_cons - q->cached_cons);
-	return nb_entries;
+	/* Release valid plus any invalid entries of whole packets */
+	xskq_cons_release_n(q, pkt_cons - q->cached_cons);
+	return total_descs;
 }
 
 /* Functions for consumers */
@@ -289,6 +369,51 @@ static inline bool xskq_cons_peek_desc(struct xsk_queue *q,
 	return xskq_cons_read_desc(q, desc, pool);
 }
 
+/* Reads the descriptors of the packet at the head of the ring into @descs,
+ * without releasing them, and returns their number. Unlike the other peeks,
+ * it never publishes the consumer pointer, so that packets released since
+ * the last __xskq_cons_release() can still be handed back. Returns 0 if the
+ * packet is not complete in the ring yet. A packet with an invalid
+ * descriptor, or spanning more than @max_segs of them, is skipped as a
+ * whole once complete.
+ */
+static inline u32 xskq_cons_peek_pkt(struct xsk_queue *q,
+				     struct xdp_desc *descs, u32 max_segs,
+				     struct xsk_buff_pool *pool)
+{
+	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
+	u32 cached_cons, nr_descs;
+	struct xdp_desc desc;
+	bool valid;
+
+	for (;;) {
+		cached_cons = q->cached_cons;
+		nr_descs = 0;
+		valid = true;
+
+		do {
+			if (cached_cons == q->cached_prod) {
+				__xskq_cons_peek(q);
+				if (cached_cons == q->cached_prod)
+					return 0;
+			}
+
+			desc = ring->desc[cached_cons++ & q->ring_mask];
+			if (valid && nr_descs < max_segs &&
+			    xp_validate_desc(pool, &desc))
+				descs[nr_descs++] = desc;
+			else
+				valid = false;
+		} while (xp_mb_desc(&desc));
+
+		if (likely(valid))
+			return nr_descs;
+
+		q->invalid_descs += cached_cons - q->cached_cons;
+		q->cached_cons = cached_cons;
+	}
+}
+
 /* To improve performance in the xskq_cons_release functions, only update local state here.
  * Reflect this to global state when we get new entries from the ring in
  * xskq_cons_get_entries() and whenever Rx or Tx processing are completed in the NAPI loop.
@@ -330,6 +455,11 @@ static inline void xskq_prod_cancel(struct xsk_queue *q)
 	q->cached_prod--;
 }
 
+static inline void xskq_prod_cancel_n(struct xsk_queue *q, u32 cnt)
+{
+	q->cached_prod -= cnt;
+}
+
 static inline int xskq_prod_reserve(struct xsk_queue *q)
 {
 	if (xskq_prod_is_full(q))
@@ -340,6 +470,16 @@ static inline int xskq_prod_reserve(struct xsk_queue *q)
 	return 0;
 }
 
+static inline int xskq_prod_reserve_n(struct xsk_queue *q, u32 cnt)
+{
+	if (xskq_prod_nb_free(q, cnt) < cnt)
+		return -ENOSPC;
+
+	/* A, matches D */
+	q->cached_prod += cnt;
+	return 0;
+}
+
 static inline int xskq_prod_reserve_addr(struct xsk_queue *q, u64 addr)
 {
 	struct xdp_umem_ring *ring = (struct xdp_umem_ring *)q->ring;
@@ -366,7 +506,7 @@ static inline void xskq_prod_write_addr_batch(struct xsk_queue *q, struct xdp_de
 }
 
 static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
-					 u64 addr, u32 len)
+					 u64 addr, u32 len, u32 flags)
 {
 	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
 	u32 idx;
@@ -378,6 +518,7 @@ static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
 	idx = q->cached_prod++ & q->ring_mask;
 	ring->desc[idx].addr = addr;
 	ring->desc[idx].len = len;
+	ring->desc[idx].options = flags;
 
 	return 0;
 }
@@ -428,4 +569,14 @@ static inline u64 xskq_nb_queue_empty_descs(struct xsk_queue *q)
 struct xsk_queue *xskq_create(u32 nentries, bool umem_queue);
 void xskq_destroy(struct xsk_queue *q_ops);
 
+int xp_share_rings(struct xsk_buff_pool *pool);
+int xp_attach_shared_rings(struct xsk_buff_pool *pool,
+			   struct xsk_buff_pool *owner);
+void xp_shared_set_rx_need_wakeup(struct xsk_buff_pool *pool, bool set);
+u32 xp_shared_cq_reserve(struct xsk_buff_pool *pool, u32 nb_entries);
+void xp_shared_cq_cancel(struct xsk_buff_pool *pool, u32 nb_entries);
+void xp_shared_tx_queue(struct xsk_buff_pool *pool, struct xdp_desc *descs,
+			u32 nb_entries);
+void xp_shared_tx_completed(struct xsk_buff_pool *pool, u32 nb_entries);
+
 #endif /* _LINUX_XSK_QUEUE_H */
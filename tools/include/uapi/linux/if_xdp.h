@@ -25,6 +25,17 @@
  * application.
  */
 #define XDP_USE_NEED_WAKEUP (1 << 3)
+/* By setting this option, the application tells that it can handle packets
+ * spanning several descriptors. Rx frames larger than a buffer are then
+ * split over descriptors chained with XDP_PKT_CONTD instead of being
+ * dropped, and Tx descriptors may be chained the same way.
+ */
+#define XDP_USE_SG	(1 << 4)
+/* Lets the fill and completion rings of the umem serve the sockets that
+ * share the umem on other queues and bind without rings of their own. The
+ * kernel hands each queue its buffers from the common fill ring.
+ */
+#define XDP_SHARE_RINGS	(1 << 5)
 
 /* Flags for xsk_umem_config flags */
 #define XDP_UMEM_UNALIGNED_CHUNK_FLAG (1 << 0)
@@ -106,6 +117,12 @@ struct xdp_desc {
 	__u32 options;
 };
 
+/* Flag for the options field of struct xdp_desc: the packet continues in
+ * the next descriptor of the ring. The last descriptor of a packet has it
+ * cleared.
+ */
+#define XDP_PKT_CONTD (1 << 0)
+
 /* UMEM descriptor is __u64 */
 
 #endif /* _LINUX_IF_XDP_H */
@@ -0,0 +1,568 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * kmsg_decode - print the kernel log of a kernel core image
+ *
+ * Reads the printk ringbuffer from an ELF core image of the kernel, such as
+ * /proc/kcore or a vmcore saved by kdump, and prints its records like dmesg.
+ * The ringbuffer is located through the VMCOREINFO note of the image.
+ *
+ * With CONFIG_PRINTK_BINARY_RECORDS, records may be stored as a pointer to
+ * their format string followed by the arguments as packed by vbin_printf().
+ * Such records are formatted here, reading the format strings from the
+ * image. Pointer arguments that the kernel would have printed symbolically
+ * (%pS, %ps and the like) are printed as addresses.
+ *
+ * Only 64-bit images of the same byte order as the host are supported.
+ */
+#include <ctype.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/kmsg_mmap.h>
+
+#define DEFAULT_CORE	"/proc/kcore"
+#define LINE_MAX_LEN	4096
+
+static int core_fd;
+static Elf64_Phdr *phdrs;
+static unsigned int nr_phdrs;
+static char *vmcoreinfo;
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "kmsg_decode: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(1);
+}
+
+static void read_at(uint64_t off, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = pread(core_fd, buf, len, off);
+		if (ret <= 0)
+			die("cannot read the image at %#" PRIx64 ": %s", off,
+			    ret ? strerror(errno) : "end of file");
+		buf = (char *)buf + ret;
+		off += ret;
+		len -= ret;
+	}
+}
+
+/* Copy @len bytes of kernel virtual memory at @addr, 0 if not in the image */
+static int read_mem(uint64_t addr, void *buf, size_t len)
+{
+	unsigned int i;
+	size_t chunk;
+
+	while (len) {
+		for (i = 0; i < nr_phdrs; i++) {
+			const Elf64_Phdr *ph = &phdrs[i];
+
+			if (ph->p_type == PT_LOAD && addr >= ph->p_vaddr &&
+			    addr - ph->p_vaddr < ph->p_filesz)
+				break;
+		}
+		if (i == nr_phdrs)
+			return -1;
+
+		chunk = phdrs[i].p_vaddr + phdrs[i].p_filesz - addr;
+		if (chunk > len)
+			chunk = len;
+		read_at(phdrs[i].p_offset + addr - phdrs[i].p_vaddr, buf, chunk);
+		addr += chunk;
+		buf = (char *)buf + chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+static void *read_mem_alloc(uint64_t addr, size_t len)
+{
+	void *buf = malloc(len);
+
+	if (!buf)
+		die("out of memory");
+	if (read_mem(addr, buf, len))
+		die("%zu bytes at %#" PRIx64 " are not in the image", len, addr);
+	return buf;
+}
+
+static void load_core(const char *path)
+{
+	Elf64_Ehdr ehdr;
+	unsigned int i;
+
+	core_fd = open(path, O_RDONLY);
+	if (core_fd < 0)
+		die("cannot open %s: %s", path, strerror(errno));
+
+	read_at(0, &ehdr, sizeof(ehdr));
+	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+	    ehdr.e_ident[EI_CLASS] != ELFCLASS64 || ehdr.e_type != ET_CORE)
+		die("%s is not a 64-bit ELF core image", path);
+	if (ehdr.e_phentsize != sizeof(Elf64_Phdr))
+		die("unexpected program header size %u", ehdr.e_phentsize);
+
+	nr_phdrs = ehdr.e_phnum;
+	phdrs = calloc(nr_phdrs, sizeof(*phdrs));
+	if (!phdrs)
+		die("out of memory");
+	read_at(ehdr.e_phoff, phdrs, nr_phdrs * sizeof(*phdrs));
+
+	for (i = 0; i < nr_phdrs && !vmcoreinfo; i++) {
+		uint64_t off = 0, size = phdrs[i].p_filesz;
+		char *notes;
+
+		if (phdrs[i].p_type != PT_NOTE)
+			continue;
+
+		notes = malloc(size + 1);
+		if (!notes)
+			die("out of memory");
+		read_at(phdrs[i].p_offset, notes, size);
+
+		while (off + sizeof(Elf64_Nhdr) <= size) {
+			Elf64_Nhdr *nhdr = (Elf64_Nhdr *)(notes + off);
+			char *name = (char *)(nhdr + 1);
+			char *desc = name + ((nhdr->n_namesz + 3) & ~3U);
+
+			if (desc + nhdr->n_descsz > notes + size)
+				break;
+			if (nhdr->n_namesz == sizeof("VMCOREINFO") &&
+			    !strcmp(name, "VMCOREINFO")) {
+				vmcoreinfo = strndup(desc, nhdr->n_descsz);
+				break;
+			}
+			off = desc + ((nhdr->n_descsz + 3) & ~3U) - notes;
+		}
+		free(notes);
+	}
+	if (!vmcoreinfo)
+		die("%s has no VMCOREINFO note", path);
+}
+
+/* Look up "@key=" in VMCOREINFO. Returns false if it is not there. */
+static bool vmcoreinfo_lookup(const char *key, int base, uint64_t *val)
+{
+	size_t len = strlen(key);
+	const char *p = vmcoreinfo;
+
+	while (p && *p) {
+		if (!strncmp(p, key, len) && p[len] == '=') {
+			*val = strtoull(p + len + 1, NULL, base);
+			return true;
+		}
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+static uint64_t vmcoreinfo_get(const char *key, int base)
+{
+	uint64_t val;
+
+	if (!vmcoreinfo_lookup(key, base, &val))
+		die("%s missing from VMCOREINFO", key);
+	return val;
+}
+
+/*
+ * Formatting of binary records. The arguments are laid out as vbin_printf()
+ * in lib/vsprintf.c packs them: each one aligned to its own size, 8-byte
+ * ones to 4 bytes, strings and pointers formatted by the kernel inline and
+ * NUL terminated.
+ */
+struct bin_args {
+	const unsigned char *base;
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+static const void *bin_get(struct bin_args *a, size_t size, size_t align)
+{
+	size_t off = a->p - a->base;
+	const unsigned char *p;
+
+	p = a->base + ((off + align - 1) & ~(align - 1));
+	if (p + size > a->end)
+		return NULL;
+	a->p = p + size;
+	return p;
+}
+
+static int64_t bin_get_num(struct bin_args *a, size_t size, bool is_signed)
+{
+	const void *p = bin_get(a, size, size == 8 ? 4 : size);
+	int64_t val = 0;
+
+	if (!p)
+		return 0;
+
+	switch (size) {
+	case 1: {
+		uint8_t v;
+
+		memcpy(&v, p, 1);
+		val = is_signed ? (int8_t)v : v;
+		break;
+	}
+	case 2: {
+		uint16_t v;
+
+		memcpy(&v, p, 2);
+		val = is_signed ? (int16_t)v : v;
+		break;
+	}
+	case 4: {
+		uint32_t v;
+
+		memcpy(&v, p, 4);
+		val = is_signed ? (int64_t)(int32_t)v : (int64_t)v;
+		break;
+	}
+	default:
+		memcpy(&val, p, 8);
+	}
+	return val;
+}
+
+static const char *bin_get_str(struct bin_args *a)
+{
+	const char *s = (const char *)a->p;
+	size_t len = strnlen(s, a->end - a->p);
+
+	if (a->p + len >= a->end) {
+		a->p = a->end;
+		return "";
+	}
+	a->p += len + 1;
+	return s;
+}
+
+static size_t bin_format(char *out, size_t size, const char *fmt,
+			 const unsigned char *args, size_t args_len)
+{
+	struct bin_args a = { args, args, args + args_len };
+	size_t len = 0;
+
+#define emit(...)							\
+	do {								\
+		int n = snprintf(out + len, size - len, __VA_ARGS__);	\
+		if (n > 0)						\
+			len += n;					\
+		if (len >= size)					\
+			len = size - 1;					\
+	} while (0)
+
+	while (*fmt && len < size - 1) {
+		char spec[48], *sp = spec;
+		int width = 0, prec = -1;
+		bool has_width = false;
+		size_t qual = sizeof(int);
+		bool is_signed;
+		char conv;
+
+		if (*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+		*sp++ = *fmt++;
+		if (*fmt == '%') {
+			out[len++] = '%';
+			fmt++;
+			continue;
+		}
+
+		while (*fmt && strchr("-+ #0", *fmt) && sp < spec + 8)
+			*sp++ = *fmt++;
+
+		if (*fmt == '*') {
+			width = bin_get_num(&a, sizeof(int), true);
+			has_width = true;
+			fmt++;
+		} else {
+			while (isdigit(*fmt)) {
+				width = width * 10 + *fmt++ - '0';
+				has_width = true;
+			}
+		}
+		if (*fmt == '.') {
+			fmt++;
+			prec = 0;
+			if (*fmt == '*') {
+				prec = bin_get_num(&a, sizeof(int), true);
+				fmt++;
+			} else {
+				while (isdigit(*fmt))
+					prec = prec * 10 + *fmt++ - '0';
+			}
+		}
+
+		if (fmt[0] == 'h' && fmt[1] == 'h') {
+			qual = sizeof(char);
+			fmt += 2;
+		} else if (fmt[0] == 'l' && fmt[1] == 'l') {
+			qual = sizeof(long long);
+			fmt += 2;
+		} else if (*fmt == 'h') {
+			qual = sizeof(short);
+			fmt++;
+		} else if (*fmt && strchr("lLzZt", *fmt)) {
+			qual = *fmt == 'L' ? sizeof(long long) : sizeof(long);
+			fmt++;
+		}
+
+		if (has_width)
+			sp += sprintf(sp, "%d", width);
+		if (prec >= 0)
+			sp += sprintf(sp, ".%d", prec);
+
+		conv = *fmt;
+		if (!conv)
+			break;
+		fmt++;
+
+		switch (conv) {
+		case 'c':
+			*sp++ = 'c';
+			*sp = '\0';
+			emit(spec, (int)(unsigned char)bin_get_num(&a, 1, false));
+			break;
+		case 's':
+			*sp++ = 's';
+			*sp = '\0';
+			emit(spec, bin_get_str(&a));
+			break;
+		case 'p':
+			/* The kernel formatted these into the record already */
+			if (isalnum(*fmt) && !strchr("SsxKe", *fmt)) {
+				emit("%s", bin_get_str(&a));
+			} else if (*fmt == 'e') {
+				emit("%" PRId64, bin_get_num(&a, sizeof(void *),
+							    true));
+			} else {
+				emit("0x%016" PRIx64,
+				     bin_get_num(&a, sizeof(void *), false));
+			}
+			while (isalnum(*fmt))
+				fmt++;
+			break;
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			is_signed = conv == 'd' || conv == 'i';
+			*sp++ = 'l';
+			*sp++ = 'l';
+			*sp++ = conv == 'i' ? 'd' : conv;
+			*sp = '\0';
+			emit(spec, (long long)bin_get_num(&a, qual, is_signed));
+			break;
+		default:
+			/* Not something vbin_printf() packs, print as is */
+			*sp++ = conv;
+			*sp = '\0';
+			emit("%s", spec);
+		}
+	}
+#undef emit
+
+	out[len] = '\0';
+	return len;
+}
+
+struct ringbuffer {
+	uint64_t desc_count;
+	uint64_t desc_size;
+	uint64_t info_size;
+	unsigned char *descs;
+	unsigned char *infos;
+	uint64_t text_size;
+	unsigned char *text;
+	uint64_t log_binary;
+};
+
+static void load_ringbuffer(struct ringbuffer *rb)
+{
+	uint64_t prb, desc_ring, text_ring, descs, infos, data;
+	uint32_t count_bits, size_bits;
+
+	if (read_mem(vmcoreinfo_get("SYMBOL(prb)", 16), &prb, sizeof(prb)))
+		die("the prb pointer is not in the image");
+
+	desc_ring = prb + vmcoreinfo_get("OFFSET(printk_ringbuffer.desc_ring)", 10);
+	text_ring = prb + vmcoreinfo_get("OFFSET(printk_ringbuffer.text_data_ring)", 10);
+
+	if (read_mem(desc_ring + vmcoreinfo_get("OFFSET(prb_desc_ring.count_bits)", 10),
+		     &count_bits, sizeof(count_bits)) ||
+	    read_mem(desc_ring + vmcoreinfo_get("OFFSET(prb_desc_ring.descs)", 10),
+		     &descs, sizeof(descs)) ||
+	    read_mem(desc_ring + vmcoreinfo_get("OFFSET(prb_desc_ring.infos)", 10),
+		     &infos, sizeof(infos)) ||
+	    read_mem(text_ring + vmcoreinfo_get("OFFSET(prb_data_ring.size_bits)", 10),
+		     &size_bits, sizeof(size_bits)) ||
+	    read_mem(text_ring + vmcoreinfo_get("OFFSET(prb_data_ring.data)", 10),
+		     &data, sizeof(data)))
+		die("the ringbuffer is not in the image");
+
+	rb->desc_count = 1ULL << count_bits;
+	rb->desc_size = vmcoreinfo_get("SIZE(prb_desc)", 10);
+	rb->info_size = vmcoreinfo_get("SIZE(printk_info)", 10);
+	if (rb->desc_size != sizeof(struct kmsg_mmap_desc) ||
+	    rb->info_size != sizeof(struct kmsg_mmap_info))
+		die("unexpected record layout");
+
+	rb->text_size = 1ULL << size_bits;
+	rb->descs = read_mem_alloc(descs, rb->desc_count * rb->desc_size);
+	rb->infos = read_mem_alloc(infos, rb->desc_count * rb->info_size);
+	rb->text = read_mem_alloc(data, rb->text_size);
+
+	if (!vmcoreinfo_lookup("NUMBER(LOG_BINARY)", 10, &rb->log_binary))
+		rb->log_binary = 0;
+}
+
+/* The text of a record, as laid out in <linux/kmsg_mmap.h> */
+static const unsigned char *record_text(const struct ringbuffer *rb,
+					const struct kmsg_mmap_desc *desc,
+					size_t *len)
+{
+	uint64_t begin = desc->text_begin, next = desc->text_next;
+	uint64_t mask = rb->text_size - 1, start, size;
+
+	if ((begin & 1) || (next & 1))
+		return NULL;
+
+	if (begin / rb->text_size == next / rb->text_size) {
+		start = begin & mask;
+		size = next - begin;
+	} else {
+		start = 0;
+		size = next & mask;
+	}
+	if (size < sizeof(unsigned long) || start + size > rb->text_size)
+		return NULL;
+
+	size -= sizeof(unsigned long);
+	if (*len > size)
+		*len = size;
+	return rb->text + start + sizeof(unsigned long);
+}
+
+static void print_record(const struct ringbuffer *rb,
+			 const struct kmsg_mmap_info *info,
+			 const unsigned char *text, size_t len)
+{
+	static char line[LINE_MAX_LEN];
+	char fmt[LINE_MAX_LEN];
+	uint64_t fmt_addr;
+	size_t n;
+
+	if (rb->log_binary && (info->flags & rb->log_binary)) {
+		if (len < sizeof(fmt_addr))
+			return;
+		memcpy(&fmt_addr, text, sizeof(fmt_addr));
+
+		/*
+		 * Format strings are in the image. Read them byte by byte only
+		 * if they are close to the end of a segment.
+		 */
+		if (read_mem(fmt_addr, fmt, sizeof(fmt) - 1)) {
+			for (n = 0; n < sizeof(fmt) - 1; n++) {
+				if (read_mem(fmt_addr + n, &fmt[n], 1))
+					break;
+			}
+			fmt[n] = '\0';
+		}
+		fmt[sizeof(fmt) - 1] = '\0';
+
+		n = bin_format(line, sizeof(line), fmt, text + sizeof(fmt_addr),
+			       len - sizeof(fmt_addr));
+		/* The newline ends all formats of binary records */
+		if (n && line[n - 1] == '\n')
+			n--;
+	} else {
+		n = len < sizeof(line) ? len : sizeof(line) - 1;
+		memcpy(line, text, n);
+	}
+
+	printf("<%u>[%5" PRIu64 ".%06" PRIu64 "] %.*s\n",
+	       info->facility << 3 | info->level,
+	       (uint64_t)info->ts_nsec / 1000000000,
+	       (uint64_t)info->ts_nsec % 1000000000 / 1000, (int)n, line);
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+	const struct kmsg_mmap_info *ia = *(const struct kmsg_mmap_info **)a;
+	const struct kmsg_mmap_info *ib = *(const struct kmsg_mmap_info **)b;
+
+	return ia->seq < ib->seq ? -1 : ia->seq > ib->seq;
+}
+
+int main(int argc, char **argv)
+{
+	const struct kmsg_mmap_info **order;
+	struct ringbuffer rb;
+	uint64_t i, nr = 0;
+
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "usage: %s [core image, default %s]\n",
+			argv[0], DEFAULT_CORE);
+		return 2;
+	}
+
+	load_core(argc == 2 ? argv[1] : DEFAULT_CORE);
+	load_ringbuffer(&rb);
+
+	order = calloc(rb.desc_count, sizeof(*order));
+	if (!order)
+		die("out of memory");
+
+	/* A crashed kernel may not have finalized its last records */
+	for (i = 0; i < rb.desc_count; i++) {
+		const struct kmsg_mmap_desc *desc;
+		unsigned long state;
+
+		desc = (void *)(rb.descs + i * rb.desc_size);
+		state = KMSG_MMAP_DESC_STATE(desc->state_var);
+		if (state == KMSG_MMAP_DESC_COMMITTED ||
+		    state == KMSG_MMAP_DESC_FINALIZED)
+			order[nr++] = (void *)(rb.infos + i * rb.info_size);
+	}
+	qsort(order, nr, sizeof(*order), cmp_seq);
+
+	for (i = 0; i < nr; i++) {
+		const struct kmsg_mmap_info *info = order[i];
+		const struct kmsg_mmap_desc *desc;
+		const unsigned char *text;
+		size_t len = info->text_len;
+
+		desc = (void *)(rb.descs +
+				(info->seq % rb.desc_count) * rb.desc_size);
+		text = record_text(&rb, desc, &len);
+		if (text)
+			print_record(&rb, info, text, len);
+	}
+
+	return 0;
+}
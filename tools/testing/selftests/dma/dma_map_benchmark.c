@@ -19,6 +19,7 @@ static char *directions[] = {
 	"BIDIRECTIONAL",
 	"TO_DEVICE",
 	"FROM_DEVICE",
+	"MIXED",
 };
 
 int main(int argc, char **argv)
@@ -31,11 +32,13 @@ int main(int argc, char **argv)
 	int bits = 32, xdelay = 0, dir = DMA_MAP_BIDIRECTIONAL;
 	/* default granule 1 PAGESIZE */
 	int granule = 1;
+	/* default dma_map_single(), through the device's dma_map_ops */
+	int nents = 0, flags = 0;
 
 	int cmd = DMA_MAP_BENCHMARK;
 	char *p;
 
-	while ((opt = getopt(argc, argv, "t:s:n:b:d:x:g:")) != -1) {
+	while ((opt = getopt(argc, argv, "t:s:n:b:d:x:g:S:f")) != -1) {
 		switch (opt) {
 		case 't':
 			threads = atoi(optarg);
@@ -58,6 +61,12 @@ int main(int argc, char **argv)
 		case 'g':
 			granule = atoi(optarg);
 			break;
+		case 'S':
+			nents = atoi(optarg);
+			break;
+		case 'f':
+			flags |= DMA_MAP_FORCE_BOUNCE;
+			break;
 		default:
 			return -1;
 		}
@@ -88,7 +97,7 @@ int main(int argc, char **argv)
 	}
 
 	if (dir != DMA_MAP_BIDIRECTIONAL && dir != DMA_MAP_TO_DEVICE &&
-			dir != DMA_MAP_FROM_DEVICE) {
+			dir != DMA_MAP_FROM_DEVICE && dir != DMA_MAP_MIXED) {
 		fprintf(stderr, "invalid dma direction\n");
 		exit(1);
 	}
@@ -98,6 +107,12 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (nents < 0 || nents > DMA_MAP_MAX_NENTS) {
+		fprintf(stderr, "invalid number of sg entries, must be in 0-%d\n",
+			DMA_MAP_MAX_NENTS);
+		exit(1);
+	}
+
 	fd = open("/sys/kernel/debug/dma_map_benchmark", O_RDWR);
 	if (fd == -1) {
 		perror("open");
@@ -112,6 +127,9 @@ int main(int argc, char **argv)
 	map.dma_dir = dir;
 	map.dma_trans_ns = xdelay;
 	map.granule = granule;
+	map.mode = nents ? DMA_MAP_SG_MODE : DMA_MAP_SINGLE_MODE;
+	map.nents = nents;
+	map.flags = flags;
 
 	if (ioctl(fd, cmd, &map)) {
 		perror("ioctl");
@@ -120,10 +138,20 @@ int main(int argc, char **argv)
 
 	printf("dma mapping benchmark: threads:%d seconds:%d node:%d dir:%s granule: %d\n",
 			threads, seconds, node, dir[directions], granule);
+	if (nents)
+		printf("scatterlist: %d entries\n", nents);
+	if (flags & DMA_MAP_FORCE_BOUNCE)
+		printf("bouncing through swiotlb\n");
 	printf("average map latency(us):%.1f standard deviation:%.1f\n",
 			map.avg_map_100ns/10.0, map.map_stddev/10.0);
 	printf("average unmap latency(us):%.1f standard deviation:%.1f\n",
 			map.avg_unmap_100ns/10.0, map.unmap_stddev/10.0);
+	printf("map latency(us) p50:%.3f p99:%.3f p99.9:%.3f\n",
+			map.map_p50_ns/1000.0, map.map_p99_ns/1000.0,
+			map.map_p999_ns/1000.0);
+	printf("unmap latency(us) p50:%.3f p99:%.3f p99.9:%.3f\n",
+			map.unmap_p50_ns/1000.0, map.unmap_p99_ns/1000.0,
+			map.unmap_p999_ns/1000.0);
 
 	return 0;
 }
@@ -0,0 +1,140 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Run the dma_map_benchmark scenarios on one device for each IOMMU domain
+# type, to compare them and the swiotlb setup of the running kernel.
+#
+# usage: dma_map_benchmark.sh [-t "<domain types>"] [-s seconds] <device>
+#
+# <device> is a PCI address like 0000:00:04.0 or a platform device name.
+# The device is bound to the dma_map_benchmark driver for the runs and given
+# back to its driver afterwards. Changing the domain type needs the device
+# to be alone in its IOMMU group. swiotlb settings are boot parameters, so
+# compare those by running the script once per boot; the current swiotlb
+# pool is printed first.
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+BENCH=$(dirname "$0")/dma_map_benchmark
+DEBUGFS=/sys/kernel/debug
+TYPES="identity DMA DMA-FQ"
+SECONDS_PER_RUN=10
+
+usage()
+{
+	echo "usage: $0 [-t \"<domain types>\"] [-s seconds] <device>"
+	exit 1
+}
+
+while getopts "t:s:" opt; do
+	case $opt in
+	t) TYPES=$OPTARG ;;
+	s) SECONDS_PER_RUN=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+DEV=$1
+
+if [ $UID != 0 ]; then
+	echo "must be run as root"
+	exit $ksft_skip
+fi
+
+if [ -e /sys/bus/pci/devices/$DEV ]; then
+	BUS=/sys/bus/pci
+elif [ -e /sys/bus/platform/devices/$DEV ]; then
+	BUS=/sys/bus/platform
+else
+	echo "no such device: $DEV"
+	exit 1
+fi
+SYSDEV=$BUS/devices/$DEV
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not built"
+	exit $ksft_skip
+fi
+
+ORIG_DRIVER=
+if [ -e $SYSDEV/driver ]; then
+	ORIG_DRIVER=$(basename "$(readlink $SYSDEV/driver)")
+fi
+
+unbind()
+{
+	if [ -e $SYSDEV/driver ]; then
+		echo $DEV > $SYSDEV/driver/unbind
+	fi
+}
+
+bind()
+{
+	echo "$1" > $SYSDEV/driver_override
+	echo $DEV > $BUS/drivers_probe
+}
+
+restore()
+{
+	unbind
+	bind ""
+	if [ -n "$ORIG_DRIVER" ] && [ ! -e $SYSDEV/driver ]; then
+		echo $DEV > $BUS/drivers/$ORIG_DRIVER/bind
+	fi
+}
+trap restore EXIT
+
+run()
+{
+	echo "--- $*"
+	"$BENCH" -s $SECONDS_PER_RUN "$@" | grep -v "^dma mapping benchmark"
+}
+
+scenarios()
+{
+	run -t 1
+	run -t $(nproc)
+	run -t $(nproc) -g 16
+	run -t 1 -S 32
+	run -t $(nproc) -S 32 -d 3
+	if [ -e $DEBUGFS/swiotlb/io_tlb_nslabs ]; then
+		run -t 1 -f
+		run -t $(nproc) -f -g 16
+	fi
+}
+
+if [ -e $DEBUGFS/swiotlb/io_tlb_nslabs ]; then
+	echo "swiotlb: $(cat $DEBUGFS/swiotlb/io_tlb_nslabs) slabs"
+	if [ -e $DEBUGFS/swiotlb/io_tlb_pools ]; then
+		echo "swiotlb: dynamic pools enabled"
+	fi
+else
+	echo "swiotlb: not active"
+fi
+
+if [ ! -e $SYSDEV/iommu_group ]; then
+	echo "=== $DEV: no IOMMU"
+	unbind
+	bind dma_map_benchmark
+	scenarios
+	exit 0
+fi
+
+GROUP=$(readlink -f $SYSDEV/iommu_group)
+ORIG_TYPE=$(cat $GROUP/type)
+
+for type in $TYPES; do
+	unbind
+	if ! echo $type > $GROUP/type 2>/dev/null; then
+		echo "=== $DEV: can't switch to $type domain, skipped"
+		continue
+	fi
+	bind dma_map_benchmark
+	echo "=== $DEV: $type domain"
+	scenarios
+done
+
+unbind
+echo $ORIG_TYPE > $GROUP/type 2>/dev/null